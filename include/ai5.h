@@ -115,6 +115,15 @@ struct config {
 	bool texthook_stdout;
 	bool no_warp_mouse;
 	bool map_no_wallslide;
+	bool turbo;
+	struct {
+		// output sample rate
+		unsigned frequency;
+		// device buffer size in frames (0 = backend default)
+		unsigned buffer_size;
+		// intermediate mixer chunk size in frames (0 = device buffer size)
+		unsigned chunk_size;
+	} audio;
 	struct {
 		bool enabled;
 		float dead_zone;
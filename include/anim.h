@@ -18,6 +18,7 @@
 #define AI5_ANIM_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 struct anim_draw_call;
@@ -63,6 +64,9 @@ void anim_pause_all_sync(void);
 void anim_unpause_range(unsigned start, unsigned end);
 void anim_unpause_all(void);
 void anim_set_offset(unsigned slot, unsigned x, unsigned y);
+size_t anim_state_size(void);
+void anim_save_state(void *dst);
+void anim_load_state(const void *src);
 void anim_exec_copy_call(unsigned stream);
 void anim_decompose_draw_call(struct anim_draw_call *call, int *dst_x, int *dst_y, int *w,
 		int *h);
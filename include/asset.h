@@ -18,6 +18,9 @@
 #define AI5_ASSET_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 struct archive_data;
 
@@ -46,14 +49,32 @@ bool asset_set_voice2_archive(const char *name);
 bool asset_set_voice3_archive(const char *name);
 bool asset_set_voice4_archive(const char *name);
 
+char *asset_fs_path(const char *name);
 struct archive_data *asset_load(enum asset_type t, const char *name);
 struct archive_data *asset_mes_load(const char *name);
+
+struct asset_mes_cache_stats {
+	unsigned loads;
+	unsigned hits;
+	unsigned misses;
+	unsigned evictions;
+	unsigned nr_cached;
+	unsigned nr_pinned;
+	// total time spent loading MES files on cache misses
+	uint64_t miss_us;
+};
+void asset_mes_cache_get_stats(struct asset_mes_cache_stats *stats);
 struct archive_data *_asset_cg_load(const char *name);
 struct cg *asset_cg_decode(struct archive_data *file);
 struct cg *asset_cg_load(const char *name);
+char *asset_bgm_path(const char *name);
 struct archive_data *asset_bgm_load(const char *name);
+char *asset_data_location(struct archive_data *file, off_t *offset);
 struct archive_data *asset_effect_load(const char *name);
 struct archive_data *asset_voice_load(const char *name);
+void asset_voice_prefetch(const uint8_t *data, size_t size, unsigned max);
+void asset_voice_prefetch_mes(unsigned max);
+void asset_voice_prefetch_idle(void);
 struct archive_data *asset_voicesub_load(const char *name);
 struct archive_data *asset_data_load(const char *name);
 
@@ -69,6 +69,8 @@ void audio_mixer_fade(enum audio_channel ch, int vol, int t, bool stop, bool syn
 void audio_restore_volume(enum audio_channel ch);
 bool audio_is_playing(enum audio_channel ch);
 bool audio_is_fading(enum audio_channel ch);
+const char *audio_get_playing(enum audio_channel ch, unsigned *pos);
+void audio_seek(enum audio_channel ch, unsigned ms);
 
 // convenience functions
 void audio_bgm_play(const char *name, bool check_playing);
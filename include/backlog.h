@@ -17,6 +17,7 @@
 #ifndef AI5_BACKLOG_H
 #define AI5_BACKLOG_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 void backlog_clear(void);
@@ -27,7 +28,11 @@ void backlog_commit(void);
 unsigned backlog_count(void);
 uint32_t backlog_get_pointer(unsigned no);
 bool backlog_has_voice(unsigned no);
+void backlog_prefetch_voice(unsigned no);
 void backlog_set_has_voice(void);
 void backlog_push_byte(uint8_t b);
+size_t backlog_state_size(void);
+void backlog_save_state(void *dst);
+void backlog_load_state(const void *src);
 
 #endif // AI5_BACKLOG_H
@@ -0,0 +1,49 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef AI5_COMPOSITOR_H
+#define AI5_COMPOSITOR_H
+
+#include <stdint.h>
+#include <SDL.h>
+
+/*
+ * Renderer-level compositing for effects which are drawn directly to the
+ * window (bypassing the screen surface).
+ *
+ * A layer is an RGBA texture built from regions of indexed surfaces. The
+ * texture is cached and only rebuilt when the palette changes (or when the
+ * layer is explicitly invalidated). Each frame is drawn as a list of textured
+ * quads with per-vertex alpha; consecutive quads using the same layer are
+ * submitted in a single draw call.
+ */
+
+#define GFX_LAYER_NO_MASK -1
+
+struct gfx_layer;
+
+struct gfx_layer *gfx_layer_new(int w, int h);
+void gfx_layer_free(struct gfx_layer *layer);
+void gfx_layer_add_source(struct gfx_layer *layer, unsigned src_i, int src_x, int src_y,
+		int w, int h, int dst_x, int dst_y, int mask);
+void gfx_layer_invalidate(struct gfx_layer *layer);
+
+void gfx_compositor_begin(void);
+void gfx_compositor_quad(struct gfx_layer *layer, const SDL_Rect *src_r,
+		const SDL_Rect *dst_r, uint8_t alpha_top, uint8_t alpha_bottom);
+void gfx_compositor_present(void);
+
+#endif // AI5_COMPOSITOR_H
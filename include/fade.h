@@ -0,0 +1,59 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef AI5_FADE_H
+#define AI5_FADE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL.h>
+
+/*
+ * Palette fade engine. A fade is started with one of the fade_palette_*
+ * functions and is then advanced by fade_tick() (called from vm_peek). The
+ * palette is computed from the time elapsed since the fade started, so
+ * dropped frames make the steps larger rather than making the fade longer.
+ *
+ * For a blocking fade, call fade_wait() after starting it.
+ *
+ * Fades of the whole display are driven by a separate alpha value (see
+ * fade_alpha_start), which may run alongside a palette fade.
+ */
+
+enum fade_curve {
+	// interpolate linearly over the duration of the fade
+	FADE_LINEAR,
+	// move each color channel by 1 every `step_ms` (so some colors reach
+	// their target before others)
+	FADE_FIXED_STEP,
+};
+
+void fade_palette_start(const SDL_Color *target, const uint8_t *colors, unsigned nr_colors,
+		unsigned ms);
+void fade_palette_start_range(const SDL_Color *target, unsigned start, unsigned n,
+		unsigned ms);
+void fade_palette_start_fixed_step(const SDL_Color *target, unsigned start, unsigned n,
+		unsigned step_ms);
+void fade_tick(void);
+void fade_cancel(bool finish);
+void fade_wait(bool (*cb)(float rate, void *data), void *data);
+bool fade_active(void);
+float fade_rate(uint32_t start_t, unsigned ms);
+void fade_alpha_start(float from, float to, unsigned ms);
+float fade_alpha(void);
+void fade_alpha_wait(bool (*cb)(float alpha, void *data), void *data);
+
+#endif // AI5_FADE_H
@@ -40,6 +40,10 @@ void gfx_overlay_enable(int n);
 void gfx_overlay_disable(int n);
 unsigned gfx_current_surface(void);
 void gfx_set_screen_surface(unsigned i);
+void gfx_set_view_offset(unsigned i, int x, int y);
+void gfx_set_output_offset(unsigned i, int x, int y);
+void gfx_pan_begin(unsigned i);
+void gfx_pan_end(void);
 
 // dialogs
 void gfx_error_message(const char *message);
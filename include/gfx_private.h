@@ -36,13 +36,23 @@
 #define GFX_DIRECT_BPP 24
 #define GFX_DIRECT_FORMAT SDL_PIXELFORMAT_RGB24
 
+#define GFX_MAX_WRITTEN 8
+
+/*
+ * The region `src` of a surface is presented at `dst` in the output. Panning
+ * and shifting are done by the renderer when presenting, without copying or
+ * scaling any pixels.
+ */
 struct gfx_surface {
 	SDL_Surface *s;
-	SDL_Rect src;   // source rectangle for BlitScaled
-	SDL_Rect dst;   // destination rectangle for BlitScaled
-	bool scaled;    // if true, `src` and `rect` differ
+	SDL_Rect src;   // visible region of the surface (src.x/src.y pan the view)
+	SDL_Rect dst;   // output rectangle (only dst.x/dst.y unless `scaled`)
+	bool scaled;    // if true, `src` is scaled to the size of `dst`
 	bool dirty;
 	SDL_Rect damaged;
+	// regions written since the last call to gfx_take_written()
+	SDL_Rect written[GFX_MAX_WRITTEN];
+	unsigned nr_written;
 };
 
 struct gfx_overlay {
@@ -64,7 +74,6 @@ struct gfx {
 	// XXX: we need a non-indexed surface because textures can't be created
 	//      directly from indexed surfaces (...why?)
 	SDL_Surface *display;
-	SDL_Surface *scaled_display;
 	SDL_Texture *texture;
 	SDL_Color palette[256];
 	struct {
@@ -80,6 +89,7 @@ extern struct gfx gfx;
 
 SDL_Surface *gfx_get_surface(unsigned i);
 SDL_Surface *gfx_get_overlay(int n);
+unsigned gfx_take_written(unsigned surface, SDL_Rect *rects);
 void _gfx_update_palette(int start, int n);
 void gfx_update_palette(int start, int n);
 void _gfx_palette_crossfade(SDL_Color *new, unsigned start, unsigned n, unsigned ms);
@@ -74,6 +74,39 @@ extern struct memory memory;
 #define memory_end (memory_raw+sizeof(struct memory))
 extern struct memory_ptr memory_ptr;
 
+/*
+ * Memory usage tracking. `memory` is a zero-initialized static object, so
+ * pages are only backed by the OS once they are written. High-water marks
+ * are kept for the regions whose usage varies by game.
+ */
+enum memory_region {
+	MEMORY_REGION_MEM16,
+	MEMORY_REGION_FILE_DATA,
+	MEMORY_REGION_BACKLOG,
+	MEMORY_NR_REGIONS
+};
+
+struct memory_usage {
+	const char *name;
+	uint32_t size;
+	// offset of the end of the highest byte written
+	uint32_t high_water;
+	// bytes of resident pages overlapping the region (if `have_resident`)
+	uint32_t resident;
+	bool have_resident;
+};
+
+extern uint32_t memory_high_water[MEMORY_NR_REGIONS];
+
+static inline void mem_update_high_water(enum memory_region r, uint32_t end)
+{
+	if (end > memory_high_water[r])
+		memory_high_water[r] = end;
+}
+
+void memory_get_usage(struct memory_usage usage[MEMORY_NR_REGIONS]);
+uint32_t mem_nonzero_end(const uint8_t *p, uint32_t size);
+
 static inline bool mem_ptr_valid(uint8_t *p, int size)
 {
 	return p >= memory_raw && (p + size) <= memory_end;
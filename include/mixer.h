@@ -27,7 +27,17 @@ enum mix_channel {
 	MIXER_MASTER = 4,
 };
 
+struct mixer_latency {
+	unsigned count;
+	float last_ms;
+	float min_ms;
+	float max_ms;
+	float avg_ms;
+};
+
 void mixer_init(void);
+unsigned mixer_get_frequency(void);
+int mixer_get_latency(int n, struct mixer_latency *latency);
 int mixer_get_numof(void);
 const char *mixer_get_name(int n);
 int mixer_set_name(int n, const char *name);
@@ -43,6 +53,7 @@ struct archive_data;
 struct mixer_stream;
 
 struct mixer_stream *mixer_stream_open(struct archive_data *dfile, enum mix_channel mixer);
+struct mixer_stream *mixer_stream_open_path(const char *path, enum mix_channel mixer);
 void mixer_stream_close(struct mixer_stream *ch);
 int mixer_stream_play(struct mixer_stream *ch);
 int mixer_stream_stop(struct mixer_stream *ch);
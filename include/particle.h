@@ -0,0 +1,61 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef AI5_PARTICLE_H
+#define AI5_PARTICLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL.h>
+
+/*
+ * Particle storage for simple sprite effects (falling petals, snow, etc.).
+ *
+ * Particles are stored as a structure of arrays. The meaning of each field
+ * is up to the effect, except for `active`. particles_update() runs a
+ * callback on each active particle in index order; the callback erases and
+ * redraws its particle on the surface and reports the regions it touched
+ * with particles_damage(). At the end of the update those regions are
+ * marked dirty as a single rectangle, rather than each particle dirtying
+ * the whole screen.
+ */
+
+struct particles {
+	unsigned max;
+	unsigned nr_active;
+	// surface which is dirtied by particles_damage()
+	unsigned surface;
+	bool *active;
+	int *x;
+	int *y;
+	int *size;
+	int *speed;
+	int *frame;
+	int *tick;
+	int *age;
+	uint8_t *flags;
+	// region damaged during the current update
+	SDL_Rect damaged;
+};
+
+void particles_init(struct particles *ps, unsigned max, unsigned surface);
+void particles_free(struct particles *ps);
+int particles_spawn(struct particles *ps);
+void particles_kill(struct particles *ps, unsigned i);
+void particles_damage(struct particles *ps, int x, int y, int w, int h);
+void particles_update(struct particles *ps, void (*update)(struct particles*, unsigned));
+
+#endif // AI5_PARTICLE_H
@@ -0,0 +1,69 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef AI5_PROFILE_H
+#define AI5_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nulib.h"
+
+/*
+ * Script profiler. Call counts and cumulative time are collected for a tree
+ * of frames (MES files, procedures, statements, System/Util calls) and can
+ * be dumped as folded stacks (the input format of flamegraph.pl).
+ */
+
+enum profile_frame_type {
+	PROFILE_MES,
+	PROFILE_PROC,
+	PROFILE_STMT,
+	PROFILE_SYS,
+	PROFILE_UTIL,
+};
+
+extern bool profile_enabled;
+extern uint64_t profile_expr_ops;
+extern uint64_t profile_frames;
+
+void profile_start(void);
+void profile_stop(void);
+void profile_reset(void);
+unsigned _profile_push(enum profile_frame_type type, uint32_t id, uint32_t addr);
+unsigned _profile_push_mes(const char *name);
+void _profile_pop(unsigned depth);
+void profile_mes_loaded(void);
+bool profile_dump(const char *path);
+void profile_dump_on_exit(const char *path);
+void profile_print(void);
+
+/*
+ * Enter a frame. Returns a token to be passed to profile_pop() (0 if the
+ * profiler is disabled).
+ */
+#define profile_push(type, id, addr) \
+	(unlikely(profile_enabled) ? _profile_push(type, id, addr) : 0)
+#define profile_push_mes(name) \
+	(unlikely(profile_enabled) ? _profile_push_mes(name) : 0)
+
+static inline void profile_pop(unsigned token)
+{
+	if (unlikely(token))
+		_profile_pop(token);
+}
+
+#endif // AI5_PROFILE_H
@@ -0,0 +1,66 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef AI5_REPLAY_H
+#define AI5_REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Deterministic input recording and playback.
+ *
+ * While recording or replaying, the VM runs on a virtual clock which only
+ * advances through vm_delay(), and the RNG is seeded from the replay file.
+ * Input events are recorded together with the number of the event poll at
+ * which they were delivered, so that playback delivers them at exactly the
+ * same point in execution.
+ *
+ * Audio plays in real time, so the results of audio queries (whether a
+ * channel is playing/fading) are recorded as well, and synchronous fades
+ * wait on the virtual clock. Only changes in the result of each query are
+ * recorded.
+ */
+
+// keys for replay_audio_query()
+#define REPLAY_AUDIO_PLAYING(ch) ((ch) * 2)
+#define REPLAY_AUDIO_FADING(ch) ((ch) * 2 + 1)
+
+union SDL_Event;
+
+enum replay_mode {
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_PLAY,
+};
+
+extern enum replay_mode replay_mode;
+
+void replay_init(const char *record_path, const char *play_path);
+void replay_begin_poll(void);
+bool replay_filter_event(union SDL_Event *e);
+bool replay_next_event(union SDL_Event *e);
+bool replay_get_mouse_state(int *x, int *y);
+uint32_t replay_get_ticks(void);
+void replay_delay(int ms);
+bool replay_audio_query(unsigned key, bool state);
+
+static inline bool replay_active(void)
+{
+	return replay_mode != REPLAY_OFF;
+}
+
+#endif // AI5_REPLAY_H
@@ -0,0 +1,42 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef AI5_RESAMPLE_H
+#define AI5_RESAMPLE_H
+
+/*
+ * Block-based stereo float resampler.
+ *
+ * Rate pairs with a small rational ratio (e.g. 22050 -> 44100, 48000 -> 44100)
+ * use a precomputed polyphase windowed-sinc filter. Other ratios fall back to
+ * linear interpolation.
+ *
+ * Usage (once per output block):
+ *   n = resampler_frames_needed(r, out_frames);
+ *   <write n stereo frames to resampler_input(r)>
+ *   resampler_run(r, out, out_frames);
+ */
+
+struct resampler;
+
+struct resampler *resampler_new(unsigned in_rate, unsigned out_rate, unsigned max_out_frames);
+void resampler_free(struct resampler *r);
+void resampler_reset(struct resampler *r);
+unsigned resampler_frames_needed(struct resampler *r, unsigned out_frames);
+float *resampler_input(struct resampler *r);
+void resampler_run(struct resampler *r, float *out, unsigned out_frames);
+
+#endif // AI5_RESAMPLE_H
@@ -0,0 +1,75 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef AI5_SAVESTATE_H
+#define AI5_SAVESTATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * In-memory save states.
+ *
+ * A save state is a snapshot of the state shared by all games: VM memory
+ * and registers, AIW menu entries, palette, surface pixels, animation
+ * streams, the backlog index and the name of the playing BGM. The snapshot
+ * is split into fixed-size blocks which are compressed individually; blocks
+ * which are unchanged since the previous snapshot are shared rather than
+ * stored again.
+ *
+ * Everything else is NOT saved, and is left as it is when a state is
+ * loaded:
+ *  - static state of game modules (map, dungeon, particles, menus, the
+ *    Shuusaku schedule/view windows, etc.)
+ *  - a fade in progress (it is cancelled, since it would overwrite the
+ *    restored palette)
+ *  - audio other than the BGM and the first voice channel (which are
+ *    restarted at their saved positions; the SDL_mixer backend can't seek,
+ *    so there they restart from the beginning)
+ * A state loaded while one of these differs from when it was saved may
+ * therefore not reproduce the original game state.
+ *
+ * States can only be taken/restored between statements at the top level of
+ * the VM (where no VM state lives on the C stack), or at a wait for a click
+ * which is the first effect of a top-level statement; such a state is saved
+ * as if the statement had not started, so loading it re-enters the wait.
+ * savestate_request_* schedules an operation which is carried out at the
+ * next such point: by savestate_wait_poll() during a wait (a load abandons
+ * the wait), otherwise by savestate_poll() after the current statement.
+ */
+
+struct savestate;
+
+struct savestate *savestate_save(void);
+void savestate_load(struct savestate *st);
+void savestate_free(struct savestate *st);
+// number of bytes of (compressed) block data held uniquely by this state
+size_t savestate_size(struct savestate *st);
+
+void savestate_request_quick_save(void);
+void savestate_request_quick_load(void);
+void savestate_poll(void);
+bool savestate_wait_poll(void);
+
+/*
+ * Rewind. A state is pushed to a memory-bounded ring buffer at each wait for
+ * a click; rewinding restores the state at the previous page's wait, so no
+ * script runs before the wait is re-entered.
+ */
+void savestate_rewind_mark(void);
+void savestate_request_rewind(void);
+
+#endif // AI5_SAVESTATE_H
@@ -49,6 +49,7 @@ void sys_graphics_blend(struct param_list *params);
 void sys_graphics_blend_masked(struct param_list *params);
 void sys_graphics_invert_colors(struct param_list *params);
 void sys_graphics_copy_progressive(struct param_list *params);
+void sys_wait_for_click(bool rewind_point);
 void sys_wait(struct param_list *params);
 void sys_set_text_colors_indexed(struct param_list *params);
 void sys_set_text_colors_indexed_with_sysvar(struct param_list *params);
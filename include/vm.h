@@ -44,6 +44,8 @@ struct vm_mes_call {
 struct vm {
 	struct vm_pointer ip;
 	unsigned scope_counter;
+	// cached (FLAG_LOG && FLAG_LOG_ENABLE); see vm_update_logging()
+	bool logging;
 	// stack for expressions
 	uint16_t stack_ptr;
 	uint32_t stack[VM_STACK_SIZE];
@@ -75,8 +77,10 @@ void vm_init(void);
 void vm_exec(void);
 void vm_exec_aiw(void);
 void vm_peek(void);
+bool vm_is_top_level(void);
+struct vm_pointer vm_top_level_ip(void);
 void vm_load_file(struct archive_data *file, uint32_t offset);
-void vm_load_mes(char *name);
+void vm_load_mes(const char *name);
 void vm_call_procedure(unsigned no);
 
 uint32_t vm_eval(void);
@@ -223,6 +227,7 @@ void vm_stmt_line_old_log(void);
 // input.c
 void vm_delay(int ms);
 uint32_t vm_get_ticks(void);
+bool vm_turbo(void);
 
 attr_warn_unused_result static inline bool vm_flag_is_on(enum game_flag flag)
 {
@@ -231,16 +236,27 @@ attr_warn_unused_result static inline bool vm_flag_is_on(enum game_flag flag)
 	return (mem_get_sysvar16(mes_sysvar16_flags) & game->flags[flag]);
 }
 
+/*
+ * Recompute the cached logging state. This is done at the start of every
+ * statement and whenever a flag is changed through vm_flag_on/vm_flag_off.
+ */
+static inline void vm_update_logging(void)
+{
+	vm.logging = vm_flag_is_on(FLAG_LOG) && vm_flag_is_on(FLAG_LOG_ENABLE);
+}
+
 static inline void vm_flag_on(enum game_flag flag)
 {
 	if (game->flags[flag] == FLAG_ALWAYS_ON)
 		return;
 	mem_set_sysvar16(mes_sysvar16_flags, mem_get_sysvar16(mes_sysvar16_flags) | game->flags[flag]);
+	vm_update_logging();
 }
 
 static inline void vm_flag_off(enum game_flag flag)
 {
 	mem_set_sysvar16(mes_sysvar16_flags, mem_get_sysvar16(mes_sysvar16_flags) & ~(game->flags[flag]));
+	vm_update_logging();
 }
 
 typedef uint32_t vm_timer_t;
@@ -21,10 +21,17 @@
 
 #define STRING_PARAM_SIZE 64
 
+/*
+ * Parameters are decoded without zero-initialization: only the first
+ * `nr_params` entries are valid. String parameters point into the code
+ * buffer (or, for AIW, where strings are not NUL-terminated, into a string
+ * stack that is unwound after the statement) and must be copied by handlers
+ * which modify them or need them after the statement completes.
+ */
 struct param {
 	enum mes_parameter_type type;
 	union {
-		char str[STRING_PARAM_SIZE];
+		const char *str;
 		uint32_t val;
 	};
 };
@@ -38,7 +45,7 @@ struct param_list {
 
 void vm_read_params(struct param_list *params);
 void vm_read_params_aiw(struct param_list *params);
-char *vm_string_param(struct param_list *params, int i);
+const char *vm_string_param(struct param_list *params, int i);
 
 #define vm_expr_param(params, i) _vm_expr_param(params, i, __func__)
 static inline uint32_t _vm_expr_param(struct param_list *params, int i, const char *func) {
@@ -14,6 +14,8 @@
  * along with this program; if not, see <http://gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "nulib.h"
@@ -118,29 +120,173 @@ static void ai_shimai_mem_init(void)
 // XXX: many functions below assume pixel format
 _Static_assert(GFX_DIRECT_FORMAT == SDL_PIXELFORMAT_RGB24);
 
+/*
+ * Character index.
+ *
+ * Font tables are a count followed by a list of character codes, and the
+ * index of a character in the table is the index of its glyph. Looking up a
+ * character is done with a hash table which is built the first time a table
+ * is used. Each hit is checked against the table itself and a miss falls back
+ * to a linear scan (rebuilding the hash table if the character is found), so
+ * loading a different font at the same address is handled transparently.
+ */
+#define FONT_INDEX_CACHE_SIZE 2
+
+struct font_index {
+	const uint8_t *tbl;
+	unsigned size;
+	unsigned mask;
+	// glyph index + 1 (0 = empty slot)
+	uint16_t *slots;
+};
+
+static struct font_index font_index_cache[FONT_INDEX_CACHE_SIZE] = {0};
+static unsigned font_index_next = 0;
+
+static unsigned char_hash(uint16_t ch)
+{
+	return (ch * 0x9e37u) >> 4;
+}
+
+static void font_index_build(struct font_index *fi, const uint8_t *table)
+{
+	unsigned size = le_get16(table, 0);
+	unsigned nr_slots = 16;
+	while (nr_slots < size * 2)
+		nr_slots *= 2;
+
+	fi->tbl = table;
+	fi->size = size;
+	fi->mask = nr_slots - 1;
+	fi->slots = xrealloc(fi->slots, nr_slots * sizeof(uint16_t));
+	memset(fi->slots, 0, nr_slots * sizeof(uint16_t));
+
+	for (unsigned i = 0; i < size; i++) {
+		uint16_t ch = le_get16(table, (i + 1) * 2);
+		unsigned h = char_hash(ch) & fi->mask;
+		// the first occurrence of a character wins
+		while (fi->slots[h] && le_get16(table, fi->slots[h] * 2) != ch)
+			h = (h + 1) & fi->mask;
+		if (!fi->slots[h])
+			fi->slots[h] = i + 1;
+	}
+}
+
+static struct font_index *font_index_get(const uint8_t *table)
+{
+	for (int i = 0; i < FONT_INDEX_CACHE_SIZE; i++) {
+		struct font_index *fi = &font_index_cache[i];
+		if (fi->tbl == table && fi->size == le_get16(table, 0))
+			return fi;
+	}
+	struct font_index *fi = &font_index_cache[font_index_next];
+	font_index_next = (font_index_next + 1) % FONT_INDEX_CACHE_SIZE;
+	font_index_build(fi, table);
+	return fi;
+}
+
 /*
  * Get character index from table.
  */
 static int get_char_index(uint16_t ch, uint8_t *table)
 {
+	struct font_index *fi = font_index_get(table);
+	for (unsigned h = char_hash(ch) & fi->mask; fi->slots[h]; h = (h + 1) & fi->mask) {
+		if (le_get16(table, fi->slots[h] * 2) == ch)
+			return fi->slots[h] - 1;
+	}
+
+	// not in the index: the table may have been overwritten
 	uint16_t size = le_get16(table, 0);
 	for (unsigned i = 0; i < size; i++) {
-		if (le_get16(table, (i + 1) * 2) == ch)
+		if (le_get16(table, (i + 1) * 2) == ch) {
+			font_index_build(fi, table);
 			return i;
+		}
 	}
 	return -1;
 }
 
 /*
- * Blend monochrome color data with an RGB24 pixel at a given alpha level.
+ * Glyph spans.
+ *
+ * Each row of a glyph's mask is split into runs of opaque (> 15),
+ * translucent (1-15) and transparent (0) pixels. Transparent runs are not
+ * stored at all, so rendering a glyph is a loop over its visible runs with
+ * no per-pixel branching. Glyphs are cached by the address of their mask
+ * together with a copy of the mask, which is compared before an entry is
+ * used.
  */
-static void alpha_blend_rgb_mono(uint8_t *bg, uint8_t fg, uint8_t alpha)
+#define GLYPH_CACHE_SIZE 512
+
+struct glyph_span {
+	uint8_t x;
+	uint8_t len;
+	bool opaque;
+};
+
+struct glyph {
+	const uint8_t *msk;
+	int w, h;
+	uint8_t *msk_copy;
+	// index of the first span of each row (h + 1 entries)
+	uint16_t *row_spans;
+	struct glyph_span *spans;
+};
+
+static struct glyph glyph_cache[GLYPH_CACHE_SIZE] = {0};
+
+static unsigned row_count_spans(const uint8_t *msk, int w)
 {
-	uint32_t a = (uint32_t)alpha + 1;
-	uint32_t inv_a = 256 - (uint32_t)alpha;
-	bg[0] = (uint8_t)((a * fg + inv_a * bg[0]) >> 8);
-	bg[1] = (uint8_t)((a * fg + inv_a * bg[1]) >> 8);
-	bg[2] = (uint8_t)((a * fg + inv_a * bg[2]) >> 8);
+	unsigned n = 0;
+	for (int x = 0; x < w; x++) {
+		if (msk[x] && (x == 0 || !msk[x-1] || (msk[x-1] > 15) != (msk[x] > 15)))
+			n++;
+	}
+	return n;
+}
+
+static void glyph_build(struct glyph *g, const uint8_t *msk, int w, int h)
+{
+	unsigned nr_spans = 0;
+	for (int row = 0; row < h; row++) {
+		nr_spans += row_count_spans(msk + row * w, w);
+	}
+
+	g->msk = msk;
+	g->w = w;
+	g->h = h;
+	g->msk_copy = xrealloc(g->msk_copy, w * h);
+	memcpy(g->msk_copy, msk, w * h);
+	g->row_spans = xrealloc(g->row_spans, (h + 1) * sizeof(uint16_t));
+	g->spans = xrealloc(g->spans, max(1, nr_spans) * sizeof(struct glyph_span));
+
+	unsigned n = 0;
+	for (int row = 0; row < h; row++) {
+		const uint8_t *m = msk + row * w;
+		g->row_spans[row] = n;
+		for (int x = 0; x < w;) {
+			if (!m[x]) {
+				x++;
+				continue;
+			}
+			bool opaque = m[x] > 15;
+			int end = x + 1;
+			while (end < w && m[end] && (m[end] > 15) == opaque)
+				end++;
+			g->spans[n++] = (struct glyph_span) { x, end - x, opaque };
+			x = end;
+		}
+	}
+	g->row_spans[h] = n;
+}
+
+static struct glyph *glyph_get(const uint8_t *msk, int w, int h)
+{
+	struct glyph *g = &glyph_cache[((uintptr_t)msk / (w * h)) % GLYPH_CACHE_SIZE];
+	if (g->msk != msk || g->w != w || g->h != h || memcmp(g->msk_copy, msk, w * h))
+		glyph_build(g, msk, w, h);
+	return g;
 }
 
 /*
@@ -155,31 +301,51 @@ static void alpha_blend_rgb_bgr(uint8_t *bg, uint8_t *fg, uint8_t alpha)
 	bg[2] = (uint8_t)((a * fg[0] + inv_a * bg[2]) >> 8);
 }
 
+/*
+ * Blend a run of monochrome color data with RGB24 pixels, at alpha levels
+ * given by the (translucent) mask values.
+ */
+static void blend_span_mono(uint8_t *dst, const uint8_t *fnt, const uint8_t *msk, int len)
+{
+	for (int i = 0; i < len; i++, dst += 3) {
+		uint32_t a = msk[i] * 16 - 7;
+		uint32_t inv_a = 264 - msk[i] * 16;
+		uint32_t fg = a * fnt[i];
+		dst[0] = (uint8_t)((fg + inv_a * dst[0]) >> 8);
+		dst[1] = (uint8_t)((fg + inv_a * dst[1]) >> 8);
+		dst[2] = (uint8_t)((fg + inv_a * dst[2]) >> 8);
+	}
+}
+
 /*
  * This is the simple rendering mode, in which the mask and greyscale color data are
  * merged and written directly to a surface.
  */
-static void render_char_merged(uint8_t *dst_in, uint8_t *fnt_in, uint8_t *msk_in,
-		uint8_t *pal, int char_w, int char_h, int stride)
-{
-	for (int row = 0; row < char_h; row++) {
-		uint8_t *fnt = fnt_in + char_w * row;
-		uint8_t *msk = msk_in + char_w * row;
-		uint8_t *dst = dst_in + row * stride;
-		for (int col = 0; col < char_w; col++, fnt++, msk++, dst += 3) {
-			if (*msk == 0)
-				continue;
+static void render_char_merged(uint8_t *dst_in, uint8_t *fnt_in, struct glyph *g,
+		uint8_t *pal, int stride)
+{
+	for (int row = 0; row < g->h; row++) {
+		const uint8_t *fnt_row = fnt_in + g->w * row;
+		const uint8_t *msk_row = g->msk_copy + g->w * row;
+		uint8_t *dst_row = dst_in + row * stride;
+		for (unsigned i = g->row_spans[row]; i < g->row_spans[row+1]; i++) {
+			struct glyph_span *span = &g->spans[i];
+			const uint8_t *fnt = fnt_row + span->x;
+			const uint8_t *msk = msk_row + span->x;
+			uint8_t *dst = dst_row + span->x * 3;
 			if (pal) {
-				uint8_t alpha = (min(*msk, 15) * 16) - 8;
-				uint8_t *c = pal + *fnt * 3;
-				alpha_blend_rgb_bgr(dst, c, alpha);
-			} else if (*msk > 15) {
-				dst[0] = *fnt;
-				dst[1] = *fnt;
-				dst[2] = *fnt;
+				for (int col = 0; col < span->len; col++, dst += 3) {
+					uint8_t alpha = (min(msk[col], 15) * 16) - 8;
+					alpha_blend_rgb_bgr(dst, pal + fnt[col] * 3, alpha);
+				}
+			} else if (span->opaque) {
+				for (int col = 0; col < span->len; col++, dst += 3) {
+					dst[0] = fnt[col];
+					dst[1] = fnt[col];
+					dst[2] = fnt[col];
+				}
 			} else {
-				uint8_t alpha = (min(*msk, 15) * 16) - 8;
-				alpha_blend_rgb_mono(dst, *fnt, alpha);
+				blend_span_mono(dst, fnt, msk, span->len);
 			}
 		}
 	}
@@ -190,24 +356,28 @@ static void render_char_merged(uint8_t *dst_in, uint8_t *fnt_in, uint8_t *msk_in
  * red channel is blended. The green and blue channels are set to zero whenever the
  * mask is non-zero.
  */
-static void render_char_redscale(uint8_t *dst_in, uint8_t *fnt_in, uint8_t *msk_in,
-		uint8_t *pal, int char_w, int char_h, int stride)
-{
-	for (int row = 0; row < char_h; row++) {
-		uint8_t *fnt = fnt_in + char_w * row;
-		uint8_t *msk = msk_in + char_w * row;
-		uint8_t *dst = dst_in + row * stride;
-		for (int col = 0; col < char_w; col++, fnt++, msk++, dst += 3) {
-			if (*msk == 0)
-				continue;
-			if (*msk > 15) {
-				dst[0] = *fnt;
+static void render_char_redscale(uint8_t *dst_in, uint8_t *fnt_in, struct glyph *g,
+		uint8_t *pal, int stride)
+{
+	for (int row = 0; row < g->h; row++) {
+		const uint8_t *fnt_row = fnt_in + g->w * row;
+		const uint8_t *msk_row = g->msk_copy + g->w * row;
+		uint8_t *dst_row = dst_in + row * stride;
+		for (unsigned i = g->row_spans[row]; i < g->row_spans[row+1]; i++) {
+			struct glyph_span *span = &g->spans[i];
+			const uint8_t *fnt = fnt_row + span->x;
+			uint8_t *dst = dst_row + span->x * 3;
+			if (span->opaque) {
+				for (int col = 0; col < span->len; col++) {
+					dst[col*3] = fnt[col];
+				}
 			} else {
-				uint8_t alpha = (min(*msk, 15) * 16) - 8;
-				alpha_blend_rgb_mono(dst, *fnt, alpha);
+				blend_span_mono(dst, fnt, msk_row + span->x, span->len);
+			}
+			for (int col = 0; col < span->len; col++) {
+				dst[col*3 + 1] = 0;
+				dst[col*3 + 2] = 0;
 			}
-			dst[1] = 0;
-			dst[2] = 0;
 		}
 	}
 }
@@ -217,15 +387,15 @@ static void render_char_redscale(uint8_t *dst_in, uint8_t *fnt_in, uint8_t *msk_
  * the mask data is written 256 lines below the cursor. Merging the two is a separate
  * operation.
  */
-static void render_char_separate(uint8_t *dst_in, uint8_t *fnt_in, uint8_t *msk_in,
-		uint8_t *pal, int char_w, int char_h, int stride)
+static void render_char_separate(uint8_t *dst_in, uint8_t *fnt_in, struct glyph *g,
+		uint8_t *pal, int stride)
 {
-	for (int row = 0; row < char_h; row++) {
-		uint8_t *fnt = fnt_in + char_w * row;
-		uint8_t *msk = msk_in + char_w * row;
+	for (int row = 0; row < g->h; row++) {
+		uint8_t *fnt = fnt_in + g->w * row;
+		uint8_t *msk = g->msk_copy + g->w * row;
 		uint8_t *fnt_dst = dst_in + row * stride;
 		uint8_t *msk_dst = dst_in + (row + 256) * stride;
-		for (int col = 0; col < char_w; col++, fnt++, msk++, fnt_dst += 3, msk_dst += 3) {
+		for (int col = 0; col < g->w; col++, fnt++, msk++, fnt_dst += 3, msk_dst += 3) {
 			if (*fnt) {
 				fnt_dst[0] = *fnt;
 				fnt_dst[1] = *fnt;
@@ -243,7 +413,7 @@ static void render_char_separate(uint8_t *dst_in, uint8_t *fnt_in, uint8_t *msk_
 struct render_text_params {
 	int char_w, char_h;
 	unsigned surface;
-	void (*render_char)(uint8_t*,uint8_t*,uint8_t*,uint8_t*,int,int,int);
+	void (*render_char)(uint8_t*,uint8_t*,struct glyph*,uint8_t*,int);
 	uint8_t *font_tbl;
 	uint8_t *font_msk;
 	uint8_t *font_fnt;
@@ -295,7 +465,8 @@ static void render_text(const char *txt, struct render_text_params *p)
 		uint8_t *char_msk = p->font_msk + (char_i * p->char_w * p->char_h);
 		uint8_t *char_fnt = p->font_fnt + (char_i * p->char_w * p->char_h);
 		uint8_t *dst = surf->pixels + y * surf->pitch + x * 3;
-		p->render_char(dst, char_fnt, char_msk, p->font_pal, p->char_w, p->char_h, surf->pitch);
+		struct glyph *g = glyph_get(char_msk, p->char_w, p->char_h);
+		p->render_char(dst, char_fnt, g, p->font_pal, surf->pitch);
 
 		x += char_space;
 		if (x + char_space > end_x) {
@@ -627,7 +798,12 @@ static void ai_shimai_backlog(struct param_list *params)
 	case 1: backlog_prepare(); break;
 	case 2: backlog_commit(); break;
 	case 3: mem_set_var32(18, backlog_count()); break;
-	case 4: mem_set_var32(18, backlog_get_pointer(vm_expr_param(params, 1))); break;
+	case 4: {
+		unsigned no = vm_expr_param(params, 1);
+		mem_set_var32(18, backlog_get_pointer(no));
+		backlog_prefetch_voice(no);
+		break;
+	}
 	case 5: mem_set_var16(18, backlog_has_voice(vm_expr_param(params, 1))); break;
 	default: WARNING("System.Backlog.function[%u] not implemented",
 				 params->params[0].val);
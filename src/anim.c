@@ -15,6 +15,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 
 #include "nulib.h"
@@ -291,6 +292,25 @@ void anim_set_offset(unsigned slot, unsigned x, unsigned y)
 	streams[slot].off.y = y;
 }
 
+/*
+ * Stream state for save states. The saved state refers to the currently
+ * loaded animation file, so it is only valid within the same process.
+ */
+size_t anim_state_size(void)
+{
+	return sizeof(streams);
+}
+
+void anim_save_state(void *dst)
+{
+	memcpy(dst, streams, sizeof(streams));
+}
+
+void anim_load_state(const void *src)
+{
+	memcpy(streams, src, sizeof(streams));
+}
+
 static uint16_t read_value(struct anim_stream *anim)
 {
 	if (anim_type == ANIM_S4 || anim_type == ANIM_A8)
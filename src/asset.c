@@ -14,17 +14,27 @@
  * along with this program; if not, see <http://gnu.org/licenses/>.
  */
 
+#include <ctype.h>
+#include <SDL.h>
+
 #include "nulib.h"
 #include "nulib/file.h"
 #include "nulib/queue.h"
 #include "ai5/arc.h"
 #include "ai5/cg.h"
+#include "ai5/game.h"
+#include "ai5/mes.h"
 
 #include "ai5.h"
 #include "asset.h"
 #include "game.h"
+#include "memory.h"
+#include "vm.h"
 
 static struct archive *arc[NR_ASSET_TYPES] = {0};
+// filesystem path of each open archive (for reading files in place)
+static char *arc_path[NR_ASSET_TYPES] = {0};
+static unsigned arc_flags[NR_ASSET_TYPES] = {0};
 
 char *asset_mes_name = NULL;
 char *asset_cg_name = NULL;
@@ -38,17 +48,33 @@ char *asset_data_name = NULL;
 bool asset_effect_is_bgm = true;
 
 static void cg_cache_init(void);
+static void voice_index_clear(void);
+static void mes_cache_clear(void);
 
-static struct archive *open_arc(const char *name, unsigned flags)
+static struct archive *open_arc(const char *name, unsigned flags, char **path_out)
 {
 	char *path = path_get_icase(name);
 	if (!path)
 		return NULL;
 	struct archive *arc = archive_open(path, flags);
-	free(path);
+	if (!arc) {
+		free(path);
+		return NULL;
+	}
+	*path_out = path;
 	return arc;
 }
 
+static void set_arc(enum asset_type t, struct archive *ar, char *path, unsigned flags)
+{
+	if (arc[t])
+		archive_close(arc[t]);
+	free(arc_path[t]);
+	arc[t] = ar;
+	arc_path[t] = path;
+	arc_flags[t] = flags;
+}
+
 void asset_init(void)
 {
 	unsigned typ_flags = ARCHIVE_RAW;
@@ -62,7 +88,11 @@ void asset_init(void)
 #define ARC_OPEN(asset_t, conf_t, flags, warn) \
 	if (config.file.conf_t.arc) { \
 		assert(config.file.conf_t.name); \
-		if (!(arc[asset_t] = open_arc(config.file.conf_t.name, flags))) \
+		char *path; \
+		struct archive *ar = open_arc(config.file.conf_t.name, flags, &path); \
+		if (ar) \
+			set_arc(asset_t, ar, path, flags); \
+		else \
 			warn("Failed to open archive \"%s\"", config.file.conf_t.name); \
 	}
 	ARC_OPEN(ASSET_BG,       bg,       typ_flags,  WARNING);
@@ -79,15 +109,16 @@ void asset_init(void)
 #undef ARC_OPEN
 
 	cg_cache_init();
+	voice_index_clear();
+	mes_cache_clear();
 }
 
 void asset_fini(void)
 {
+	voice_index_clear();
+	mes_cache_clear();
 	for (unsigned i = 0; i < ARRAY_SIZE(arc); i++) {
-		if (arc[i]) {
-			archive_close(arc[i]);
-			arc[i] = NULL;
-		}
+		set_arc(i, NULL, NULL, 0);
 	}
 }
 
@@ -97,14 +128,18 @@ static bool set_archive(const char *name, unsigned flags, enum asset_type t,
 	if (cfg->arc && !strcasecmp(cfg->name, name))
 		return true;
 
-	struct archive *ar = open_arc(name, flags);
+	char *path;
+	struct archive *ar = open_arc(name, flags, &path);
 	if (!ar) {
 		NOTICE("failed to open %s", name);
 		return false;
 	}
-	if (arc[t])
-		archive_close(arc[t]);
-	arc[t] = ar;
+	if (t >= ASSET_VOICE && t <= ASSET_VOICE4)
+		voice_index_clear();
+	// cached MES files belong to the old archive
+	if (t == ASSET_MES)
+		mes_cache_clear();
+	set_arc(t, ar, path, flags);
 	cfg->arc = true;
 	if (cfg->name)
 		string_free(cfg->name);
@@ -132,7 +167,11 @@ bool asset_set_voice4_archive(const char *name)
 	return set_archive(name, ARCHIVE_RAW, ASSET_VOICE4, &config.file.voice4);
 }
 
-struct archive_data *asset_fs_load(const char *_name)
+/*
+ * Get the (case-insensitive) filesystem path for an asset which is not
+ * stored in an archive.
+ */
+char *asset_fs_path(const char *_name)
 {
 	// convert to *nix path
 	char *name = xstrdup(_name);
@@ -152,6 +191,12 @@ struct archive_data *asset_fs_load(const char *_name)
 		path = path_get_icase(name);
 	}
 	free(name);
+	return path;
+}
+
+struct archive_data *asset_fs_load(const char *name)
+{
+	char *path = asset_fs_path(name);
 	if (!path)
 		return NULL;
 
@@ -172,18 +217,141 @@ struct archive_data *asset_fs_load(const char *_name)
 	return file;
 }
 
-struct archive_data *asset_mes_load(const char *name)
+/*
+ * MES cache. Loaded MES files are kept (by reference) in a small LRU cache
+ * keyed by name, so that scripts which bounce between a hub MES and its
+ * sub-scenes (MESCALL/MESJMP) don't reload them from the archive each time.
+ * Files which are loaded repeatedly are pinned and never evicted.
+ */
+#define MES_CACHE_SIZE 16
+#define MES_CACHE_MAX_PINNED 8
+#define MES_CACHE_PIN_THRESHOLD 4
+
+struct cached_mes {
+	TAILQ_ENTRY(cached_mes) entry;
+	char name[32];
+	struct archive_data *file;
+	unsigned hits;
+	bool pinned;
+};
+
+static struct cached_mes mes_cache_entry[MES_CACHE_SIZE] = {0};
+static TAILQ_HEAD(mes_cache_head, cached_mes) mes_cache = TAILQ_HEAD_INITIALIZER(mes_cache);
+static struct asset_mes_cache_stats mes_stats = {0};
+
+static struct cached_mes *mes_cache_get(const char *name)
+{
+	struct cached_mes *e;
+	TAILQ_FOREACH(e, &mes_cache, entry) {
+		if (!strcasecmp(e->name, name)) {
+			TAILQ_REMOVE(&mes_cache, e, entry);
+			TAILQ_INSERT_HEAD(&mes_cache, e, entry);
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take another reference to a loaded file. The archive API only provides
+ * archive_data_release(), which drops the reference taken here.
+ */
+static struct archive_data *data_ref(struct archive_data *file)
+{
+	file->ref++;
+	return file;
+}
+
+static void mes_cache_put(const char *name, struct archive_data *file)
+{
+	if (strlen(name) >= sizeof(mes_cache_entry[0].name))
+		return;
+
+	// find a free entry, or evict the least recently used unpinned entry
+	struct cached_mes *e = NULL;
+	for (int i = 0; i < MES_CACHE_SIZE; i++) {
+		if (!mes_cache_entry[i].file) {
+			e = &mes_cache_entry[i];
+			break;
+		}
+	}
+	if (!e) {
+		TAILQ_FOREACH_REVERSE(e, &mes_cache, mes_cache_head, entry) {
+			if (!e->pinned)
+				break;
+		}
+		if (!e)
+			return;
+		TAILQ_REMOVE(&mes_cache, e, entry);
+		archive_data_release(e->file);
+		mes_stats.evictions++;
+	}
+
+	strcpy(e->name, name);
+	e->file = data_ref(file);
+	e->hits = 0;
+	e->pinned = false;
+	TAILQ_INSERT_HEAD(&mes_cache, e, entry);
+}
+
+static void mes_cache_clear(void)
+{
+	struct cached_mes *e;
+	while ((e = TAILQ_FIRST(&mes_cache))) {
+		TAILQ_REMOVE(&mes_cache, e, entry);
+		archive_data_release(e->file);
+		e->file = NULL;
+		e->name[0] = '\0';
+	}
+	mes_stats.nr_pinned = 0;
+}
+
+static struct archive_data *_asset_mes_load(const char *name)
 {
 	if (!arc[ASSET_MES])
 		return asset_fs_load(name);
-	struct archive_data *file = archive_get(arc[ASSET_MES], name);
-	if (!file)
-		return NULL;
+	return archive_get(arc[ASSET_MES], name);
+}
+
+struct archive_data *asset_mes_load(const char *name)
+{
+	struct archive_data *file;
+	mes_stats.loads++;
+
+	struct cached_mes *e = mes_cache_get(name);
+	if (e) {
+		mes_stats.hits++;
+		if (!e->pinned && ++e->hits >= MES_CACHE_PIN_THRESHOLD
+				&& mes_stats.nr_pinned < MES_CACHE_MAX_PINNED) {
+			e->pinned = true;
+			mes_stats.nr_pinned++;
+		}
+		file = data_ref(e->file);
+	} else {
+		uint64_t start = SDL_GetPerformanceCounter();
+		if (!(file = _asset_mes_load(name)))
+			return NULL;
+		mes_stats.misses++;
+		mes_stats.miss_us += (SDL_GetPerformanceCounter() - start) * 1000000
+			/ SDL_GetPerformanceFrequency();
+		mes_cache_put(name, file);
+	}
+
 	free(asset_mes_name);
 	asset_mes_name = xstrdup(name);
 	return file;
 }
 
+void asset_mes_cache_get_stats(struct asset_mes_cache_stats *stats)
+{
+	*stats = mes_stats;
+	stats->nr_cached = 0;
+	for (int i = 0; i < MES_CACHE_SIZE; i++) {
+		if (mes_cache_entry[i].file)
+			stats->nr_cached++;
+	}
+}
+
 struct cached_cg {
 	TAILQ_ENTRY(cached_cg) entry;
 	unsigned key;
@@ -306,6 +474,43 @@ struct archive_data *asset_bgm_load(const char *name)
 	return file;
 }
 
+/*
+ * Get the filesystem path of a BGM file, or NULL if BGM is stored in an
+ * archive (in which case asset_bgm_load should be used).
+ */
+char *asset_bgm_path(const char *name)
+{
+	if (arc[ASSET_BGM])
+		return NULL;
+	char *path = asset_fs_path(name);
+	if (!path)
+		return NULL;
+	free(asset_bgm_name);
+	asset_bgm_name = xstrdup(name);
+	return path;
+}
+
+/*
+ * Get the location of an archived file on disk, so that it can be read in
+ * place instead of being loaded into memory. Returns the path of the
+ * archive and stores the offset of the file within it in `offset`, or
+ * returns NULL if the file isn't stored as-is in an open archive.
+ */
+char *asset_data_location(struct archive_data *file, off_t *offset)
+{
+	if (!file->archive || file->archive->meta.type == ARCHIVE_TYPE_AWD)
+		return NULL;
+	for (unsigned i = 0; i < ARRAY_SIZE(arc); i++) {
+		if (arc[i] != file->archive)
+			continue;
+		if (!arc_path[i] || !(arc_flags[i] & ARCHIVE_RAW))
+			return NULL;
+		*offset = file->meta.offset;
+		return xstrdup(arc_path[i]);
+	}
+	return NULL;
+}
+
 struct archive_data *asset_effect_load(const char *name)
 {
 	if (asset_effect_is_bgm)
@@ -320,21 +525,283 @@ struct archive_data *asset_effect_load(const char *name)
 	return file;
 }
 
-struct archive_data *asset_voice_load(const char *name)
+/*
+ * Voice index: maps a (case-folded) voice file name to the voice archive
+ * which contains it, so that a voice is looked up in a single archive
+ * regardless of how many voice archives are open. Entries (including
+ * misses) are added the first time a name is looked up, and the index is
+ * cleared whenever a voice archive is replaced.
+ */
+#define VOICE_NOT_FOUND -1
+#define VOICE_NAME_MAX 32
+
+struct voice_index_entry {
+	char *name;
+	uint32_t hash;
+	int type;
+};
+
+static struct voice_index_entry *voice_index = NULL;
+static unsigned voice_index_cap = 0;
+static unsigned voice_index_nr = 0;
+
+/*
+ * Prefetched voice files. Each entry holds a reference to its archive_data
+ * so that the file is already loaded when the voice is played.
+ */
+#define VOICE_PREFETCH_SIZE 8
+
+struct prefetched_voice {
+	char name[VOICE_NAME_MAX];
+	struct archive_data *file;
+};
+
+static struct prefetched_voice voice_prefetch[VOICE_PREFETCH_SIZE] = {0};
+static unsigned voice_prefetch_next = 0;
+// extension of the last voice file loaded (used to recognize voice names in
+// MES bytecode)
+static char voice_ext[4] = {0};
+
+static uint32_t voice_name_hash(const char *name)
+{
+	uint32_t h = 2166136261u;
+	for (const char *p = name; *p; p++) {
+		h ^= (uint8_t)toupper((uint8_t)*p);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void voice_prefetch_clear(void)
+{
+	for (unsigned i = 0; i < VOICE_PREFETCH_SIZE; i++) {
+		if (voice_prefetch[i].file)
+			archive_data_release(voice_prefetch[i].file);
+		voice_prefetch[i].name[0] = '\0';
+		voice_prefetch[i].file = NULL;
+	}
+	voice_prefetch_next = 0;
+}
+
+static void voice_index_clear(void)
+{
+	for (unsigned i = 0; i < voice_index_cap; i++) {
+		free(voice_index[i].name);
+	}
+	free(voice_index);
+	voice_index = NULL;
+	voice_index_cap = 0;
+	voice_index_nr = 0;
+	voice_prefetch_clear();
+}
+
+static struct voice_index_entry *voice_index_slot(struct voice_index_entry *table,
+		unsigned cap, const char *name, uint32_t hash)
+{
+	for (unsigned i = hash & (cap - 1);; i = (i + 1) & (cap - 1)) {
+		if (!table[i].name)
+			return &table[i];
+		if (table[i].hash == hash && !strcasecmp(table[i].name, name))
+			return &table[i];
+	}
+}
+
+static void voice_index_grow(void)
 {
+	unsigned cap = voice_index_cap ? voice_index_cap * 2 : 256;
+	struct voice_index_entry *table = xcalloc(cap, sizeof(struct voice_index_entry));
+	for (unsigned i = 0; i < voice_index_cap; i++) {
+		struct voice_index_entry *e = &voice_index[i];
+		if (e->name)
+			*voice_index_slot(table, cap, e->name, e->hash) = *e;
+	}
+	free(voice_index);
+	voice_index = table;
+	voice_index_cap = cap;
+}
+
+/*
+ * Get the asset type of the voice archive containing `name`, or
+ * VOICE_NOT_FOUND. If `file` is not NULL, the file is loaded and returned
+ * through it.
+ */
+static int voice_index_lookup(const char *name, struct archive_data **file)
+{
+	uint32_t hash = voice_name_hash(name);
+	struct voice_index_entry *e = NULL;
+	if (voice_index_cap) {
+		e = voice_index_slot(voice_index, voice_index_cap, name, hash);
+		if (e->name) {
+			if (file && e->type != VOICE_NOT_FOUND)
+				*file = archive_get(arc[e->type], name);
+			return e->type;
+		}
+	}
+
+	// not indexed yet: search each voice archive in turn
+	int type = VOICE_NOT_FOUND;
+	struct archive_data *data = NULL;
+	for (int t = ASSET_VOICE; t <= ASSET_VOICE4; t++) {
+		if (arc[t] && (data = archive_get(arc[t], name))) {
+			type = t;
+			break;
+		}
+	}
+	if (file)
+		*file = data;
+	else if (data)
+		archive_data_release(data);
+
+	if (!e || (voice_index_nr + 1) * 2 > voice_index_cap) {
+		voice_index_grow();
+		e = voice_index_slot(voice_index, voice_index_cap, name, hash);
+	}
+	e->name = xstrdup(name);
+	e->hash = hash;
+	e->type = type;
+	voice_index_nr++;
+	return type;
+}
+
+static struct prefetched_voice *voice_prefetch_get(const char *name)
+{
+	for (unsigned i = 0; i < VOICE_PREFETCH_SIZE; i++) {
+		if (voice_prefetch[i].file && !strcasecmp(voice_prefetch[i].name, name))
+			return &voice_prefetch[i];
+	}
+	return NULL;
+}
+
+static void voice_prefetch_name(const char *name)
+{
+	if (voice_prefetch_get(name))
+		return;
+
 	struct archive_data *file;
-	if (arc[ASSET_VOICE] && (file = archive_get(arc[ASSET_VOICE], name)))
-		goto found;
-	if (arc[ASSET_VOICE2] && (file = archive_get(arc[ASSET_VOICE2], name)))
-		goto found;
-	if (arc[ASSET_VOICE3] && (file = archive_get(arc[ASSET_VOICE3], name)))
+	if (voice_index_lookup(name, &file) == VOICE_NOT_FOUND || !file)
+		return;
+
+	struct prefetched_voice *slot = &voice_prefetch[voice_prefetch_next];
+	voice_prefetch_next = (voice_prefetch_next + 1) % VOICE_PREFETCH_SIZE;
+	if (slot->file)
+		archive_data_release(slot->file);
+	strcpy(slot->name, name);
+	slot->file = file;
+}
+
+static bool is_voice_name_char(uint8_t c)
+{
+	return isalnum(c) || c == '_' || c == '-' || c == '.';
+}
+
+static const char *voice_name_ext(const char *name, size_t len)
+{
+	const char *dot = memchr(name, '.', len);
+	if (!dot || len - (dot - name) != 4 || dot == name)
+		return NULL;
+	return dot + 1;
+}
+
+/*
+ * Check if a string has the shape of a voice file name (a base name and the
+ * same 3-character extension as previously loaded voices). This rejects
+ * most other string parameters without touching the voice index.
+ */
+static bool is_voice_name(const uint8_t *s, size_t len)
+{
+	const char *ext = voice_name_ext((const char*)s, len);
+	return ext && voice_ext[0] && !strncasecmp(ext, voice_ext, 3);
+}
+
+/*
+ * Scan MES bytecode for string parameters naming voice files and load them
+ * ahead of time. At most `max` voices are prefetched.
+ */
+void asset_voice_prefetch(const uint8_t *data, size_t size, unsigned max)
+{
+	if (!arc[ASSET_VOICE] && !arc[ASSET_VOICE2] && !arc[ASSET_VOICE3]
+			&& !arc[ASSET_VOICE4])
+		return;
+
+	const uint8_t marker = game_is_aiwin() ? 0xf5 : MES_PARAM_STRING;
+	const uint8_t term = game_is_aiwin() ? 0xff : 0;
+	unsigned nr_found = 0;
+	for (size_t i = 0; i + 1 < size && nr_found < max; i++) {
+		if (data[i] != marker)
+			continue;
+		size_t len = 0;
+		while (i + 1 + len < size && len < VOICE_NAME_MAX
+				&& is_voice_name_char(data[i + 1 + len]))
+			len++;
+		if (len < 5 || len >= VOICE_NAME_MAX || i + 1 + len >= size
+				|| data[i + 1 + len] != term || !is_voice_name(data + i + 1, len))
+			continue;
+
+		char name[VOICE_NAME_MAX];
+		memcpy(name, data + i + 1, len);
+		name[len] = '\0';
+		if (voice_index_lookup(name, NULL) != VOICE_NOT_FOUND) {
+			voice_prefetch_name(name);
+			nr_found++;
+		}
+		i += len + 1;
+	}
+}
+
+#define VOICE_PREFETCH_WINDOW 4096
+
+// number of voices to prefetch at the next idle point
+static unsigned voice_prefetch_pending = 0;
+
+/*
+ * Request that up to `max` voices referenced by the MES code following the
+ * instruction pointer be prefetched. The prefetch is carried out by
+ * asset_voice_prefetch_idle(), so that it doesn't delay the caller.
+ */
+void asset_voice_prefetch_mes(unsigned max)
+{
+	if (max > voice_prefetch_pending)
+		voice_prefetch_pending = max;
+}
+
+/*
+ * Carry out a pending prefetch request. Called when the VM is idle (i.e.
+ * from vm_delay).
+ */
+void asset_voice_prefetch_idle(void)
+{
+	if (likely(!voice_prefetch_pending))
+		return;
+	unsigned n = voice_prefetch_pending;
+	voice_prefetch_pending = 0;
+
+	uint8_t *p = vm.ip.code + vm.ip.ptr;
+	if (p < memory_raw || p >= memory_end)
+		return;
+	size_t size = min((size_t)VOICE_PREFETCH_WINDOW, (size_t)(memory_end - p));
+	asset_voice_prefetch(p, size, n);
+}
+
+struct archive_data *asset_voice_load(const char *name)
+{
+	struct archive_data *file = NULL;
+	struct prefetched_voice *pv = voice_prefetch_get(name);
+	if (pv) {
+		// hand the prefetched reference to the caller
+		file = pv->file;
+		pv->name[0] = '\0';
+		pv->file = NULL;
 		goto found;
-	if (arc[ASSET_VOICE4] && (file = archive_get(arc[ASSET_VOICE4], name)))
+	}
+	if (voice_index_lookup(name, &file) != VOICE_NOT_FOUND && file)
 		goto found;
 	return asset_fs_load(name);
 found:
 	free(asset_voice_name);
 	asset_voice_name = xstrdup(name);
+	const char *ext = voice_name_ext(name, strlen(name));
+	if (ext)
+		memcpy(voice_ext, ext, 4);
 	return file;
 }
 
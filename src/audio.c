@@ -24,6 +24,7 @@
 #include "audio.h"
 #include "game.h"
 #include "mixer.h"
+#include "replay.h"
 #include "vm.h"
 
 struct channel {
@@ -78,6 +79,22 @@ static void channel_play(struct channel *ch, struct archive_data *file, bool che
 	}
 }
 
+static void channel_play_path(struct channel *ch, const char *path, const char *name,
+		bool check_playing)
+{
+	if (check_playing && ch->file_name && !strcmp(name, ch->file_name)) {
+		if (ch->ch && mixer_stream_is_playing(ch->ch))
+			return;
+	}
+
+	channel_stop(ch);
+
+	if ((ch->ch = mixer_stream_open_path(path, ch->id))) {
+		mixer_stream_play(ch->ch);
+		ch->file_name = strdup(name);
+	}
+}
+
 static void channel_set_volume(struct channel *ch, int vol)
 {
 	mixer_set_volume(ch->id, get_linear_volume(vol));
@@ -93,7 +110,10 @@ static void channel_fade(struct channel *ch, int vol, int t, bool stop, bool syn
 
 	mixer_stream_fade(ch->ch, t, end_vol, stop);
 	if (sync) {
-		while (mixer_stream_is_fading(ch->ch)) {
+		// while recording/replaying, wait on the VM clock instead of the mixer
+		uint32_t start_t = vm_get_ticks();
+		while (replay_active() ? vm_get_ticks() - start_t < (unsigned)t
+				: mixer_stream_is_fading(ch->ch)) {
 			vm_peek();
 			vm_delay(16);
 		}
@@ -109,7 +129,9 @@ static void channel_mixer_fade(struct channel *ch, int vol, int t, bool stop, bo
 
 	mixer_fade(ch->id, t, end_vol, stop);
 	if (sync) {
-		while (mixer_is_fading(ch->id)) {
+		uint32_t start_t = vm_get_ticks();
+		while (replay_active() ? vm_get_ticks() - start_t < (unsigned)t
+				: mixer_is_fading(ch->id)) {
 			vm_peek();
 			vm_delay(16);
 		}
@@ -126,6 +148,17 @@ static bool channel_is_fading(struct channel *ch)
 	return ch->ch && mixer_stream_is_fading(ch->ch);
 }
 
+static unsigned channel_get_pos(struct channel *ch)
+{
+	return ch->ch ? mixer_stream_get_pos(ch->ch) : 0;
+}
+
+static void channel_seek(struct channel *ch, unsigned ms)
+{
+	if (ch->ch)
+		mixer_stream_seek(ch->ch, ms);
+}
+
 static struct channel channels[] = {
 	[AUDIO_CH_BGM]    = { .id = MIXER_MUSIC },
 	[AUDIO_CH_SE0]    = { .id = MIXER_EFFECT },
@@ -17,6 +17,8 @@
 // NOTE: This file is included by the actual audio implementation file
 //       (audio.c, audio_sdl_mixer.c).
 
+#include "replay.h"
+
 #if 0
 #define AUDIO_LOG(...) NOTICE(__VA_ARGS__)
 #else
@@ -25,11 +27,15 @@
 
 // XXX: The audio implementation provides this interface.
 static void channel_play(struct channel *ch, struct archive_data *file, bool check_playing);
+static void channel_play_path(struct channel *ch, const char *path, const char *name,
+		bool check_playing);
 static void channel_set_volume(struct channel *ch, int vol);
 static void channel_fade(struct channel *ch, int vol, int t, bool stop, bool sync);
 static void channel_mixer_fade(struct channel *ch, int vol, int t, bool stop, bool sync);
 static bool channel_is_playing(struct channel *ch);
 static bool channel_is_fading(struct channel *ch);
+static unsigned channel_get_pos(struct channel *ch);
+static void channel_seek(struct channel *ch, unsigned ms);
 
 void audio_play(enum audio_channel ch, struct archive_data *file, bool check_playing)
 {
@@ -67,17 +73,47 @@ void audio_mixer_fade(enum audio_channel ch, int vol, int t, bool stop, bool syn
 bool audio_is_playing(enum audio_channel ch)
 {
 	AUDIO_LOG("audio_is_playing(%s)", audio_channel_name(ch));
-	return channel_is_playing(&channels[ch]);
+	return replay_audio_query(REPLAY_AUDIO_PLAYING(ch), channel_is_playing(&channels[ch]));
 }
 
 bool audio_is_fading(enum audio_channel ch)
 {
 	AUDIO_LOG("audio_is_fading(%s)", audio_channel_name(ch));
-	return channel_is_fading(&channels[ch]);
+	return replay_audio_query(REPLAY_AUDIO_FADING(ch), channel_is_fading(&channels[ch]));
+}
+
+/*
+ * Get the name of the file playing on a channel (NULL if none) and its
+ * position in milliseconds.
+ */
+const char *audio_get_playing(enum audio_channel ch, unsigned *pos)
+{
+	struct channel *c = &channels[ch];
+	if (!c->file_name || !channel_is_playing(c))
+		return NULL;
+	*pos = channel_get_pos(c);
+	return c->file_name;
+}
+
+void audio_seek(enum audio_channel ch, unsigned ms)
+{
+	AUDIO_LOG("audio_seek(%s, %u)", audio_channel_name(ch), ms);
+	channel_seek(&channels[ch], ms);
 }
 
 void audio_bgm_play(const char *name, bool check_playing)
 {
+	// BGM files on the filesystem are opened by path, so that the mixer can
+	// read them incrementally (the SDL_mixer backend still loads them whole)
+	char *path = asset_bgm_path(name);
+	if (path) {
+		AUDIO_LOG("audio_play(%s, \"%s\", %s)", audio_channel_name(AUDIO_CH_BGM),
+				path, check_playing ? "true" : "false");
+		channel_play_path(&channels[AUDIO_CH_BGM], path, name, check_playing);
+		free(path);
+		return;
+	}
+
 	struct archive_data *file = asset_bgm_load(name);
 	if (!file) {
 		WARNING("Failed to load BGM file: %s", name);
@@ -130,6 +166,9 @@ void audio_voice_play(const char *name, unsigned ch)
 	}
 	audio_play(AUDIO_CH_VOICE(ch), file, false);
 	archive_data_release(file);
+
+	// warm the voices for the next few lines of text (once the VM is idle)
+	asset_voice_prefetch_mes(4);
 }
 
 void audio_voice_stop(unsigned ch)
@@ -15,6 +15,9 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <stdatomic.h>
 #include <sndfile.h>
 #include <SDL.h>
@@ -22,8 +25,10 @@
 #include "nulib.h"
 #include "ai5/arc.h"
 
+#include "ai5.h"
 #include "asset.h"
 #include "mixer.h"
+#include "resample.h"
 
 #define muldiv(x, y, denom) ((int64_t)(x) * (int64_t)(y) / (int64_t)(denom))
 
@@ -35,7 +40,8 @@
 #define STS_MIXER_IMPLEMENTATION
 #include "sts_mixer.h"
 
-#define CHUNK_SIZE 1024
+// number of frames mixed per refill of an intermediate mixer/stream buffer
+static unsigned chunk_size = 1024;
 
 struct fade {
 	atomic_bool fading;
@@ -46,11 +52,46 @@ struct fade {
 	float end_volume;
 };
 
+/*
+ * Decoded audio for a stream which is read from disk. The reader thread
+ * decodes ahead of playback into this ring, so that the audio callback
+ * never waits on file I/O.
+ */
+struct stream_ring {
+	// stereo frames at the file's sample rate
+	float *data;
+	// position in the file of each frame
+	uint_least32_t *pos;
+	// size in frames (a power of two)
+	unsigned size;
+	// frames written by the reader thread
+	atomic_uint head;
+	// frames consumed by the audio callback
+	atomic_uint tail;
+	// the reader reached the end of the stream
+	atomic_bool complete;
+	// position in the file of the next frame to be played
+	atomic_uint_least32_t frame;
+	// decode buffer (reader thread)
+	float *buf;
+};
+
 struct mixer_stream {
-	// archive data
+	// archive data (NULL when streaming from disk)
 	struct archive_data *dfile;
 	int mixer_no;
 
+	// file data (streamed): the audio file occupies `fp_size` bytes at
+	// `fp_base` in `fp` (an archive, or the file itself)
+	FILE *fp;
+	off_t fp_base;
+	sf_count_t fp_size;
+	struct stream_ring ring;
+	// the stream must be rewound before it is played again
+	atomic_bool rewind;
+	// next stream in the reader thread's list
+	struct mixer_stream *reader_next;
+
 	// audio file data
 	SNDFILE *file;
 	SF_INFO info;
@@ -59,9 +100,16 @@ struct mixer_stream {
 	// stream data
 	atomic_int voice;
 	sts_mixer_stream_t stream;
-	float data[CHUNK_SIZE * 2];
+	float *data;
 
-	// main thread read-only
+	// time at which the stream was started (for latency measurement)
+	uint64_t trigger_time;
+
+	// resampler (NULL if the file is at the mixer sample rate)
+	struct resampler *resampler;
+
+	// position of the decoder in the file (main thread read-only; for streams
+	// read from disk, the played position is ring.frame)
 	atomic_uint_least32_t frame;
 
 	atomic_uint volume;
@@ -77,7 +125,7 @@ struct mixer {
 	sts_mixer_stream_t stream;
 	int voice;
 	atomic_bool muted;
-	float data[CHUNK_SIZE * 2];
+	float *data;
 	char *name;
 
 	struct mixer *parent;
@@ -85,6 +133,12 @@ struct mixer {
 	int nr_children;
 
 	struct fade fade;
+
+	// output frame at which the next chunk mixed by this mixer starts playing
+	uint64_t next_frame;
+
+	// trigger-to-output latency of streams played on this mixer
+	struct mixer_latency latency;
 };
 
 static struct mixer *master = NULL;
@@ -92,16 +146,44 @@ static struct mixer *mixers = NULL;
 static int nr_mixers = 0;
 
 static SDL_AudioDeviceID audio_device = 0;
+static SDL_AudioSpec audio_spec = {0};
+
+// time at which the current audio callback started
+static uint64_t callback_time = 0;
+// number of frames output before the current audio callback
+static uint64_t callback_frame = 0;
+// output frame at which the chunk currently being mixed starts playing
+static uint64_t chunk_frame = 0;
+
+/*
+ * The reader thread decodes streams which are read from disk. It holds
+ * `reader_lock` while decoding; the main thread takes it (before the audio
+ * device lock, never after) to seek or close such a stream.
+ */
+static SDL_Thread *reader_thread = NULL;
+static SDL_mutex *reader_lock = NULL;
+static SDL_sem *reader_sem = NULL;
+static struct mixer_stream *reader_streams = NULL;
+
+// minimum size of a stream's ring, in frames
+#define RING_MIN_FRAMES 16384
+// maximum number of frames decoded per read
+#define RING_READ_FRAMES 2048
+// time between refills when the audio callback doesn't signal the reader
+#define READER_INTERVAL 20
 
 /*
  * The SDL2 audio callback.
  */
 static void audio_callback(void *data, Uint8 *stream, int len)
 {
-	sts_mixer_mix_audio(&master->mixer, stream, len / (sizeof(float) * 2));
+	unsigned frames = len / (sizeof(float) * 2);
+	callback_time = SDL_GetPerformanceCounter();
+	sts_mixer_mix_audio(&master->mixer, stream, frames);
 	if (master->muted) {
 		memset(stream, 0, len);
 	}
+	callback_frame += frames;
 }
 
 /*
@@ -199,26 +281,209 @@ static float cb_calc_fade(struct fade *fade)
 	return gain;
 }
 
-static int refill_stream(sts_mixer_sample_t *sample, void *data)
+/*
+ * Read `frame_count` frames from the file into `out` as stereo.
+ */
+static int cb_read_stereo(struct mixer_stream *ch, float *out, unsigned frame_count,
+		uint_least32_t *num_read)
 {
-	struct mixer_stream *ch = data;
-	uint_least32_t frames_read;
-	memset(ch->data, 0, sizeof(float) * sample->length);
+	memset(out, 0, sizeof(float) * frame_count * 2);
 
 	// read audio data from file
-	int r = cb_read_frames(ch, ch->data, CHUNK_SIZE, &frames_read);
+	int r = cb_read_frames(ch, out, frame_count, num_read);
 
 	// convert mono to stereo
 	if (ch->info.channels == 1) {
-		for (int i = CHUNK_SIZE-1; i >= 0; i--) {
-			ch->data[i*2+1] = ch->data[i];
-			ch->data[i*2] = ch->data[i];
+		for (int i = frame_count-1; i >= 0; i--) {
+			out[i*2+1] = out[i];
+			out[i*2] = out[i];
+		}
+	}
+	return r;
+}
+
+/*
+ * Decode ahead into the ring of a stream which is read from disk. Called with
+ * `reader_lock` held, or before the stream is added to the reader's list.
+ */
+static void ring_fill(struct mixer_stream *ch)
+{
+	struct stream_ring *r = &ch->ring;
+	bool looped = false;
+	while (!r->complete) {
+		unsigned head = r->head;
+		if (r->size - (head - r->tail) < RING_READ_FRAMES)
+			return;
+		if (ch->frame >= ch->loop_end && !cb_loop(ch)) {
+			r->complete = true;
+			return;
+		}
+
+		unsigned n = min(RING_READ_FRAMES, ch->loop_end - ch->frame);
+		sf_count_t got = sf_readf_float(ch->file, r->buf, n);
+		if (got <= 0) {
+			// the file ended early (see cb_read_frames)
+			if (looped || !cb_loop(ch)) {
+				r->complete = true;
+				return;
+			}
+			looped = true;
+			continue;
+		}
+		looped = false;
+
+		for (sf_count_t i = 0; i < got; i++) {
+			unsigned j = (head + i) & (r->size - 1);
+			if (ch->info.channels == 1) {
+				r->data[j*2] = r->buf[i];
+				r->data[j*2+1] = r->buf[i];
+			} else {
+				r->data[j*2] = r->buf[i*2];
+				r->data[j*2+1] = r->buf[i*2+1];
+			}
+			r->pos[j] = ch->frame + i;
+		}
+		ch->frame += got;
+		r->head = head + got;
+	}
+}
+
+/*
+ * Read `frame_count` decoded frames from the ring of a stream. If the reader
+ * thread has fallen behind, the rest of the chunk is silent.
+ */
+static int ring_read(struct mixer_stream *ch, float *out, unsigned frame_count,
+		uint_least32_t *num_read)
+{
+	struct stream_ring *r = &ch->ring;
+	// the reader sets `complete` after writing its last frames
+	bool complete = r->complete;
+	unsigned head = r->head;
+	unsigned tail = r->tail;
+	unsigned n = min(frame_count, head - tail);
+	for (unsigned i = 0; i < n; i++) {
+		unsigned j = (tail + i) & (r->size - 1);
+		out[i*2] = r->data[j*2];
+		out[i*2+1] = r->data[j*2+1];
+	}
+	memset(out + n*2, 0, sizeof(float) * (frame_count - n) * 2);
+	if (n)
+		r->frame = r->pos[(tail + n - 1) & (r->size - 1)] + 1;
+	r->tail = tail + n;
+	*num_read = n;
+
+	if (!SDL_SemValue(reader_sem))
+		SDL_SemPost(reader_sem);
+	if (complete && head == r->tail) {
+		ch->rewind = true;
+		return STS_STREAM_COMPLETE;
+	}
+	return STS_STREAM_CONTINUE;
+}
+
+static int stream_read(struct mixer_stream *ch, float *out, unsigned frame_count,
+		uint_least32_t *num_read)
+{
+	if (ch->fp)
+		return ring_read(ch, out, frame_count, num_read);
+	return cb_read_stereo(ch, out, frame_count, num_read);
+}
+
+/*
+ * Discard the decoded frames of a stream after its decoder was moved. Called
+ * with both `reader_lock` and the audio device lock held.
+ */
+static void ring_reset(struct mixer_stream *ch)
+{
+	ch->ring.head = 0;
+	ch->ring.tail = 0;
+	ch->ring.complete = false;
+	ch->ring.frame = ch->frame;
+}
+
+/*
+ * Seek a stream which is read from disk. The audio device is only locked to
+ * discard the old frames, so the audio callback doesn't wait on file I/O.
+ */
+static bool stream_seek(struct mixer_stream *ch, uint_least32_t pos)
+{
+	SDL_LockMutex(reader_lock);
+	bool r = cb_seek(ch, pos);
+	SDL_LockAudioDevice(audio_device);
+	ring_reset(ch);
+	if (ch->resampler)
+		resampler_reset(ch->resampler);
+	ch->rewind = false;
+	SDL_UnlockAudioDevice(audio_device);
+	ring_fill(ch);
+	SDL_UnlockMutex(reader_lock);
+	return r;
+}
+
+static int reader_main(void *data)
+{
+	while (true) {
+		SDL_SemWaitTimeout(reader_sem, READER_INTERVAL);
+		SDL_LockMutex(reader_lock);
+		for (struct mixer_stream *ch = reader_streams; ch; ch = ch->reader_next) {
+			ring_fill(ch);
 		}
+		SDL_UnlockMutex(reader_lock);
+	}
+	return 0;
+}
+
+/*
+ * Record the latency between a stream being started and its first chunk
+ * reaching the output device.
+ *
+ * Mixers render whole chunks ahead of the output position, so the first
+ * chunk of a stream may start playing several callbacks after it was mixed.
+ * The position of that chunk in the output is tracked exactly; the time it
+ * takes the device to play out a queued buffer is not reported by SDL, so
+ * the device buffer duration is added as an estimate.
+ */
+static void cb_record_latency(struct mixer_stream *ch)
+{
+	struct mixer_latency *l = &mixers[ch->mixer_no].latency;
+	uint64_t freq = SDL_GetPerformanceFrequency();
+	float wait_ms = callback_time > ch->trigger_time
+		? (float)(callback_time - ch->trigger_time) * 1000.f / freq : 0.f;
+	float queued = (float)(int64_t)(chunk_frame - callback_frame) + audio_spec.samples;
+	float ms = wait_ms + queued * 1000.f / audio_spec.freq;
+	ch->trigger_time = 0;
+
+	l->last_ms = ms;
+	if (!l->count || ms < l->min_ms)
+		l->min_ms = ms;
+	if (!l->count || ms > l->max_ms)
+		l->max_ms = ms;
+	l->avg_ms = (l->avg_ms * l->count + ms) / (l->count + 1);
+	l->count++;
+}
+
+static int refill_stream(sts_mixer_sample_t *sample, void *data)
+{
+	struct mixer_stream *ch = data;
+	uint_least32_t frames_read;
+	int r;
+
+	if (ch->trigger_time)
+		cb_record_latency(ch);
+
+	if (ch->resampler) {
+		// read just enough frames at the file's rate to produce one chunk
+		// at the mixer's rate
+		unsigned n = resampler_frames_needed(ch->resampler, chunk_size);
+		r = stream_read(ch, resampler_input(ch->resampler), n, &frames_read);
+		resampler_run(ch->resampler, ch->data, chunk_size);
+	} else {
+		r = stream_read(ch, ch->data, chunk_size, &frames_read);
 	}
 
 	// reverse LR channels
-	else if (ch->swapped) {
-		for (int i = 0; i < CHUNK_SIZE; i++) {
+	if (ch->swapped && ch->info.channels != 1) {
+		for (int i = 0; i < chunk_size; i++) {
 			float tmp = ch->data[i*2];
 			ch->data[i*2] = ch->data[i*2+1];
 			ch->data[i*2+1] = tmp;
@@ -236,7 +501,13 @@ static int refill_stream(sts_mixer_sample_t *sample, void *data)
 			ch->fade.fading = false;
 			ch->volume = ch->fade.end_volume * 100.0;
 			if (ch->fade.stop) {
-				cb_seek(ch, 0);
+				// streams read from disk are rewound by the main thread
+				if (ch->fp) {
+					ch->rewind = true;
+					ch->ring.frame = 0;
+				} else {
+					cb_seek(ch, 0);
+				}
 				r = STS_STREAM_COMPLETE;
 			}
 		}
@@ -257,7 +528,9 @@ static int refill_mixer(sts_mixer_sample_t *sample, void *data)
 	struct mixer *mixer = data;
 
 	// mix child mixers/streams
-	sts_mixer_mix_audio(&mixer->mixer, &mixer->data, CHUNK_SIZE);
+	chunk_frame = mixer->next_frame;
+	mixer->next_frame += chunk_size;
+	sts_mixer_mix_audio(&mixer->mixer, mixer->data, chunk_size);
 	if (mixer->muted) {
 		memset(mixer->data, 0, sizeof(float) * sample->length);
 	}
@@ -267,7 +540,7 @@ static int refill_mixer(sts_mixer_sample_t *sample, void *data)
 		float gain = cb_calc_fade(&mixer->fade);
 		mixer->mixer.gain = gain;
 
-		mixer->fade.elapsed += CHUNK_SIZE;
+		mixer->fade.elapsed += chunk_size;
 		if (mixer->fade.elapsed >= mixer->fade.frames) {
 			mixer->fade.fading = false;
 			if (mixer->fade.stop) {
@@ -281,12 +554,17 @@ static int refill_mixer(sts_mixer_sample_t *sample, void *data)
 
 int mixer_stream_play(struct mixer_stream *ch)
 {
+	if (ch->fp && ch->rewind)
+		stream_seek(ch, 0);
 	SDL_LockAudioDevice(audio_device);
 	if (ch->voice >= 0) {
 		SDL_UnlockAudioDevice(audio_device);
 		return 1;
 	}
-	memset(ch->data, 0, sizeof(ch->data));
+	memset(ch->data, 0, sizeof(float) * chunk_size * 2);
+	if (ch->resampler)
+		resampler_reset(ch->resampler);
+	ch->trigger_time = SDL_GetPerformanceCounter();
 	ch->voice = sts_mixer_play_stream(&mixers[ch->mixer_no].mixer, &ch->stream, 1.0f);
 	SDL_UnlockAudioDevice(audio_device);
 	return 1;
@@ -299,7 +577,13 @@ int mixer_stream_stop(struct mixer_stream *ch)
 		SDL_UnlockAudioDevice(audio_device);
 		return 1;
 	}
-	cb_seek(ch, 0);
+	if (ch->fp) {
+		// rewound when played again, to keep file I/O out of the lock
+		ch->rewind = true;
+		ch->ring.frame = 0;
+	} else {
+		cb_seek(ch, 0);
+	}
 	sts_mixer_stop_voice(&mixers[ch->mixer_no].mixer, ch->voice);
 	ch->voice = -1;
 	SDL_UnlockAudioDevice(audio_device);
@@ -313,9 +597,11 @@ int mixer_stream_is_playing(struct mixer_stream *ch)
 
 int mixer_stream_set_loop_count(struct mixer_stream *ch, int count)
 {
+	SDL_LockMutex(reader_lock);
 	SDL_LockAudioDevice(audio_device);
 	ch->loop_count = count;
 	SDL_UnlockAudioDevice(audio_device);
+	SDL_UnlockMutex(reader_lock);
 	return 1;
 }
 
@@ -326,17 +612,21 @@ int mixer_stream_get_loop_count(struct mixer_stream *ch)
 
 int mixer_stream_set_loop_start_pos(struct mixer_stream *ch, int pos)
 {
+	SDL_LockMutex(reader_lock);
 	SDL_LockAudioDevice(audio_device);
 	ch->loop_start = pos;
 	SDL_UnlockAudioDevice(audio_device);
+	SDL_UnlockMutex(reader_lock);
 	return 1;
 }
 
 int mixer_stream_set_loop_end_pos(struct mixer_stream *ch, int pos)
 {
+	SDL_LockMutex(reader_lock);
 	SDL_LockAudioDevice(audio_device);
 	ch->loop_end = pos;
 	SDL_UnlockAudioDevice(audio_device);
+	SDL_UnlockMutex(reader_lock);
 	return 1;
 }
 
@@ -398,9 +688,14 @@ int mixer_stream_is_paused(struct mixer_stream *ch)
 	return 0;
 }
 
+static uint_least32_t stream_frame(struct mixer_stream *ch)
+{
+	return ch->fp ? ch->ring.frame : ch->frame;
+}
+
 int mixer_stream_get_pos(struct mixer_stream *ch)
 {
-	return muldiv(ch->frame, 1000, ch->info.samplerate);
+	return muldiv(stream_frame(ch), 1000, ch->info.samplerate);
 }
 
 int mixer_stream_get_length(struct mixer_stream *ch)
@@ -411,7 +706,7 @@ int mixer_stream_get_length(struct mixer_stream *ch)
 
 int mixer_stream_get_sample_pos(struct mixer_stream *ch)
 {
-	return ch->frame;
+	return stream_frame(ch);
 }
 
 int mixer_stream_get_sample_length(struct mixer_stream *ch)
@@ -421,8 +716,12 @@ int mixer_stream_get_sample_length(struct mixer_stream *ch)
 
 int mixer_stream_seek(struct mixer_stream *ch, int pos)
 {
+	if (ch->fp)
+		return stream_seek(ch, muldiv(pos, ch->info.samplerate, 1000));
 	SDL_LockAudioDevice(audio_device);
 	int r = cb_seek(ch, muldiv(pos, ch->info.samplerate, 1000));
+	if (ch->resampler)
+		resampler_reset(ch->resampler);
 	SDL_UnlockAudioDevice(audio_device);
 	return r;
 }
@@ -445,12 +744,14 @@ int mixer_stream_get_time_length(struct mixer_stream *ch)
 
 static sf_count_t mixer_stream_vio_get_filelen(void *data)
 {
-	return ((struct mixer_stream*)data)->dfile->size;
+	struct mixer_stream *ch = data;
+	return ch->fp ? ch->fp_size : (sf_count_t)ch->dfile->size;
 }
 
 static sf_count_t mixer_stream_vio_seek(sf_count_t offset, int whence, void *data)
 {
 	struct mixer_stream *ch = data;
+	sf_count_t size = mixer_stream_vio_get_filelen(data);
 	switch (whence) {
 	case SEEK_CUR:
 		ch->offset += offset;
@@ -459,18 +760,25 @@ static sf_count_t mixer_stream_vio_seek(sf_count_t offset, int whence, void *dat
 		ch->offset = offset;
 		break;
 	case SEEK_END:
-		ch->offset = ch->dfile->size + offset;
+		ch->offset = size + offset;
 		break;
 	}
-	ch->offset = clamp(0, (sf_count_t)ch->dfile->size, ch->offset);
+	ch->offset = clamp(0, size, ch->offset);
 	return ch->offset;
 }
 
 static sf_count_t mixer_stream_vio_read(void *ptr, sf_count_t count, void *data)
 {
 	struct mixer_stream *ch = data;
-	sf_count_t c = min(count, (sf_count_t)ch->dfile->size - ch->offset);
-	memcpy(ptr, ch->dfile->data + ch->offset, c);
+	sf_count_t c = min(count, mixer_stream_vio_get_filelen(data) - ch->offset);
+	if (ch->fp) {
+		// only called from the reader thread (or with reader_lock held)
+		if (fseeko(ch->fp, ch->fp_base + ch->offset, SEEK_SET))
+			return 0;
+		c = fread(ptr, 1, c, ch->fp);
+	} else {
+		memcpy(ptr, ch->dfile->data + ch->offset, c);
+	}
 	ch->offset += c;
 	return c;
 }
@@ -493,18 +801,24 @@ static SF_VIRTUAL_IO mixer_stream_vio = {
 	.tell = mixer_stream_vio_tell
 };
 
-struct mixer_stream *mixer_stream_open(struct archive_data *dfile, enum mix_channel mixer)
+static void mixer_stream_free(struct mixer_stream *ch)
 {
-	struct mixer_stream *ch = xcalloc(1, sizeof(struct mixer_stream));
-
-	// take ownership of archive file
-	if (!archive_data_load(dfile)) {
-		WARNING("Failed to load archive file: %s", dfile->name);
-		free(ch);
-		return NULL;
-	}
-	ch->dfile = dfile;
+	if (ch->dfile)
+		archive_data_release(ch->dfile);
+	if (ch->fp)
+		fclose(ch->fp);
+	if (ch->resampler)
+		resampler_free(ch->resampler);
+	free(ch->ring.data);
+	free(ch->ring.pos);
+	free(ch->ring.buf);
+	free(ch->data);
+	free(ch);
+}
 
+static struct mixer_stream *stream_init(struct mixer_stream *ch, struct archive_data *dfile,
+		enum mix_channel mixer)
+{
 	// open file
 	ch->file = sf_open_virtual(&mixer_stream_vio, SFM_READ, &ch->info, ch);
 	if (sf_error(ch->file) != SF_ERR_NO_ERROR) {
@@ -517,11 +831,16 @@ struct mixer_stream *mixer_stream_open(struct archive_data *dfile, enum mix_chan
 	}
 
 	// create stream
+	unsigned mixer_rate = mixers[mixer].mixer.frequency;
+	if ((unsigned)ch->info.samplerate != mixer_rate) {
+		ch->resampler = resampler_new(ch->info.samplerate, mixer_rate, chunk_size);
+	}
+	ch->data = xcalloc(chunk_size * 2, sizeof(float));
 	ch->stream.userdata = ch;
 	ch->stream.callback = refill_stream;
-	ch->stream.sample.frequency = ch->info.samplerate;
+	ch->stream.sample.frequency = mixer_rate;
 	ch->stream.sample.audio_format = STS_MIXER_SAMPLE_FORMAT_FLOAT;
-	ch->stream.sample.length = CHUNK_SIZE * 2;
+	ch->stream.sample.length = chunk_size * 2;
 	ch->stream.sample.data = ch->data;
 	ch->voice = -1;
 
@@ -532,7 +851,7 @@ struct mixer_stream *mixer_stream_open(struct archive_data *dfile, enum mix_chan
 	unsigned loop_start = 0;
 	unsigned loop_end = 0;
 	unsigned loop_count = 0;
-	if (dfile->archive && dfile->archive->meta.type == ARCHIVE_TYPE_AWD) {
+	if (dfile && dfile->archive && dfile->archive->meta.type == ARCHIVE_TYPE_AWD) {
 		// loop info stored in archive
 		if (dfile->meta.loop_start != 0xffffffff) {
 			// XXX: convert to sample offsets (assuming 16-bit mono PCM)
@@ -565,21 +884,127 @@ struct mixer_stream *mixer_stream_open(struct archive_data *dfile, enum mix_chan
 	return ch;
 
 error:
-	archive_data_release(dfile);
-	free(ch);
+	if (ch->file)
+		sf_close(ch->file);
+	mixer_stream_free(ch);
 	return NULL;
 }
 
+/*
+ * Open a stream which reads `size` bytes at `base` in the file at `path`
+ * (or the whole file, if `size` is negative) incrementally, rather than
+ * loading it up front. The file is decoded ahead of playback by the reader
+ * thread.
+ */
+static struct mixer_stream *stream_open_file(const char *path, off_t base, sf_count_t size,
+		struct archive_data *dfile, enum mix_channel mixer)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		WARNING("fopen(\"%s\"): %s", path, strerror(errno));
+		return NULL;
+	}
+
+	struct mixer_stream *ch = xcalloc(1, sizeof(struct mixer_stream));
+	ch->fp = fp;
+	ch->fp_base = base;
+	ch->fp_size = size;
+	if (size < 0 && (fseeko(fp, 0, SEEK_END) || (ch->fp_size = ftello(fp)) < 0)) {
+		WARNING("Failed to get size of file: %s", path);
+		mixer_stream_free(ch);
+		return NULL;
+	}
+	if (!(ch = stream_init(ch, dfile, mixer)))
+		return NULL;
+
+	// size the ring for a few chunks at the file's rate
+	unsigned need = chunk_size;
+	if (ch->resampler)
+		need = resampler_frames_needed(ch->resampler, chunk_size) + 1;
+	ch->ring.size = RING_MIN_FRAMES;
+	while (ch->ring.size < need * 4)
+		ch->ring.size *= 2;
+	ch->ring.data = xcalloc(ch->ring.size * 2, sizeof(float));
+	ch->ring.pos = xcalloc(ch->ring.size, sizeof(uint_least32_t));
+	ch->ring.buf = xcalloc(RING_READ_FRAMES * 2, sizeof(float));
+	ch->ring.frame = ch->frame;
+
+	// decode the start of the stream now, so that it can be played at once
+	ring_fill(ch);
+	SDL_LockMutex(reader_lock);
+	ch->reader_next = reader_streams;
+	reader_streams = ch;
+	SDL_UnlockMutex(reader_lock);
+	return ch;
+}
+
+struct mixer_stream *mixer_stream_open(struct archive_data *dfile, enum mix_channel mixer)
+{
+	// read the file in place if it is stored as-is in an archive on disk
+	off_t offset;
+	char *path;
+	if (!dfile->data && (path = asset_data_location(dfile, &offset))) {
+		struct mixer_stream *ch = stream_open_file(path, offset, dfile->size, dfile, mixer);
+		free(path);
+		if (ch)
+			return ch;
+	}
+
+	struct mixer_stream *ch = xcalloc(1, sizeof(struct mixer_stream));
+
+	// take ownership of archive file
+	if (!archive_data_load(dfile)) {
+		WARNING("Failed to load archive file: %s", dfile->name);
+		free(ch);
+		return NULL;
+	}
+	ch->dfile = dfile;
+	return stream_init(ch, dfile, mixer);
+}
+
+struct mixer_stream *mixer_stream_open_path(const char *path, enum mix_channel mixer)
+{
+	return stream_open_file(path, 0, -1, NULL, mixer);
+}
+
 void mixer_stream_close(struct mixer_stream *ch)
 {
 	mixer_stream_stop(ch);
+	if (ch->fp) {
+		SDL_LockMutex(reader_lock);
+		struct mixer_stream **p = &reader_streams;
+		while (*p != ch)
+			p = &(*p)->reader_next;
+		*p = ch->reader_next;
+		SDL_UnlockMutex(reader_lock);
+	}
 	sf_close(ch->file);
-	archive_data_release(ch->dfile);
-	free(ch);
+	mixer_stream_free(ch);
 }
 
 void mixer_init(void)
 {
+	// initialize SDL audio
+	// The device is opened first so that the mixer graph can adapt to the
+	// negotiated sample rate and buffer size.
+	SDL_AudioSpec want = {
+		.format = AUDIO_F32,
+		.freq = config.audio.frequency,
+		.channels = 2,
+		.samples = config.audio.buffer_size ? config.audio.buffer_size : 1024,
+		.callback = audio_callback,
+	};
+	audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &audio_spec,
+			SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+	if (!audio_device) {
+		WARNING("SDL_OpenAudioDevice failed: %s", SDL_GetError());
+		audio_spec = want;
+	}
+	chunk_size = config.audio.chunk_size ? config.audio.chunk_size : audio_spec.samples;
+	NOTICE("audio: %d Hz, %u frame buffer (%.1f ms), %u frame chunks",
+			audio_spec.freq, audio_spec.samples,
+			(float)audio_spec.samples * 1000.f / audio_spec.freq, chunk_size);
+
 	nr_mixers = 5;
 	mixers = xcalloc(nr_mixers, sizeof(struct mixer));
 	mixers[MIXER_MUSIC].name = strdup("Music");
@@ -595,7 +1020,7 @@ void mixer_init(void)
 
 	// initialize mixers
 	for (int i = 0; i < nr_mixers; i++) {
-		sts_mixer_init(&mixers[i].mixer, 44100, STS_MIXER_SAMPLE_FORMAT_FLOAT);
+		sts_mixer_init(&mixers[i].mixer, audio_spec.freq, STS_MIXER_SAMPLE_FORMAT_FLOAT);
 		mixers[i].mixer.gain = 1.0f;
 	}
 
@@ -603,28 +1028,46 @@ void mixer_init(void)
 	for (int i = 0; i < nr_mixers; i++) {
 		if (&mixers[i] == master)
 			continue;
+		mixers[i].data = xcalloc(chunk_size * 2, sizeof(float));
 		mixers[i].stream.userdata = &mixers[i];
 		mixers[i].stream.callback = refill_mixer;
-		mixers[i].stream.sample.frequency = 44100;
+		mixers[i].stream.sample.frequency = audio_spec.freq;
 		mixers[i].stream.sample.audio_format = STS_MIXER_SAMPLE_FORMAT_FLOAT;
-		mixers[i].stream.sample.length = CHUNK_SIZE * 2;
+		mixers[i].stream.sample.length = chunk_size * 2;
 		mixers[i].stream.sample.data = mixers[i].data;
+		// the first (silent) chunk is played before the stream is refilled
+		mixers[i].next_frame = chunk_size;
 		mixers[i].voice = sts_mixer_play_stream(&mixers[i].parent->mixer, &mixers[i].stream, 1.0f);
 	}
 
-	// initialize SDL audio
-	SDL_AudioSpec have;
-	SDL_AudioSpec want = {
-		.format = AUDIO_F32,
-		.freq = 44100,
-		.channels = 2,
-		.samples = CHUNK_SIZE,
-		.callback = audio_callback,
-	};
-	audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+	// start the reader thread for streams read from disk
+	if (!(reader_lock = SDL_CreateMutex()) || !(reader_sem = SDL_CreateSemaphore(0)))
+		ERROR("Failed to create audio reader lock: %s", SDL_GetError());
+	if (!(reader_thread = SDL_CreateThread(reader_main, "audio reader", NULL)))
+		ERROR("Failed to create audio reader thread: %s", SDL_GetError());
+
 	SDL_PauseAudioDevice(audio_device, 0);
 }
 
+unsigned mixer_get_frequency(void)
+{
+	return master->mixer.frequency;
+}
+
+/*
+ * Get the (estimated) trigger-to-output latency statistics for streams played
+ * on a mixer.
+ */
+int mixer_get_latency(int n, struct mixer_latency *latency)
+{
+	if (n < 0 || n >= nr_mixers)
+		return 0;
+	SDL_LockAudioDevice(audio_device);
+	*latency = mixers[n].latency;
+	SDL_UnlockAudioDevice(audio_device);
+	return 1;
+}
+
 int mixer_get_numof(void)
 {
 	return nr_mixers;
@@ -21,6 +21,7 @@
 #include "nulib.h"
 #include "ai5/arc.h"
 
+#include "ai5.h"
 #include "asset.h"
 #include "audio.h"
 #include "game.h"
@@ -53,7 +54,8 @@ void audio_fini(void)
 void audio_init(void)
 {
 	Mix_Init(0);
-	if (Mix_OpenAudio(44100, AUDIO_S16LSB, 2, 2048) < 0) {
+	int buffer_size = config.audio.buffer_size ? config.audio.buffer_size : 2048;
+	if (Mix_OpenAudio(config.audio.frequency, AUDIO_S16LSB, 2, buffer_size) < 0) {
 		ERROR("Mix_OpenAudio");
 	}
 	atexit(audio_fini);
@@ -112,6 +114,25 @@ static void channel_play(struct channel *ch, struct archive_data *file, bool che
 	ch->file_name = strdup(file->name);
 }
 
+/*
+ * Play a file by path. Mix_LoadWAV_RW decodes the whole file into a chunk, so
+ * unlike the mixer backend this doesn't stream the file.
+ */
+static void channel_play_path(struct channel *ch, const char *path, const char *name,
+		bool check_playing)
+{
+	if (check_playing && ch->file_name && !strcmp(ch->file_name, name))
+		return;
+	channel_stop(ch);
+	ch->chunk = Mix_LoadWAV_RW(SDL_RWFromFile(path, "rb"), 1);
+	if (!ch->chunk) {
+		WARNING("Failed to decode audio file on channel %u: \"%s\"", ch->id, path);
+		return;
+	}
+	Mix_PlayChannel(ch->id, ch->chunk, ch->repeat);
+	ch->file_name = strdup(name);
+}
+
 static void channel_set_volume(struct channel *ch, int vol)
 {
 	if (ch->fade.fading)
@@ -184,6 +205,16 @@ static bool channel_is_fading(struct channel *ch)
 	return ch->fade.fading;
 }
 
+// SDL_mixer can't seek within a chunk: files are always played from the start
+static unsigned channel_get_pos(struct channel *ch)
+{
+	return 0;
+}
+
+static void channel_seek(struct channel *ch, unsigned ms)
+{
+}
+
 static struct channel channels[] = {
 	[AUDIO_CH_BGM] = { .id = 0, .repeat = -1 },
 	[AUDIO_CH_SE0] = { .id = 1 },
@@ -19,6 +19,7 @@
 #include "nulib.h"
 #include "ai5/mes.h"
 
+#include "asset.h"
 #include "backlog.h"
 #include "game.h"
 #include "memory.h"
@@ -43,6 +44,38 @@ static unsigned backlog_head = 0;
 static unsigned backlog_tail = 0;
 bool backlog_empty = true;
 
+// index of the backlog, as stored in a save state (the data itself is part
+// of VM memory)
+struct backlog_state {
+	struct backlog_entry entries[MEMORY_BACKLOG_NR_ENTRIES];
+	unsigned head;
+	unsigned tail;
+	bool empty;
+};
+
+size_t backlog_state_size(void)
+{
+	return sizeof(struct backlog_state);
+}
+
+void backlog_save_state(void *dst)
+{
+	struct backlog_state *s = dst;
+	memcpy(s->entries, backlog, sizeof(backlog));
+	s->head = backlog_head;
+	s->tail = backlog_tail;
+	s->empty = backlog_empty;
+}
+
+void backlog_load_state(const void *src)
+{
+	const struct backlog_state *s = src;
+	memcpy(backlog, s->entries, sizeof(backlog));
+	backlog_head = s->head;
+	backlog_tail = s->tail;
+	backlog_empty = s->empty;
+}
+
 static inline uint8_t *backlog_data(unsigned no)
 {
 	return memory.backlog + no * MEMORY_BACKLOG_DATA_SIZE;
@@ -56,8 +89,9 @@ static unsigned translate_index(unsigned no)
 void backlog_clear(void)
 {
 	BACKLOG_LOG("backlog_clear()");
+	// only clear up to the last non-zero byte, so that unused pages stay untouched
+	memset(memory.backlog, 0, mem_nonzero_end(memory.backlog, sizeof(memory.backlog)));
 	memset(backlog, 0, sizeof(backlog));
-	memset(memory.backlog, 0, sizeof(memory.backlog));
 	backlog_head = 0;
 	backlog_tail = 0;
 	backlog_empty = true;
@@ -150,6 +184,19 @@ uint32_t backlog_get_pointer(unsigned no)
 	return offsetof(struct memory, backlog) + no * MEMORY_BACKLOG_DATA_SIZE;
 }
 
+/*
+ * Load the voice of a backlog entry ahead of time. Called by the backlog
+ * UI when an entry is displayed, in case its voice is replayed.
+ */
+void backlog_prefetch_voice(unsigned no)
+{
+	if (no >= MEMORY_BACKLOG_NR_ENTRIES)
+		return;
+	no = translate_index(no);
+	if (backlog[no].present && backlog[no].has_voice)
+		asset_voice_prefetch(backlog_data(no), MEMORY_BACKLOG_DATA_SIZE, 1);
+}
+
 bool backlog_has_voice(unsigned no)
 {
 	BACKLOG_LOG("backlog_has_voice(%u)", no);
@@ -178,4 +225,6 @@ void backlog_push_byte(uint8_t b)
 	uint8_t *data = backlog_data(backlog_head);
 	data[e->ptr++] = b;
 	data[e->ptr] = 0;
+	mem_update_high_water(MEMORY_REGION_BACKLOG,
+			backlog_head * MEMORY_BACKLOG_DATA_SIZE + min(e->ptr + 1, MEMORY_BACKLOG_DATA_SIZE));
 }
@@ -362,7 +362,12 @@ static void beyond_backlog(struct param_list *params)
 	case 1: backlog_prepare(); break;
 	case 2: backlog_commit(); break;
 	case 3: mem_set_var32(18, backlog_count()); break;
-	case 4: mem_set_var32(18, backlog_get_pointer(vm_expr_param(params, 1))); break;
+	case 4: {
+		unsigned no = vm_expr_param(params, 1);
+		mem_set_var32(18, backlog_get_pointer(no));
+		backlog_prefetch_voice(no);
+		break;
+	}
 	case 5: mem_set_var16(18, backlog_has_voice(vm_expr_param(params, 1))); break;
 	default: VM_ERROR("System.Backlog.function[%u] not implemented",
 				 params->params[0].val);
@@ -0,0 +1,274 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "nulib.h"
+
+#include "compositor.h"
+#include "gfx_private.h"
+#include "profile.h"
+
+// SDL_RenderGeometry is available since SDL 2.0.18 (on all renderers,
+// including the software renderer)
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define HAVE_RENDER_GEOMETRY 1
+#endif
+
+#define LAYER_MAX_SOURCES 8
+
+struct layer_source {
+	unsigned i;
+	SDL_Rect src;
+	SDL_Point dst;
+	int mask;
+};
+
+struct gfx_layer {
+	int w, h;
+	SDL_Texture *t;
+	// palette the texture was built with
+	SDL_Color palette[256];
+	bool valid;
+	unsigned nr_sources;
+	struct layer_source sources[LAYER_MAX_SOURCES];
+};
+
+struct gfx_layer *gfx_layer_new(int w, int h)
+{
+	struct gfx_layer *layer = xcalloc(1, sizeof(struct gfx_layer));
+	layer->w = w;
+	layer->h = h;
+	return layer;
+}
+
+void gfx_layer_free(struct gfx_layer *layer)
+{
+	if (layer->t)
+		SDL_DestroyTexture(layer->t);
+	free(layer);
+}
+
+/*
+ * Add a region of an indexed surface to the layer. Pixels of color `mask`
+ * are transparent (pass GFX_LAYER_NO_MASK for an opaque region).
+ */
+void gfx_layer_add_source(struct gfx_layer *layer, unsigned src_i, int src_x, int src_y,
+		int w, int h, int dst_x, int dst_y, int mask)
+{
+	if (layer->nr_sources >= LAYER_MAX_SOURCES) {
+		WARNING("Too many layer sources");
+		return;
+	}
+	layer->sources[layer->nr_sources++] = (struct layer_source) {
+		.i = src_i,
+		.src = { src_x, src_y, w, h },
+		.dst = { dst_x, dst_y },
+		.mask = mask,
+	};
+	layer->valid = false;
+}
+
+/*
+ * Force the layer to be rebuilt before it is next drawn (e.g. because the
+ * source surfaces were modified).
+ */
+void gfx_layer_invalidate(struct gfx_layer *layer)
+{
+	layer->valid = false;
+}
+
+static void layer_build(struct gfx_layer *layer)
+{
+	if (!layer->t) {
+		SDL_CTOR(SDL_CreateTexture, layer->t, gfx.renderer, SDL_PIXELFORMAT_RGBA32,
+				SDL_TEXTUREACCESS_STREAMING, layer->w, layer->h);
+		SDL_CALL(SDL_SetTextureBlendMode, layer->t, SDL_BLENDMODE_BLEND);
+	}
+
+	// RGBA32 is R,G,B,A in memory regardless of endianness
+	uint8_t lut[256][4];
+	for (int i = 0; i < 256; i++) {
+		lut[i][0] = gfx.palette[i].r;
+		lut[i][1] = gfx.palette[i].g;
+		lut[i][2] = gfx.palette[i].b;
+		lut[i][3] = 255;
+	}
+
+	void *pixels;
+	int pitch;
+	SDL_CALL(SDL_LockTexture, layer->t, NULL, &pixels, &pitch);
+	memset(pixels, 0, (size_t)pitch * layer->h);
+	for (unsigned n = 0; n < layer->nr_sources; n++) {
+		struct layer_source *source = &layer->sources[n];
+		SDL_Surface *src = gfx_get_surface(source->i);
+		if (src->format->format != GFX_INDEXED_FORMAT) {
+			WARNING("Layer source is not an indexed surface");
+			continue;
+		}
+		// clip to both surfaces
+		SDL_Rect src_r = source->src;
+		SDL_Point dst_p = source->dst;
+		SDL_Surface dst = { .w = layer->w, .h = layer->h };
+		if (!gfx_copy_clip(src, &src_r, &dst, &dst_p))
+			continue;
+		for (int row = 0; row < src_r.h; row++) {
+			uint8_t *src_p = src->pixels + (src_r.y + row) * src->pitch + src_r.x;
+			uint8_t *dst_p = (uint8_t*)pixels + (dst_p.y + row) * pitch + dst_p.x * 4;
+			for (int col = 0; col < src_r.w; col++, src_p++, dst_p += 4) {
+				if (*src_p != source->mask)
+					memcpy(dst_p, lut[*src_p], 4);
+			}
+		}
+	}
+	SDL_UnlockTexture(layer->t);
+
+	memcpy(layer->palette, gfx.palette, sizeof(layer->palette));
+	layer->valid = true;
+}
+
+static SDL_Texture *layer_texture(struct gfx_layer *layer)
+{
+	if (!layer->valid || memcmp(layer->palette, gfx.palette, sizeof(layer->palette)))
+		layer_build(layer);
+	return layer->t;
+}
+
+#ifdef HAVE_RENDER_GEOMETRY
+static struct {
+	SDL_Texture *t;
+	SDL_Vertex *vertices;
+	int *indices;
+	int nr_quads;
+	int max_quads;
+} batch = {0};
+
+static void batch_flush(void)
+{
+	if (!batch.nr_quads)
+		return;
+	SDL_CALL(SDL_RenderGeometry, gfx.renderer, batch.t, batch.vertices, batch.nr_quads * 4,
+			batch.indices, batch.nr_quads * 6);
+	batch.nr_quads = 0;
+}
+
+static void batch_add_quad(SDL_Texture *t, const SDL_Rect *src_r, const SDL_Rect *dst_r,
+		int tex_w, int tex_h, uint8_t alpha_top, uint8_t alpha_bottom)
+{
+	if (t != batch.t) {
+		batch_flush();
+		batch.t = t;
+	}
+	if (batch.nr_quads == batch.max_quads) {
+		batch.max_quads = max(16, batch.max_quads * 2);
+		batch.vertices = xrealloc(batch.vertices, batch.max_quads * 4 * sizeof(SDL_Vertex));
+		batch.indices = xrealloc(batch.indices, batch.max_quads * 6 * sizeof(int));
+	}
+
+	float x0 = dst_r->x, x1 = dst_r->x + dst_r->w;
+	float y0 = dst_r->y, y1 = dst_r->y + dst_r->h;
+	float u0 = (float)src_r->x / tex_w, u1 = (float)(src_r->x + src_r->w) / tex_w;
+	float v0 = (float)src_r->y / tex_h, v1 = (float)(src_r->y + src_r->h) / tex_h;
+	SDL_Color top = { 255, 255, 255, alpha_top };
+	SDL_Color bot = { 255, 255, 255, alpha_bottom };
+
+	int base = batch.nr_quads * 4;
+	SDL_Vertex *v = batch.vertices + base;
+	v[0] = (SDL_Vertex) { { x0, y0 }, top, { u0, v0 } };
+	v[1] = (SDL_Vertex) { { x1, y0 }, top, { u1, v0 } };
+	v[2] = (SDL_Vertex) { { x1, y1 }, bot, { u1, v1 } };
+	v[3] = (SDL_Vertex) { { x0, y1 }, bot, { u0, v1 } };
+
+	int *i = batch.indices + batch.nr_quads * 6;
+	i[0] = base;
+	i[1] = base + 1;
+	i[2] = base + 2;
+	i[3] = base;
+	i[4] = base + 2;
+	i[5] = base + 3;
+	batch.nr_quads++;
+}
+#else
+/*
+ * Without SDL_RenderGeometry, a gradient is approximated by drawing one row
+ * at a time with a constant alpha.
+ */
+static void draw_quad(SDL_Texture *t, const SDL_Rect *src_r, const SDL_Rect *dst_r,
+		uint8_t alpha_top, uint8_t alpha_bottom)
+{
+	if (alpha_top == alpha_bottom || src_r->h != dst_r->h) {
+		SDL_CALL(SDL_SetTextureAlphaMod, t, alpha_top);
+		SDL_CALL(SDL_RenderCopy, gfx.renderer, t, src_r, dst_r);
+		return;
+	}
+	for (int row = 0; row < dst_r->h; row++) {
+		SDL_Rect s = { src_r->x, src_r->y + row, src_r->w, 1 };
+		SDL_Rect d = { dst_r->x, dst_r->y + row, dst_r->w, 1 };
+		int a = alpha_top + ((int)alpha_bottom - alpha_top) * (2 * row + 1) / (2 * dst_r->h);
+		SDL_CALL(SDL_SetTextureAlphaMod, t, a);
+		SDL_CALL(SDL_RenderCopy, gfx.renderer, t, &s, &d);
+	}
+}
+#endif
+
+/*
+ * Start a new frame.
+ */
+void gfx_compositor_begin(void)
+{
+	SDL_CALL(SDL_RenderClear, gfx.renderer);
+}
+
+/*
+ * Draw the region `src_r` of a layer to `dst_r`, with alpha interpolated
+ * vertically from `alpha_top` to `alpha_bottom`. If `src_r` or `dst_r` is
+ * NULL, the whole layer or output is used.
+ */
+void gfx_compositor_quad(struct gfx_layer *layer, const SDL_Rect *src_r,
+		const SDL_Rect *dst_r, uint8_t alpha_top, uint8_t alpha_bottom)
+{
+	SDL_Rect whole_src = { 0, 0, layer->w, layer->h };
+	SDL_Rect whole_dst = { 0, 0, gfx_view.w, gfx_view.h };
+	if (!src_r)
+		src_r = &whole_src;
+	if (!dst_r)
+		dst_r = &whole_dst;
+	if (SDL_RectEmpty(src_r) || SDL_RectEmpty(dst_r))
+		return;
+
+	SDL_Texture *t = layer_texture(layer);
+#ifdef HAVE_RENDER_GEOMETRY
+	batch_add_quad(t, src_r, dst_r, layer->w, layer->h, alpha_top, alpha_bottom);
+#else
+	draw_quad(t, src_r, dst_r, alpha_top, alpha_bottom);
+#endif
+}
+
+/*
+ * Submit the frame and present it.
+ */
+void gfx_compositor_present(void)
+{
+#ifdef HAVE_RENDER_GEOMETRY
+	batch_flush();
+	batch.t = NULL;
+#endif
+	SDL_RenderPresent(gfx.renderer);
+	if (unlikely(profile_enabled))
+		profile_frames++;
+}
@@ -19,6 +19,13 @@
 #include <string.h>
 #include <SDL.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "nulib.h"
 #include "nulib/buffer.h"
 #include "nulib/file.h"
@@ -243,17 +250,87 @@ struct vma {
 	bool initialized;
 };
 
-// TODO: use this abstraction for memory reads on executable image
+// sections of the executable image, and the executable file itself
 struct vmm {
 	struct vma *vmas;
 	unsigned nr_vmas;
 	struct buffer exe;
 };
 
-uint8_t *vmm_lookup(uint32_t ptr);
-
 #pragma pack()
 
+static struct vmm vmm = {0};
+
+/*
+ * Get a pointer to the range [ptr, ptr+size) of the executable image (as
+ * loaded at its base address), given as a relative virtual address. The
+ * range must be contained in the raw data of a single section. Returns NULL
+ * if the range isn't backed by the file.
+ */
+static uint8_t *vmm_lookup(uint32_t ptr, uint32_t size)
+{
+	for (unsigned i = 0; i < vmm.nr_vmas; i++) {
+		struct vma *vma = &vmm.vmas[i];
+		if (!vma->initialized || ptr < vma->virt_addr)
+			continue;
+		uint32_t off = ptr - vma->virt_addr;
+		if (off > vma->size || size > vma->size - off)
+			continue;
+		if ((uint64_t)vma->raw_addr + off + size > vmm.exe.size)
+			return NULL;
+		return vmm.exe.buf + vma->raw_addr + off;
+	}
+	return NULL;
+}
+
+/*
+ * Map the executable into memory. Pages are only read from disk when they
+ * are accessed, so only the headers and resources are actually read.
+ */
+#ifdef _WIN32
+static bool exe_map(const char *path, struct buffer *exe)
+{
+	exe->buf = file_read(path, &exe->size);
+	exe->index = 0;
+	return !!exe->buf;
+}
+
+static void exe_unmap(struct buffer *exe)
+{
+	free(exe->buf);
+	exe->buf = NULL;
+}
+#else
+static bool exe_map(const char *path, struct buffer *exe)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+
+	exe->buf = p;
+	exe->size = st.st_size;
+	exe->index = 0;
+	return true;
+}
+
+static void exe_unmap(struct buffer *exe)
+{
+	if (exe->buf)
+		munmap(exe->buf, exe->size);
+	exe->buf = NULL;
+}
+#endif
+
 static bool buffer_expect_string(struct buffer *buf, const char *magic, size_t magic_size)
 {
 	if (buffer_remaining(buf) < magic_size)
@@ -354,8 +431,24 @@ bool read_resource_data(struct buffer *b, struct resource *node)
 {
 	if (buffer_remaining(b) < sizeof(struct res_data_entry))
 		return false;
-	node->leaf.addr = buffer_read_u32(b);
-	node->leaf.size = buffer_read_u32(b);
+	uint32_t addr = buffer_read_u32(b);
+	uint32_t size = buffer_read_u32(b);
+
+	// convert the address of the data to a file offset (resources which
+	// aren't backed by the file are left empty)
+	uint8_t *data = vmm_lookup(addr, size);
+	if (data && size) {
+		node->leaf.addr = data - vmm.exe.buf;
+		node->leaf.size = size;
+	}
+	return true;
+}
+
+static bool seek_leaf(struct buffer *b, struct resource *res)
+{
+	if (!res->leaf.size)
+		return false;
+	buffer_seek(b, res->leaf.addr);
 	return true;
 }
 
@@ -610,7 +703,8 @@ SDL_Cursor *read_cursor(struct buffer *b, struct resource *res)
 	struct cursor_data cur;
 	uint8_t *xor_bitmap = NULL;
 	uint8_t *and_bitmap = NULL;
-	buffer_seek(b, res->leaf.addr);
+	if (!seek_leaf(b, res))
+		return NULL;
 	if (!read_cursor_data(b, &cur, &xor_bitmap, &and_bitmap))
 		return NULL;
 
@@ -621,7 +715,8 @@ SDL_Cursor *read_cursor(struct buffer *b, struct resource *res)
 
 int read_group_cursor(struct buffer *b, struct resource *res)
 {
-	buffer_seek(b, res->leaf.addr);
+	if (!seek_leaf(b, res))
+		return -1;
 	if (buffer_remaining(b) < sizeof(struct cursor_dir))
 		return -1;
 
@@ -681,7 +776,8 @@ SDL_Surface *read_icon(struct buffer *b, struct resource *res, struct cg **cg_ou
 	struct icon_data icon;
 	uint8_t *image;
 	uint8_t *bitmask;
-	buffer_seek(b, res->leaf.addr);
+	if (!seek_leaf(b, res))
+		return NULL;
 	if (!read_icon_data(b, &icon, &image, &bitmask)) {
 		//WARNING("failed to read icon data");
 		return NULL;
@@ -705,7 +801,8 @@ SDL_Surface *read_icon(struct buffer *b, struct resource *res, struct cg **cg_ou
 
 int read_group_icon(struct buffer *b, struct resource *res)
 {
-	buffer_seek(b, res->leaf.addr);
+	if (!seek_leaf(b, res))
+		return -1;
 	if (buffer_remaining(b) < sizeof(struct icon_dir))
 		return -1;
 
@@ -848,16 +945,12 @@ void cursor_init(const char *exe_path)
 {
 	system_cursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW);
 
-	struct buffer buf;
-	struct vma *vma = NULL;
-	struct res_dir_entry *entry = NULL;
-
-	buf.buf = file_read(exe_path, &buf.size);
-	buf.index = 0;
-	if (!buf.buf) {
+	if (!exe_map(exe_path, &vmm.exe)) {
 		WARNING("Failed to read executable");
 		return;
 	}
+	struct buffer buf = vmm.exe;
+	buf.index = 0;
 
 	// expect DOS header
 	if (!buffer_expect_string(&buf, "MZ", 2))
@@ -875,38 +968,16 @@ void cursor_init(const char *exe_path)
 	uint32_t res_virt_addr;
 	uint32_t res_virt_size;
 	uint16_t nr_vmas;
-	if (!read_pe_header(&buf, &res_virt_addr, &res_virt_size, &vma, &nr_vmas))
+	if (!read_pe_header(&buf, &res_virt_addr, &res_virt_size, &vmm.vmas, &nr_vmas))
 		goto error;
+	vmm.nr_vmas = nr_vmas;
 
-	// calculate size of expanded process image
-	size_t vma_size = 0;
-	for (int i = 0; i < nr_vmas; i++) {
-		vma_size = max(vma_size, vma[i].virt_addr + vma[i].size);
-	}
-	if (vma_size < buf.size)
+	// the resource directory is parsed in place
+	uint8_t *res = vmm_lookup(res_virt_addr, res_virt_size);
+	if (!res)
 		goto error;
 
-	// load sections into memory at correct offsets
-	// TODO: use an abstraction for virtual memory lookups that doesn't involve
-	//       copying memory
-	buf.buf = realloc(buf.buf, vma_size);
-	buf.size = vma_size;
-	for (int i = nr_vmas - 1; i >= 0; i--) {
-		if (!vma[i].initialized)
-			continue;
-		if (vma[i].virt_addr + vma[i].size > buf.size)
-			goto error;
-		if (vma[i].raw_addr + vma[i].size > buf.size)
-			goto error;
-		if (vma[i].virt_addr != vma[i].raw_addr) {
-			memmove(buf.buf + vma[i].virt_addr, buf.buf + vma[i].raw_addr, vma[i].size);
-		}
-	}
-
-	if (res_virt_addr + res_virt_size > buf.size)
-		goto error;
-
-	buffer_seek(&buf, res_virt_addr);
+	buffer_seek(&buf, res - vmm.exe.buf);
 	struct resource *root = read_resources(&buf);
 	if (!root)
 		goto error;
@@ -917,15 +988,17 @@ void cursor_init(const char *exe_path)
 	SDL_AddTimer(cursor_frame_time[0], anim_cb, NULL);
 
 	free_resources(root);
-	free(buf.buf);
-	free(vma);
-	free(entry);
+	exe_unmap(&vmm.exe);
+	free(vmm.vmas);
+	vmm.vmas = NULL;
+	vmm.nr_vmas = 0;
 	return;
 error:
 	WARNING("Invalid/unexpected executable format: %s", exe_path);
-	free(buf.buf);
-	free(vma);
-	free(entry);
+	exe_unmap(&vmm.exe);
+	free(vmm.vmas);
+	vmm.vmas = NULL;
+	vmm.nr_vmas = 0;
 }
 
 #if 0
@@ -1010,7 +1083,8 @@ void cursor_set_pos(unsigned x, unsigned y)
 void cursor_get_pos(unsigned *x_out, unsigned *y_out)
 {
 	int x, y;
-	SDL_GetMouseState(&x, &y);
+	if (!replay_get_mouse_state(&x, &y))
+		SDL_GetMouseState(&x, &y);
 
 	float fx, fy;
 	SDL_RenderWindowToLogical(gfx.renderer, x, y, &fx, &fy);
@@ -28,6 +28,8 @@
 #include "debug.h"
 #include "gfx_private.h"
 #include "memory.h"
+#include "mixer.h"
+#include "profile.h"
 #include "vm.h"
 
 #if 0
@@ -211,6 +213,75 @@ static int dbg_cmd_map(unsigned nr_args, char **args)
 #undef ENTRY
 }
 
+#ifndef USE_SDL_MIXER
+static int dbg_cmd_audio_latency(unsigned nr_args, char **args)
+{
+	printf("mixer       count    last     min     max     avg\n");
+	for (int i = 0; i < mixer_get_numof(); i++) {
+		struct mixer_latency l;
+		if (!mixer_get_latency(i, &l) || !l.count)
+			continue;
+		printf("%-10s %6u %5.1fms %5.1fms %5.1fms %5.1fms\n", mixer_get_name(i),
+				l.count, l.last_ms, l.min_ms, l.max_ms, l.avg_ms);
+	}
+	return DBG_REPL;
+}
+#endif
+
+static int dbg_cmd_mes_cache(unsigned nr_args, char **args)
+{
+	struct asset_mes_cache_stats s;
+	asset_mes_cache_get_stats(&s);
+	printf("loads:     %u\n", s.loads);
+	printf("hits:      %u\n", s.hits);
+	printf("misses:    %u\n", s.misses);
+	printf("evictions: %u\n", s.evictions);
+	printf("cached:    %u (%u pinned)\n", s.nr_cached, s.nr_pinned);
+	if (s.misses) {
+		// estimate time saved assuming each hit would cost an average miss
+		uint64_t avg_us = s.miss_us / s.misses;
+		printf("avg load:  %uus\n", (unsigned)avg_us);
+		printf("saved:     ~%.1fms\n", (double)(avg_us * s.hits) / 1000.0);
+	}
+	return DBG_REPL;
+}
+
+static int dbg_cmd_profile(unsigned nr_args, char **args)
+{
+	if (nr_args == 0) {
+		profile_print();
+	} else if (!strcmp(args[0], "start")) {
+		profile_start();
+	} else if (!strcmp(args[0], "stop")) {
+		profile_stop();
+	} else if (!strcmp(args[0], "reset")) {
+		profile_reset();
+	} else if (!strcmp(args[0], "dump") && nr_args == 2) {
+		if (profile_dump(args[1]))
+			printf("Wrote folded stacks to \"%s\"\n", args[1]);
+	} else {
+		printf("Usage: profile [start|stop|reset|dump <file>]\n");
+	}
+	return DBG_REPL;
+}
+
+static int dbg_cmd_memory_usage(unsigned nr_args, char **args)
+{
+	struct memory_usage usage[MEMORY_NR_REGIONS];
+	memory_get_usage(usage);
+	printf("%-10s %10s %16s %14s\n", "region", "size (KiB)", "high-water (KiB)", "resident (KiB)");
+	for (int i = 0; i < MEMORY_NR_REGIONS; i++) {
+		struct memory_usage *u = &usage[i];
+		printf("%-10s %10u %9u (%3u%%)", u->name, u->size / 1024, u->high_water / 1024,
+				(unsigned)((uint64_t)u->high_water * 100 / u->size));
+		if (u->have_resident)
+			printf(" %14u\n", u->resident / 1024);
+		else
+			printf(" %14s\n", "n/a");
+	}
+	return DBG_REPL;
+}
+
 static int dbg_cmd_palette(unsigned nr_args, char **args)
 {
 	printf("gfx.palette");
@@ -382,12 +453,18 @@ static int dbg_cmd_help(unsigned nr_args, char **args)
 }
 
 static struct cmdline_cmd dbg_commands[] = {
+#ifndef USE_SDL_MIXER
+	{ "audio-latency", NULL, NULL, "Display estimated audio trigger-to-output latency", 0, 0, dbg_cmd_audio_latency },
+#endif
 	{ "breakpoint", "b", "<file:address>", "Set breakpoint", 1, 1, dbg_cmd_breakpoint },
 	{ "clear", NULL, "<file:address>", "Clear breakpoint", 1, 1, dbg_cmd_clear },
 	{ "continue", "c", NULL, "Continue running", 0, 0, dbg_cmd_continue },
 	{ "help", "h", NULL, "Display debugger help", 0, 2, dbg_cmd_help },
 	{ "map", NULL, NULL, "Display memory map", 0, 0, dbg_cmd_map },
+	{ "mes-cache", NULL, NULL, "Display MES cache statistics", 0, 0, dbg_cmd_mes_cache },
+	{ "memory-usage", "mem", NULL, "Display memory usage by region", 0, 0, dbg_cmd_memory_usage },
 	{ "palette", "pal", NULL, "Print the current palette", 0, 0, dbg_cmd_palette },
+	{ "profile", NULL, "[start|stop|reset|dump <file>]", "Control the script profiler", 0, 2, dbg_cmd_profile },
 	{ "quit", "q", NULL, "Quit AI5-SDL2", 0, 0, dbg_cmd_quit },
 	{ "get-flag", NULL, "<flag-number>", "Get a flag", 1, 1, dbg_cmd_get_flag },
 	{ "get-var16", NULL, "<var-number>", "Get a 16-bit variable", 1, 1, dbg_cmd_get_var16 },
@@ -22,11 +22,13 @@
 #include "audio.h"
 #include "backlog.h"
 #include "cursor.h"
+#include "fade.h"
 #include "game.h"
 #include "gfx_private.h"
 #include "input.h"
 #include "map.h"
 #include "menu.h"
+#include "particle.h"
 #include "savedata.h"
 #include "sys.h"
 #include "vm_private.h"
@@ -171,43 +173,7 @@ static void nanpa2_voice(struct param_list *params)
 	}
 }
 
-static bool nanpa2_fixed_crossfade_tick(SDL_Color new_pal[236])
-{
-	bool changed = false;
-	for (int i = 0; i < 236; i++) {
-		SDL_Color *cur_c = &gfx.palette[i];
-		SDL_Color *new_c = &new_pal[i];
-		if (cur_c->r < new_c->r) {
-			cur_c->r++;
-			changed = true;
-		}
-		else if (cur_c->r > new_c->r) {
-			cur_c->r--;
-			changed = true;
-		}
-		if (cur_c->g < new_c->g) {
-			cur_c->g++;
-			changed = true;
-		}
-		else if (cur_c->g > new_c->g) {
-			cur_c->g--;
-			changed = true;
-		}
-		if (cur_c->b < new_c->b) {
-			cur_c->b++;
-			changed = true;
-		}
-		else if (cur_c->b > new_c->b) {
-			cur_c->b--;
-			changed = true;
-		}
-	}
-	if (changed)
-		gfx_update_palette(0, 236);
-	return changed;
-}
-
-static void mem_to_sdl_palette(SDL_Color new_pal[236])
+static void mem_to_sdl_palette(SDL_Color new_pal[256])
 {
 	for (int i = 0; i < 236; i++) {
 		new_pal[i].b = memory.palette[i*4];
@@ -222,22 +188,12 @@ static void mem_to_sdl_palette(SDL_Color new_pal[236])
  */
 static void nanpa2_fixed_crossfade(void)
 {
-	SDL_Color new_pal[236];
+	SDL_Color new_pal[256] = {0};
 	mem_to_sdl_palette(new_pal);
-
-	vm_timer_t timer = vm_timer_create();
-	for (int i = 0; i < 256; i++) {
-		if (!nanpa2_fixed_crossfade_tick(new_pal))
-			break;
-		vm_peek();
-		vm_timer_tick(&timer, 20);
-	}
+	fade_palette_start_fixed_step(new_pal, 0, 236, 20);
+	fade_wait(NULL, NULL);
 }
 
-static bool async_crossfade_active = false;
-static SDL_Color async_crossfade_palette[236];
-static vm_timer_t async_crossfade_t;
-
 static void nanpa2_palette(struct param_list *params)
 {
 	if (vm_flag_is_on(FLAG_SAVE_PALETTE)) {
@@ -270,14 +226,16 @@ static void nanpa2_palette(struct param_list *params)
 		_gfx_update_palette(start, n);
 		break;
 	}
-	case 6:
+	case 6: {
 		// Util 102/114 change whether this is a normal or 'fixed'-style crossfade.
 		// In practice I think it's always a 'fixed'-style crossfade
 		// Range of crossfade is always 16-236
-		mem_to_sdl_palette(async_crossfade_palette);
-		async_crossfade_t = vm_timer_create();
-		async_crossfade_active = true;
+		// (asynchronous: the fade runs from vm_peek)
+		SDL_Color new_pal[256] = {0};
+		mem_to_sdl_palette(new_pal);
+		fade_palette_start_fixed_step(new_pal, 0, 236, 15);
 		break;
+	}
 	case 7:
 		if (params->nr_params > 2) {
 			memset(memory.palette, (uint8_t)vm_expr_param(params, 2), 236 * 4);
@@ -794,21 +752,13 @@ static void nanpa2_init(void)
 	anim_load_palette = nanpa2_anim_load_palette;
 }
 
-struct hana {
-	bool active;
-	bool alt_anim;
-	int size;
-	int speed;
-	struct { int x, y; } pos;
-	int frame;
-	int frame_tick;
-};
+#define HANA_ALT_ANIM 1
 
 #define MAX_PETALS 30
 struct {
 	bool enabled;
-	unsigned nr_petals;
-	struct hana petals[MAX_PETALS];
+	unsigned nr_spawned;
+	struct particles petals;
 	bool need_spawn;
 	vm_timer_t timer;
 	int tick;
@@ -816,50 +766,64 @@ struct {
 
 static void hana_spawn(void)
 {
-	assert(hana.nr_petals < MAX_PETALS);
-	unsigned i = hana.nr_petals++;
-	hana.petals[i].active = true;
-	hana.petals[i].size = rand() % 3;
-	hana.petals[i].speed = hana.petals[i].size;
-	hana.petals[i].frame_tick = 0;
+	int i = particles_spawn(&hana.petals);
+	if (i < 0)
+		return;
+	hana.nr_spawned++;
+
+	struct particles *p = &hana.petals;
+	p->size[i] = rand() % 3;
+	p->speed[i] = p->size[i];
+	p->tick[i] = 0;
 	if (rand() % 2) {
-		if (hana.petals[i].size == 0 || hana.petals[i].size == 2)
-			hana.petals[i].size = 1;
+		if (p->size[i] == 0 || p->size[i] == 2)
+			p->size[i] = 1;
 	}
 
-	hana.petals[i].pos.x = (rand() % 34) * 16;
-	hana.petals[i].pos.y = 0;
-	hana.petals[i].alt_anim = false;
-	hana.petals[i].frame = 9; // XXX: last frame of normal animation
+	p->x[i] = (rand() % 34) * 16;
+	p->y[i] = 0;
+	p->frame[i] = 9; // XXX: last frame of normal animation
+}
+
+static void hana_erase(struct particles *p, unsigned i)
+{
+	int x = p->x[i] + 96;
+	int y = p->y[i] + 60;
+	gfx_indexed_copy_masked_dst_gt(x, y, 16, 16, 2, x, y, 0, 0, 155);
+	particles_damage(p, x, y, 16, 16);
 }
 
-static void _hana_tick(struct hana *p)
+static void hana_update(struct particles *p, unsigned i)
 {
+	hana_erase(p, i);
+
 	// move
-	if (p->frame_tick == 0) {
-		p->pos.x--;
-		p->pos.y++;
-		p->frame_tick = p->speed;
-		if (++p->frame >= (p->alt_anim ? 6 : 10)) {
-			p->frame = 0;
+	bool alt_anim = p->flags[i] & HANA_ALT_ANIM;
+	if (p->tick[i] == 0) {
+		p->x[i]--;
+		p->y[i]++;
+		p->tick[i] = p->speed[i];
+		if (++p->frame[i] >= (alt_anim ? 6 : 10)) {
+			p->frame[i] = 0;
 			// 30% chance for alternate animation
-			p->alt_anim = (rand() % 3) == 0;
+			alt_anim = (rand() % 3) == 0;
+			p->flags[i] = alt_anim ? HANA_ALT_ANIM : 0;
 		}
 	} else {
-		p->frame_tick--;
+		p->tick[i]--;
 	}
 
 	// despawn
-	if (p->pos.x <= -16 || p->pos.y >= 280) {
-		p->active = false;
+	if (p->x[i] <= -16 || p->y[i] >= 280) {
+		particles_kill(p, i);
 		return;
 	}
 
 	// calculate coordinates/dimensions
-	int frame_x = (p->size + (p->alt_anim ? 0 : 3)) * 16;
-	int frame_y = p->frame * 16;
-	int x = p->pos.x;
-	int y = p->pos.y;
+	int frame_x = (p->size[i] + (alt_anim ? 0 : 3)) * 16;
+	int frame_y = p->frame[i] * 16;
+	int x = p->x[i];
+	int y = p->y[i];
 	int w = 16;
 	int h = 16;
 	if (x < 0) {
@@ -872,31 +836,21 @@ static void _hana_tick(struct hana *p)
 	assert(w > 0 && h > 0);
 
 	// draw petal
-	if (x < 448)
+	if (x < 448) {
 		gfx_indexed_copy_masked_dst_gt(frame_x, frame_y, w, h, 3, x + 96, y + 60, 0, 0, 155);
-}
-
-static void hana_erase(struct hana *p)
-{
-	int x = p->pos.x + 96;
-	int y = p->pos.y + 60;
-	gfx_indexed_copy_masked_dst_gt(x, y, 16, 16, 2, x, y, 0, 0, 155);
+		particles_damage(p, x + 96, y + 60, w, h);
+	}
 }
 
 static void hana_tick(void)
 {
-	if (hana.nr_petals < MAX_PETALS && hana.need_spawn) {
+	// XXX: petals are not respawned once MAX_PETALS have been spawned
+	if (hana.nr_spawned < MAX_PETALS && hana.need_spawn) {
 		hana_spawn();
 		hana.need_spawn = false;
 	}
 
-	for (int i = 0; i < MAX_PETALS; i++) {
-		if (!hana.petals[i].active)
-			continue;
-		hana_erase(&hana.petals[i]);
-		_hana_tick(&hana.petals[i]);
-		gfx_screen_dirty();
-	}
+	particles_update(&hana.petals, hana_update);
 
 	if (++hana.tick >= 16) {
 		hana.need_spawn = true;
@@ -906,10 +860,12 @@ static void hana_tick(void)
 
 static void nanpa2_hana_start(struct param_list *params)
 {
-	memset(&hana, 0, sizeof hana);
+	particles_init(&hana.petals, MAX_PETALS, 0);
+	hana.nr_spawned = 0;
 	hana.enabled = true;
 	hana.need_spawn = true;
 	hana.timer = vm_timer_create();
+	hana.tick = 0;
 }
 
 static void nanpa2_hana_end(struct param_list *params)
@@ -917,110 +873,96 @@ static void nanpa2_hana_end(struct param_list *params)
 	hana.enabled = false;
 }
 
-struct yuki {
-	// static
-	bool active;
-	int size;
-	int speed;
-	bool bg_layer;
-	// dynamic
-	struct { int x, y; } pos;
-	bool left;
-	int tick;
-	int spawn_ticks;
-};
+#define YUKI_BG_LAYER 1
+#define YUKI_LEFT     2
 
 #define MAX_FLAKES 200
 struct {
 	bool enabled;
-	int nr_flakes;
-	struct yuki flakes[MAX_FLAKES];
+	struct particles flakes;
 	bool need_spawn;
 	vm_timer_t timer;
 	int tick;
-} yuki;
+} yuki = {0};
+
+static void yuki_erase(struct particles *p, unsigned i)
+{
+	int x = p->x[i];
+	int y = p->y[i];
+	if (x <= -8 || x >= 640 || y >= 400)
+		return;
+	gfx_indexed_copy_masked_dst_gt(x, y, 8, 8, 1, x, y, 0, 0, 109);
+	gfx_indexed_copy_masked_dst_gt(x, y, 8, 8, 1, x, y, 0, 2, 109);
+	particles_damage(p, x, y, 8, 8);
+}
 
-static void _yuki_tick(struct yuki *p)
+static void yuki_update(struct particles *p, unsigned i)
 {
+	yuki_erase(p, i);
+
 	// draw flake
-	int src_x = p->size * 8;
-	int dst_x = p->pos.x;
-	int dst_y = p->pos.y;
-	int threshold = p->bg_layer ? 109 : 9;
+	int src_x = p->size[i] * 8;
+	int dst_x = p->x[i];
+	int dst_y = p->y[i];
+	int threshold = (p->flags[i] & YUKI_BG_LAYER) ? 109 : 9;
 	if (dst_x > -8 && dst_x < 640 && dst_y < 400) {
 		gfx_indexed_copy_masked_dst_gt(src_x, 0, 8, 8, 3, dst_x, dst_y, 0, 0, threshold);
 		gfx_indexed_copy_masked_dst_gt(src_x, 0, 8, 8, 3, dst_x, dst_y, 2, 0, threshold);
+		particles_damage(p, dst_x, dst_y, 8, 8);
 	}
 
 	// speed 0: tick, tick, tock
 	// speed 1: tick, tock
 	// speed 2: tick, tock, tock
-	int spawn_tick = p->spawn_ticks++;
-	if (p->speed == 0 && (spawn_tick % 3) > 2) {
+	int spawn_tick = p->age[i]++;
+	if (p->speed[i] == 0 && (spawn_tick % 3) > 2) {
 		return;
-	} else if (p->speed == 1 && (spawn_tick % 2) > 0) {
+	} else if (p->speed[i] == 1 && (spawn_tick % 2) > 0) {
 		return;
-	} else if (p->speed == 2 && (spawn_tick % 3) > 1) {
+	} else if (p->speed[i] == 2 && (spawn_tick % 3) > 1) {
 		return;
 	}
 
 	// despawn
 	if (dst_y + 1 > 400) {
-		yuki.nr_flakes--;
-		p->active = false;
+		particles_kill(p, i);
 		return;
 	}
 
 	// tick
-	if (p->tick == 0) {
-		p->left = !p->left;
-		p->tick = p->left ? 8 : 12;
+	if (p->tick[i] == 0) {
+		p->flags[i] ^= YUKI_LEFT;
+		p->tick[i] = (p->flags[i] & YUKI_LEFT) ? 8 : 12;
 	} else {
-		p->tick--;
+		p->tick[i]--;
 	}
 
-	p->pos.x += p->left ? -1 : 1;
-	p->pos.y++;
-}
-
-static void yuki_erase(struct yuki *p)
-{
-	if (p->pos.x <= -8 || p->pos.x >= 640 || p->pos.y >= 400)
-		return;
-	gfx_indexed_copy_masked_dst_gt(p->pos.x, p->pos.y, 8, 8, 1,
-			p->pos.x, p->pos.y, 0, 0, 109);
-	gfx_indexed_copy_masked_dst_gt(p->pos.x, p->pos.y, 8, 8, 1,
-			p->pos.x, p->pos.y, 0, 2, 109);
+	p->x[i] += (p->flags[i] & YUKI_LEFT) ? -1 : 1;
+	p->y[i]++;
 }
 
 static void yuki_spawn(void)
 {
-	int i;
-	for (i = 0; i < MAX_FLAKES; i++) {
-		if (!yuki.flakes[i].active)
-			break;
-	}
-	if (i >= MAX_FLAKES)
+	struct particles *p = &yuki.flakes;
+	int i = particles_spawn(p);
+	if (i < 0)
 		return;
 
-	struct yuki *flake = &yuki.flakes[i];
-	flake->active = true;
-	flake->size = rand() % 3;
-	flake->speed = flake->size;
-	flake->bg_layer = false;
-	if (flake->size == 0 && rand() % 2) {
+	p->size[i] = rand() % 3;
+	p->speed[i] = p->size[i];
+	if (p->size[i] == 0 && rand() % 2) {
 		// large flakes: 50% chance to be downsized and put into bg
-		flake->size = 1;
-		flake->bg_layer = true;
-	} else if (flake->size == 1 && rand() % 2) {
+		p->size[i] = 1;
+		p->flags[i] |= YUKI_BG_LAYER;
+	} else if (p->size[i] == 1 && rand() % 2) {
 		// medium flakes: 50% chance to be put into bg
-		flake->bg_layer = true;
-	} else if (flake->size == 2) {
+		p->flags[i] |= YUKI_BG_LAYER;
+	} else if (p->size[i] == 2) {
 		// small flakes: 50/50 either upsized, or else put into bg
 		if (rand() % 2)
-			flake->size = 1;
+			p->size[i] = 1;
 		else
-			flake->bg_layer = true;
+			p->flags[i] |= YUKI_BG_LAYER;
 	}
 
 	// flakes spawn from left to right, one each per 64-pixel chunk, resetting after 25
@@ -1039,28 +981,21 @@ static void yuki_spawn(void)
 		else
 			x += 56;
 	}
-	flake->pos.x = x;
-	flake->pos.y = -7;
-	flake->left = true;
-	flake->tick = 4;
-	flake->spawn_ticks = 0;
-	yuki.nr_flakes++;
+	p->x[i] = x;
+	p->y[i] = -7;
+	p->flags[i] |= YUKI_LEFT;
+	p->tick[i] = 4;
+	p->age[i] = 0;
 }
 
 static void yuki_tick(void)
 {
-	if (yuki.nr_flakes < MAX_FLAKES && yuki.need_spawn) {
+	if (yuki.flakes.nr_active < MAX_FLAKES && yuki.need_spawn) {
 		yuki_spawn();
 		yuki.need_spawn = false;
 	}
 
-	for (int i = 0; i < MAX_FLAKES; i++) {
-		if (!yuki.flakes[i].active)
-			continue;
-		yuki_erase(&yuki.flakes[i]);
-		_yuki_tick(&yuki.flakes[i]);
-		gfx_screen_dirty();
-	}
+	particles_update(&yuki.flakes, yuki_update);
 
 	if (++yuki.tick >= 32) {
 		yuki.need_spawn = true;
@@ -1070,10 +1005,11 @@ static void yuki_tick(void)
 
 static void nanpa2_yuki_start(struct param_list *params)
 {
-	memset(&yuki, 0, sizeof yuki);
+	particles_init(&yuki.flakes, MAX_FLAKES, 0);
 	yuki.enabled = true;
 	yuki.need_spawn = true;
 	yuki.timer = vm_timer_create();
+	yuki.tick = 0;
 }
 
 static void nanpa2_yuki_end(struct param_list *params)
@@ -1088,11 +1024,6 @@ static void nanpa2_yuki_resume(struct param_list *params)
 
 static void nanpa2_update(void)
 {
-	if (async_crossfade_active && vm_timer_tick_async(&async_crossfade_t, 15)) {
-		if (!nanpa2_fixed_crossfade_tick(async_crossfade_palette)) {
-			async_crossfade_active = false;
-		}
-	}
 	if (hana.enabled && vm_timer_tick_async(&hana.timer, 25))
 		hana_tick();
 	if (yuki.enabled && vm_timer_tick_async(&yuki.timer, 25))
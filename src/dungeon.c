@@ -14,6 +14,9 @@
  * along with this program; if not, see <http://gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "nulib.h"
 #include "nulib/little_endian.h"
 
@@ -387,6 +390,135 @@ static struct dungeon_view_cg dungeon_floors[] = {
 #undef E
 #undef M
 
+/*
+ * Wall CG Cache
+ * -------------
+ *
+ * Decoding the 4-bit CGs is the bulk of the work when drawing a view, so each
+ * CG (and its mirrored form) is expanded to RGB24 the first time it is drawn.
+ * Drawing a CG is then a series of row copies.
+ *
+ * Composed views are cached as well (keyed on the view mode and the visible
+ * walls), so that the frames of movement animations through a familiar part
+ * of the dungeon are a single copy.
+ *
+ * Both caches are cleared when the CG data or palette changes.
+ */
+
+#define VIEW_CACHE_SIZE 8
+
+static uint8_t *kabe_cache[3][ARRAY_SIZE(kabe_entry)][2];
+
+static struct view_cache_entry {
+	uint8_t *pixels;
+	enum dungeon_view_mode mode;
+	uint8_t view[VIEW_NR_WALLS];
+	int w, h, pitch;
+	uint32_t last_used;
+} view_cache[VIEW_CACHE_SIZE];
+static uint32_t view_cache_clock = 0;
+
+static void dungeon_cache_clear(void)
+{
+	for (int t = 0; t < 3; t++) {
+		for (int i = 0; i < ARRAY_SIZE(kabe_entry); i++) {
+			free(kabe_cache[t][i][0]);
+			free(kabe_cache[t][i][1]);
+			kabe_cache[t][i][0] = NULL;
+			kabe_cache[t][i][1] = NULL;
+		}
+	}
+	for (int i = 0; i < VIEW_CACHE_SIZE; i++) {
+		free(view_cache[i].pixels);
+		view_cache[i].pixels = NULL;
+	}
+}
+
+/*
+ * Expand a 4-bit CG to RGB24 (mirrored on the Y-axis if `mirrored` is true).
+ */
+static uint8_t *kabe_expand(uint8_t *kabe_dat, struct kabe_entry *kabe, bool mirrored)
+{
+	// RGB24 values for each pair of pixels in a byte
+	uint8_t lut[256][6];
+	for (int i = 0; i < 256; i++) {
+		SDL_Color *c1 = &dungeon.pal[i >> 4];
+		SDL_Color *c2 = &dungeon.pal[i & 0xf];
+		if (mirrored) {
+			SDL_Color *tmp = c1;
+			c1 = c2;
+			c2 = tmp;
+		}
+		lut[i][0] = c1->r;
+		lut[i][1] = c1->g;
+		lut[i][2] = c1->b;
+		lut[i][3] = c2->r;
+		lut[i][4] = c2->g;
+		lut[i][5] = c2->b;
+	}
+
+	unsigned stride = kabe->w * 3;
+	uint8_t *pixels = xmalloc(stride * kabe->h);
+	uint8_t *src = kabe_dat + kabe->offset;
+	for (int row = 0; row < kabe->h; row++) {
+		uint8_t *p = pixels + row * stride;
+		if (!mirrored) {
+			for (int col = 0; col < kabe->w; col += 2, p += 6, src++) {
+				memcpy(p, lut[*src], 6);
+			}
+		} else {
+			p += (kabe->w - 2) * 3;
+			for (int col = kabe->w - 2; col >= 0; col -= 2, p -= 6, src++) {
+				memcpy(p, lut[*src], 6);
+			}
+		}
+	}
+	return pixels;
+}
+
+static struct view_cache_entry *view_cache_get(enum dungeon_view_mode mode, SDL_Surface *dst)
+{
+	for (int i = 0; i < VIEW_CACHE_SIZE; i++) {
+		struct view_cache_entry *e = &view_cache[i];
+		if (!e->pixels || e->mode != mode)
+			continue;
+		if (e->w != dst->w || e->h != dst->h || e->pitch != dst->pitch)
+			continue;
+		if (memcmp(e->view, dungeon.view, sizeof(e->view)))
+			continue;
+		e->last_used = ++view_cache_clock;
+		return e;
+	}
+	return NULL;
+}
+
+static void view_cache_put(enum dungeon_view_mode mode, SDL_Surface *dst)
+{
+	// replace the least recently used entry
+	struct view_cache_entry *e = &view_cache[0];
+	for (int i = 0; i < VIEW_CACHE_SIZE; i++) {
+		if (!view_cache[i].pixels) {
+			e = &view_cache[i];
+			break;
+		}
+		if (view_cache[i].last_used < e->last_used)
+			e = &view_cache[i];
+	}
+
+	size_t size = (size_t)dst->h * dst->pitch;
+	if (!e->pixels || (size_t)e->h * e->pitch != size) {
+		free(e->pixels);
+		e->pixels = xmalloc(size);
+	}
+	memcpy(e->pixels, dst->pixels, size);
+	memcpy(e->view, dungeon.view, sizeof(e->view));
+	e->mode = mode;
+	e->w = dst->w;
+	e->h = dst->h;
+	e->pitch = dst->pitch;
+	e->last_used = ++view_cache_clock;
+}
+
 /*
  * Draw Order
  * ----------
@@ -696,6 +828,7 @@ void dungeon_load(uint8_t *mp3, uint8_t *kabe1, uint8_t *kabe2, uint8_t *kabe3,
 		uint8_t *kabe_pal, uint8_t *dun_a6)
 {
 	DUNGEON_LOG("dungeon_load");
+	dungeon_cache_clear();
 	dungeon_load_mp3(mp3);
 	dungeon_load_pal(kabe_pal);
 	dungeon.kabe[0] = kabe1;
@@ -732,51 +865,26 @@ static void dungeon_draw_cg(SDL_Surface *dst, unsigned x, unsigned y, uint8_t wa
 		VM_ERROR("Invalid wall ID: %u", (unsigned)wall_id);
 
 	// get CG archive
-	uint8_t *kabe_dat;
-	if (wall_type == 0) {
-		kabe_dat = dungeon.kabe[0];
-	} else if (wall_type == 1) {
-		kabe_dat = dungeon.kabe[1];
-	} else if (wall_type == 2) {
-		kabe_dat = dungeon.kabe[2];
-		wall_id += 45;
-	} else {
+	if (wall_type > 2)
 		VM_ERROR("Invalid wall type: %u", wall_type);
+	uint8_t *kabe_dat = dungeon.kabe[wall_type];
+	if (wall_type == 2) {
+		wall_id += 45;
+		if (wall_id >= ARRAY_SIZE(kabe_entry))
+			VM_ERROR("Invalid wall ID: %u", (unsigned)wall_id);
 	}
 
-	struct kabe_entry *kabe = &kabe_entry[wall_id];
-	uint8_t *src = kabe_dat + kabe->offset;
-
 	// XXX: CG data is 4-bit indexed bitmap
-	if (!mirrored) {
-		for (int row = 0; row < kabe->h; row++) {
-			uint8_t *p = dst->pixels + (y + row) * dst->pitch + x * 3;
-			for (int col = 0; col < kabe->w; col += 2, p += 6, src++) {
-				SDL_Color *c1 = &dungeon.pal[*src >> 4];
-				SDL_Color *c2 = &dungeon.pal[*src & 0xf];
-				p[0] = c1->r;
-				p[1] = c1->g;
-				p[2] = c1->b;
-				p[3] = c2->r;
-				p[4] = c2->g;
-				p[5] = c2->b;
-			}
-		}
-	} else {
-		for (int row = 0; row < kabe->h; row++) {
-			uint8_t *p = dst->pixels + (y + row) * dst->pitch + x * 3;
-			p += (kabe->w - 2) * 3;
-			for (int col = kabe->w - 2; col >= 0; col -= 2, p -= 6, src++) {
-				SDL_Color *c1 = &dungeon.pal[*src >> 4];
-				SDL_Color *c2 = &dungeon.pal[*src & 0xf];
-				p[0] = c2->r;
-				p[1] = c2->g;
-				p[2] = c2->b;
-				p[3] = c1->r;
-				p[4] = c1->g;
-				p[5] = c1->b;
-			}
-		}
+	struct kabe_entry *kabe = &kabe_entry[wall_id];
+	uint8_t **cached = &kabe_cache[wall_type][wall_id][mirrored];
+	if (!*cached)
+		*cached = kabe_expand(kabe_dat, kabe, mirrored);
+
+	unsigned stride = kabe->w * 3;
+	uint8_t *src = *cached;
+	uint8_t *p = dst->pixels + y * dst->pitch + x * 3;
+	for (int row = 0; row < kabe->h; row++, src += stride, p += dst->pitch) {
+		memcpy(p, src, stride);
 	}
 }
 
@@ -818,6 +926,17 @@ static void dungeon_draw_view(enum dungeon_view_mode mode)
 
 	uint16_t dst_i = mem_get_sysvar16(mes_sysvar16_dst_surface);
 	SDL_Surface *dst = gfx_get_surface(dst_i);
+
+	struct view_cache_entry *cached = view_cache_get(mode, dst);
+	if (cached) {
+		if (SDL_MUSTLOCK(dst))
+			SDL_CALL(SDL_LockSurface, dst);
+		memcpy(dst->pixels, cached->pixels, (size_t)dst->h * dst->pitch);
+		if (SDL_MUSTLOCK(dst))
+			SDL_UnlockSurface(dst);
+		goto update;
+	}
+
 	SDL_CALL(SDL_FillRect, dst, NULL, SDL_MapRGB(dst->format, 0, 0, 0));
 
 	if (SDL_MUSTLOCK(dst))
@@ -842,10 +961,11 @@ static void dungeon_draw_view(enum dungeon_view_mode mode)
 			i++;
 		}
 	}
+	view_cache_put(mode, dst);
 
 	if (SDL_MUSTLOCK(dst))
 		SDL_UnlockSurface(dst);
-
+update:
 	gfx_whole_surface_dirty(dst_i);
 	vm_timer_tick(&timer, move_frame_time[dungeon_speed]);
 	gfx_update();
@@ -632,7 +632,7 @@ void gfx_scale_h(unsigned i, int mag)
 		s->src.y = 0;
 		s->src.h = s->s->h;
 		s->dst.y = 0;
-		s->scaled = !SDL_RectEquals(&s->src, &s->dst);
+		s->scaled = false;
 	} else if (mag < 0) {
 		s->src.y = 0;
 		s->src.h = s->s->h + mag;
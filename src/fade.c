@@ -0,0 +1,295 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <SDL.h>
+
+#include "nulib.h"
+
+#include "ai5.h"
+#include "fade.h"
+#include "gfx_private.h"
+#include "vm.h"
+
+// time between frames of a blocking fade
+#define FADE_FRAME_TIME 16
+
+// alpha fade (fades of the whole display)
+static struct {
+	bool active;
+	uint32_t start_t;
+	unsigned ms;
+	float from;
+	float to;
+	float value;
+} alpha = {0};
+
+static struct {
+	bool active;
+	enum fade_curve curve;
+	uint32_t start_t;
+	// duration of the fade (FADE_LINEAR) or of a step (FADE_FIXED_STEP)
+	unsigned ms;
+	// number of steps until every color reaches its target (FADE_FIXED_STEP)
+	unsigned nr_steps;
+	float rate;
+	SDL_Color from[256];
+	SDL_Color to[256];
+	uint8_t colors[256];
+	unsigned nr_colors;
+	unsigned max_color;
+} fade = {0};
+
+static uint8_t u8_interp(uint8_t a, uint8_t b, float rate)
+{
+	int d = b - a;
+	return a + d * rate;
+}
+
+static uint8_t u8_step(uint8_t a, uint8_t b, unsigned steps)
+{
+	if (a < b)
+		return a + min(steps, (unsigned)(b - a));
+	return a - min(steps, (unsigned)(a - b));
+}
+
+static unsigned u8_dist(uint8_t a, uint8_t b)
+{
+	return a < b ? b - a : a - b;
+}
+
+/*
+ * Get the progress (0.0 - 1.0) of a timed effect which started at `start_t`
+ * and lasts `ms` milliseconds.
+ */
+float fade_rate(uint32_t start_t, unsigned ms)
+{
+	uint32_t t = vm_get_ticks() - start_t;
+	if (!ms || t >= ms)
+		return 1.f;
+	return (float)t / (float)ms;
+}
+
+bool fade_active(void)
+{
+	return fade.active;
+}
+
+static void set_colors(float rate, unsigned steps)
+{
+	for (unsigned i = 0; i < fade.nr_colors; i++) {
+		uint8_t c = fade.colors[i];
+		SDL_Color *from = &fade.from[c], *to = &fade.to[c];
+		if (fade.curve == FADE_LINEAR) {
+			gfx.palette[c].r = u8_interp(from->r, to->r, rate);
+			gfx.palette[c].g = u8_interp(from->g, to->g, rate);
+			gfx.palette[c].b = u8_interp(from->b, to->b, rate);
+		} else {
+			gfx.palette[c].r = u8_step(from->r, to->r, steps);
+			gfx.palette[c].g = u8_step(from->g, to->g, steps);
+			gfx.palette[c].b = u8_step(from->b, to->b, steps);
+		}
+	}
+	gfx_update_palette(0, fade.max_color + 1);
+}
+
+static void alpha_tick(void)
+{
+	if (!alpha.active)
+		return;
+	float rate = fade_rate(alpha.start_t, alpha.ms);
+	alpha.value = alpha.from + (alpha.to - alpha.from) * rate;
+	if (rate >= 1.f)
+		alpha.active = false;
+}
+
+static void palette_tick(void)
+{
+	if (!fade.active)
+		return;
+
+	uint32_t t = vm_get_ticks() - fade.start_t;
+	if (fade.curve == FADE_LINEAR) {
+		fade.rate = fade_rate(fade.start_t, fade.ms);
+		set_colors(fade.rate, 0);
+		if (fade.rate >= 1.f)
+			fade.active = false;
+	} else {
+		unsigned steps = min(t / fade.ms, fade.nr_steps);
+		fade.rate = (float)steps / (float)fade.nr_steps;
+		set_colors(0.f, steps);
+		if (steps >= fade.nr_steps)
+			fade.active = false;
+	}
+}
+
+/*
+ * Advance the active fades to the current time.
+ */
+void fade_tick(void)
+{
+	palette_tick();
+	alpha_tick();
+}
+
+/*
+ * Stop the active fade. If `finish` is true, the target palette is applied;
+ * otherwise the palette is left as it is.
+ */
+void fade_cancel(bool finish)
+{
+	if (!fade.active)
+		return;
+	if (finish)
+		set_colors(1.f, fade.nr_steps);
+	fade.active = false;
+}
+
+/*
+ * Run the active fade to completion. If `cb` returns false, the fade is
+ * finished immediately.
+ */
+void fade_wait(bool (*cb)(float rate, void *data), void *data)
+{
+	vm_timer_t timer = vm_timer_create();
+	while (fade.active) {
+		vm_peek();
+		if (!fade.active)
+			break;
+		vm_timer_tick(&timer, FADE_FRAME_TIME);
+		if (cb && !cb(fade.rate, data)) {
+			fade_cancel(true);
+			break;
+		}
+	}
+	gfx_update();
+}
+
+static void fade_start(enum fade_curve curve, const SDL_Color *target,
+		const uint8_t *colors, unsigned nr_colors, unsigned ms)
+{
+	// a fade still in progress (e.g. one started asynchronously by the
+	// script) is finished rather than abandoned partway
+	fade_cancel(true);
+
+	memcpy(fade.colors, colors, nr_colors);
+	fade.nr_colors = nr_colors;
+	memcpy(fade.from, gfx_get_surface(gfx_current_surface())->format->palette->colors,
+			sizeof(fade.from));
+	memcpy(gfx.palette, fade.from, sizeof(fade.from));
+	memcpy(fade.to, target, sizeof(fade.to));
+	fade.curve = curve;
+	fade.ms = ms;
+	fade.rate = 0.f;
+	fade.nr_steps = 0;
+	fade.max_color = 0;
+
+	// only the colors which actually change are interpolated
+	unsigned n = 0;
+	for (unsigned i = 0; i < fade.nr_colors; i++) {
+		uint8_t c = fade.colors[i];
+		SDL_Color *from = &fade.from[c], *to = &fade.to[c];
+		if (from->r == to->r && from->g == to->g && from->b == to->b)
+			continue;
+		fade.colors[n++] = c;
+		fade.max_color = max(fade.max_color, c);
+		fade.nr_steps = max(fade.nr_steps, u8_dist(from->r, to->r));
+		fade.nr_steps = max(fade.nr_steps, u8_dist(from->g, to->g));
+		fade.nr_steps = max(fade.nr_steps, u8_dist(from->b, to->b));
+	}
+	fade.nr_colors = n;
+	if (unlikely(n == 0))
+		return;
+
+	fade.start_t = vm_get_ticks();
+	fade.active = true;
+	palette_tick();
+}
+
+/*
+ * Start a linear fade of the given colors to `target` (an array of 256
+ * colors) over `ms` milliseconds (scaled by the transition speed).
+ */
+void fade_palette_start(const SDL_Color *target, const uint8_t *colors, unsigned nr_colors,
+		unsigned ms)
+{
+	fade_start(FADE_LINEAR, target, colors, nr_colors, ms * config.transition_speed);
+}
+
+void fade_palette_start_range(const SDL_Color *target, unsigned start, unsigned n, unsigned ms)
+{
+	uint8_t colors[256];
+	assert(start + n <= 256);
+	for (unsigned i = 0; i < n; i++) {
+		colors[i] = start + i;
+	}
+	fade_palette_start(target, colors, n, ms);
+}
+
+/*
+ * Start a fade in which each color channel moves towards its target by 1
+ * every `step_ms` milliseconds.
+ */
+void fade_palette_start_fixed_step(const SDL_Color *target, unsigned start, unsigned n,
+		unsigned step_ms)
+{
+	uint8_t colors[256];
+	assert(start + n <= 256);
+	for (unsigned i = 0; i < n; i++) {
+		colors[i] = start + i;
+	}
+	fade_start(FADE_FIXED_STEP, target, colors, n, max(1, step_ms));
+}
+
+/*
+ * Start a fade of an alpha value from `from` to `to` over `ms` milliseconds
+ * (scaled by the transition speed). The value is read with fade_alpha() by
+ * the code drawing the fade.
+ */
+void fade_alpha_start(float from, float to, unsigned ms)
+{
+	alpha.from = from;
+	alpha.to = to;
+	alpha.ms = ms * config.transition_speed;
+	alpha.value = from;
+	alpha.start_t = vm_get_ticks();
+	alpha.active = true;
+	alpha_tick();
+}
+
+float fade_alpha(void)
+{
+	return alpha.value;
+}
+
+/*
+ * Run the active alpha fade to completion. `cb` is called once per frame
+ * with the current alpha value to draw the fade; if it returns false, the
+ * fade is finished immediately.
+ */
+void fade_alpha_wait(bool (*cb)(float alpha, void *data), void *data)
+{
+	vm_timer_t timer = vm_timer_create();
+	while (alpha.active) {
+		if (!cb(alpha.value, data)) {
+			alpha.value = alpha.to;
+			alpha.active = false;
+			break;
+		}
+		vm_peek();
+		vm_timer_tick(&timer, FADE_FRAME_TIME);
+	}
+}
@@ -26,8 +26,10 @@
 #include "ai5/cg.h"
 
 #include "ai5.h"
+#include "fade.h"
 #include "game.h"
 #include "gfx_private.h"
+#include "profile.h"
 #include "vm.h"
 
 #define gfx_decode_direct(color) _gfx_decode_direct(color, __func__)
@@ -76,11 +78,62 @@ bool gfx_confirm_quit(void)
 struct gfx gfx = {0};
 struct gfx_view gfx_view = { 640, 400 };
 
+/*
+ * State for presenting indexed surfaces. The display is converted with a
+ * cached lookup table, and the set of colors used on each row of the display
+ * is tracked so that a palette change only re-converts the rows which use
+ * one of the changed colors.
+ */
+static struct {
+	// palette the display was converted with
+	SDL_Color palette[256];
+	uint8_t lut[256][3];
+	// bitmap of the colors used on each row of the display
+	uint8_t (*row_colors)[32];
+} indexed = {0};
+
+/*
+ * State for panning the view over a surface larger than the view. The whole
+ * surface is converted to a texture once, and panning only changes the
+ * presented rectangle of that texture.
+ */
+static struct {
+	// the panned surface, or -1
+	int surface;
+	SDL_Surface *display;
+	SDL_Texture *texture;
+} pan = { .surface = -1 };
+
+static void add_written(struct gfx_surface *s, const SDL_Rect *r)
+{
+	if (s->nr_written < GFX_MAX_WRITTEN)
+		s->written[s->nr_written++] = *r;
+	else
+		SDL_UnionRect(&s->written[GFX_MAX_WRITTEN-1], r, &s->written[GFX_MAX_WRITTEN-1]);
+}
+
 void gfx_dirty(unsigned surface, int x, int y, int w, int h)
 {
 	gfx.surface[surface].dirty = true;
 	SDL_Rect r = { x, y, w, h };
 	SDL_UnionRect(&gfx.surface[surface].damaged, &r, &gfx.surface[surface].damaged);
+	add_written(&gfx.surface[surface], &r);
+}
+
+/*
+ * Get the regions of a surface which have been written since the last call
+ * (for code which redraws a surface incrementally and needs to know when
+ * its pixels were overwritten by something else). Returns the number of
+ * regions stored in `rects` (which may be NULL).
+ */
+unsigned gfx_take_written(unsigned surface, SDL_Rect *rects)
+{
+	struct gfx_surface *s = &gfx.surface[surface];
+	unsigned n = s->nr_written;
+	if (rects)
+		memcpy(rects, s->written, n * sizeof(SDL_Rect));
+	s->nr_written = 0;
+	return n;
 }
 
 bool gfx_is_dirty(unsigned surface)
@@ -98,6 +151,7 @@ void gfx_screen_dirty(void)
 {
 	gfx.surface[gfx.screen].dirty = true;
 	gfx.surface[gfx.screen].damaged = gfx.surface[gfx.screen].src;
+	add_written(&gfx.surface[gfx.screen], &gfx.surface[gfx.screen].src);
 }
 
 void gfx_whole_surface_dirty(unsigned surface)
@@ -272,7 +326,6 @@ static void gfx_init_window(void)
 		SDL_FreeSurface(gfx.surface[i].s);
 	}
 	SDL_FreeSurface(gfx.display);
-	SDL_FreeSurface(gfx.scaled_display);
 	SDL_DestroyTexture(gfx.texture);
 
 	// recreate and initialize surfaces/texture
@@ -292,6 +345,8 @@ static void gfx_init_window(void)
 		gfx.surface[i].scaled = false;
 		gfx.surface[i].dirty = false;
 		gfx.surface[i].damaged = (SDL_Rect) {0};
+		gfx.surface[i].written[0] = gfx.surface[i].src;
+		gfx.surface[i].nr_written = 1;
 	}
 	gfx.surface[gfx.screen].src.w = gfx_view.w;
 	gfx.surface[gfx.screen].src.h = gfx_view.h;
@@ -299,13 +354,14 @@ static void gfx_init_window(void)
 
 	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, gfx.display, 0, gfx_view.w, gfx_view.h,
 			GFX_DIRECT_BPP, GFX_DIRECT_FORMAT);
-	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, gfx.scaled_display, 0, gfx_view.w,
-			gfx_view.h, GFX_DIRECT_BPP, GFX_DIRECT_FORMAT);
 	SDL_CALL(SDL_FillRect, gfx.display, NULL, SDL_MapRGB(gfx.display->format, 0, 0, 0));
-	SDL_CALL(SDL_FillRect, gfx.scaled_display, NULL,
-			SDL_MapRGB(gfx.scaled_display->format, 0, 0, 0));
 
 	gfx.texture = gfx_create_texture(gfx_view.w, gfx_view.h);
+
+	if (game->bpp == 8) {
+		free(indexed.row_colors);
+		indexed.row_colors = xcalloc(gfx_view.h, sizeof(indexed.row_colors[0]));
+	}
 }
 
 void gfx_set_icon(void)
@@ -325,11 +381,11 @@ static void gfx_fini(void)
 			SDL_FreeSurface(gfx.surface[i].s);
 		}
 		SDL_FreeSurface(gfx.display);
-		SDL_FreeSurface(gfx.scaled_display);
 		for (int i = 0; i < GFX_NR_OVERLAYS; i++) {
 			if (gfx.overlay[i].s)
 				SDL_FreeSurface(gfx.overlay[i].s);
 		}
+		gfx_pan_end();
 		SDL_DestroyTexture(gfx.texture);
 		SDL_DestroyRenderer(gfx.renderer);
 		SDL_DestroyWindow(gfx.window);
@@ -371,37 +427,217 @@ void gfx_init(const char *name)
 	atexit(gfx_fini);
 }
 
-void gfx_update(void)
+/*
+ * Update the lookup table from the palette of the screen. The colors which
+ * changed are set in the `changed` bitmap.
+ */
+static bool indexed_palette_update(struct gfx_surface *screen, uint8_t changed[32])
 {
-	struct gfx_surface *screen = &gfx.surface[gfx.screen];
-	if (gfx.hidden || !screen->dirty)
+	SDL_Color *colors = screen->s->format->palette->colors;
+	bool any_changed = false;
+	for (int i = 0; i < 256; i++) {
+		SDL_Color *a = &colors[i], *b = &indexed.palette[i];
+		if (a->r == b->r && a->g == b->g && a->b == b->b)
+			continue;
+		changed[i >> 3] |= 1 << (i & 7);
+		any_changed = true;
+		indexed.palette[i] = *a;
+		indexed.lut[i][0] = a->r;
+		indexed.lut[i][1] = a->g;
+		indexed.lut[i][2] = a->b;
+	}
+	return any_changed;
+}
+
+/*
+ * Add the rows of the display which use a color that changed since the
+ * display was last converted to the damaged area of the screen.
+ */
+static void indexed_palette_damage(struct gfx_surface *screen)
+{
+	uint8_t changed[32] = {0};
+	if (!indexed_palette_update(screen, changed))
 		return;
-	SDL_Rect dst_r = screen->damaged;
-	// XXX: only shuusaku uses this...
-	dst_r.y -= screen->src.y;
-	SDL_CALL(SDL_BlitSurface, screen->s, &screen->damaged, gfx.display, &dst_r);
-	for (int i = 0; i < GFX_NR_OVERLAYS; i++) {
-		if (gfx.overlay[i].s && gfx.overlay[i].enabled) {
-			SDL_CALL(SDL_BlitSurface, gfx.overlay[i].s, &screen->damaged,
-					gfx.display, &screen->damaged);
+
+	int first = -1, last = -1;
+	for (int y = 0; y < (int)gfx_view.h; y++) {
+		for (int i = 0; i < 32; i++) {
+			if (indexed.row_colors[y][i] & changed[i]) {
+				if (first < 0)
+					first = y;
+				last = y;
+				break;
+			}
 		}
 	}
+	if (first >= 0) {
+		gfx_dirty(gfx.screen, screen->src.x, screen->src.y + first, screen->src.w,
+				last - first + 1);
+	}
+}
+
+/*
+ * Convert a region of an indexed surface to the display. Like SDL_BlitSurface,
+ * `dst_r` is set to the final (clipped) rectangle.
+ */
+static void indexed_convert(SDL_Surface *src, SDL_Rect *src_r, SDL_Rect *dst_r)
+{
+	SDL_Point dst_p = { dst_r->x, dst_r->y };
+	if (!gfx_copy_clip(src, src_r, gfx.display, &dst_p)) {
+		*dst_r = (SDL_Rect) {0};
+		return;
+	}
+	*dst_r = (SDL_Rect) { dst_p.x, dst_p.y, src_r->w, src_r->h };
+
+	// the color set of a row can only be reset if the whole row is converted
+	bool whole_rows = dst_r->x == 0 && dst_r->w == gfx.display->w;
+	for (int row = 0; row < dst_r->h; row++) {
+		uint8_t *src_p = src->pixels + (src_r->y + row) * src->pitch + src_r->x;
+		uint8_t *dst_p = gfx.display->pixels + (dst_r->y + row) * gfx.display->pitch
+			+ dst_r->x * 3;
+		uint8_t *row_colors = indexed.row_colors[dst_r->y + row];
+		if (whole_rows)
+			memset(row_colors, 0, sizeof(indexed.row_colors[0]));
+		for (int col = 0; col < dst_r->w; col++, src_p++, dst_p += 3) {
+			memcpy(dst_p, indexed.lut[*src_p], 3);
+			row_colors[*src_p >> 3] |= 1 << (*src_p & 7);
+		}
+	}
+}
+
+// minimum time between presented frames during turbo skip
+#define TURBO_PRESENT_INTERVAL 100
+
+static void gfx_present(struct gfx_surface *screen, SDL_Texture *texture, SDL_Rect *tex_r)
+{
+	// offsets and scaling are applied by the renderer
+	SDL_Rect out_r = { screen->dst.x, screen->dst.y, tex_r->w, tex_r->h };
 	if (screen->scaled) {
-		SDL_Rect src = screen->src;
-		SDL_Rect dst = screen->dst;
-		SDL_CALL(SDL_FillRect, gfx.scaled_display, NULL, 0);
-		SDL_CALL(SDL_BlitScaled, gfx.display, &src, gfx.scaled_display, &dst);
-		SDL_CALL(SDL_UpdateTexture, gfx.texture, NULL, gfx.scaled_display->pixels,
-				gfx.scaled_display->pitch);
-	} else {
-		uint8_t *p = gfx.display->pixels + dst_r.y * gfx.display->pitch
-			+ dst_r.x * gfx.display->format->BytesPerPixel;
-		SDL_CALL(SDL_UpdateTexture, gfx.texture, &dst_r, p, gfx.display->pitch);
+		out_r.w = screen->dst.w;
+		out_r.h = screen->dst.h;
 	}
 	SDL_CALL(SDL_RenderClear, gfx.renderer);
-	SDL_CALL(SDL_RenderCopy, gfx.renderer, gfx.texture, NULL, NULL);
+	SDL_CALL(SDL_RenderCopy, gfx.renderer, texture, tex_r, &out_r);
 	SDL_RenderPresent(gfx.renderer);
 	gfx_clean(gfx.screen);
+	if (unlikely(profile_enabled))
+		profile_frames++;
+}
+
+/*
+ * Present a panned surface. Only the damaged part of the surface is converted;
+ * the view offset just selects the part of the texture that is presented.
+ * Overlays are not drawn over a panned surface.
+ */
+static void pan_update(struct gfx_surface *screen)
+{
+	SDL_Rect whole = { 0, 0, screen->s->w, screen->s->h };
+	uint8_t changed[32] = {0};
+	if (game->bpp == 8 && indexed_palette_update(screen, changed))
+		screen->damaged = whole;
+
+	SDL_Rect r;
+	if (SDL_IntersectRect(&screen->damaged, &whole, &r)) {
+		SDL_Rect dst_r = r;
+		SDL_CALL(SDL_BlitSurface, screen->s, &r, pan.display, &dst_r);
+		uint8_t *p = pan.display->pixels + r.y * pan.display->pitch
+			+ r.x * pan.display->format->BytesPerPixel;
+		SDL_CALL(SDL_UpdateTexture, pan.texture, &r, p, pan.display->pitch);
+	}
+
+	SDL_Rect tex_r = { screen->src.x, screen->src.y, min(screen->src.w, gfx_view.w),
+		min(screen->src.h, gfx_view.h) };
+	gfx_present(screen, pan.texture, &tex_r);
+}
+
+/*
+ * Begin panning the view over surface `i`. The surface is converted to a
+ * texture of its own size, so that gfx_set_view_offset doesn't need to
+ * convert anything. Falls back to the normal path if the renderer can't
+ * create a texture that large.
+ */
+void gfx_pan_begin(unsigned i)
+{
+	if (unlikely(i >= GFX_NR_SURFACES || !gfx.surface[i].s)) {
+		WARNING("Invalid surface index: %u", i);
+		return;
+	}
+	gfx_pan_end();
+
+	SDL_Surface *s = gfx.surface[i].s;
+	SDL_RendererInfo info;
+	SDL_CALL(SDL_GetRendererInfo, gfx.renderer, &info);
+	if ((info.max_texture_width && s->w > info.max_texture_width)
+			|| (info.max_texture_height && s->h > info.max_texture_height)) {
+		NOTICE("Surface %u is too large to pan in the renderer", i);
+		return;
+	}
+
+	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, pan.display, 0, s->w, s->h,
+			GFX_DIRECT_BPP, GFX_DIRECT_FORMAT);
+	pan.texture = gfx_create_texture(s->w, s->h);
+	pan.surface = i;
+	gfx.surface[i].dirty = true;
+	gfx.surface[i].damaged = (SDL_Rect) { 0, 0, s->w, s->h };
+}
+
+void gfx_pan_end(void)
+{
+	if (pan.surface < 0)
+		return;
+	SDL_DestroyTexture(pan.texture);
+	SDL_FreeSurface(pan.display);
+	pan.texture = NULL;
+	pan.display = NULL;
+	pan.surface = -1;
+	// the display wasn't updated while panning
+	gfx_screen_dirty();
+}
+
+void gfx_update(void)
+{
+	struct gfx_surface *screen = &gfx.surface[gfx.screen];
+	if (gfx.hidden || !screen->dirty)
+		return;
+	// in turbo mode, only present the current state at a low rate
+	if (vm_turbo()) {
+		static uint32_t last_present = 0;
+		uint32_t t = SDL_GetTicks();
+		if (t - last_present < TURBO_PRESENT_INTERVAL)
+			return;
+		last_present = t;
+	}
+	if (pan.surface == (int)gfx.screen) {
+		pan_update(screen);
+		return;
+	}
+	if (game->bpp == 8)
+		indexed_palette_damage(screen);
+
+	// convert the damaged part of the view (in view coordinates)
+	SDL_Rect src_r;
+	if (SDL_IntersectRect(&screen->damaged, &screen->src, &src_r)) {
+		SDL_Rect dst_r = { src_r.x - screen->src.x, src_r.y - screen->src.y, src_r.w, src_r.h };
+		if (game->bpp == 8)
+			indexed_convert(screen->s, &src_r, &dst_r);
+		else
+			SDL_CALL(SDL_BlitSurface, screen->s, &src_r, gfx.display, &dst_r);
+		for (int i = 0; i < GFX_NR_OVERLAYS; i++) {
+			if (gfx.overlay[i].s && gfx.overlay[i].enabled) {
+				SDL_Rect r = dst_r;
+				SDL_CALL(SDL_BlitSurface, gfx.overlay[i].s, &r, gfx.display, &r);
+			}
+		}
+		// the blit clips dst_r to the display
+		if (!SDL_RectEmpty(&dst_r)) {
+			uint8_t *p = gfx.display->pixels + dst_r.y * gfx.display->pitch
+				+ dst_r.x * gfx.display->format->BytesPerPixel;
+			SDL_CALL(SDL_UpdateTexture, gfx.texture, &dst_r, p, gfx.display->pitch);
+		}
+	}
+
+	SDL_Rect tex_r = { 0, 0, min(screen->src.w, gfx_view.w), min(screen->src.h, gfx_view.h) };
+	gfx_present(screen, gfx.texture, &tex_r);
 }
 
 void gfx_display_freeze(void)
@@ -417,7 +653,25 @@ void gfx_display_unfreeze(void)
 	gfx_screen_dirty();
 }
 
-#define FADE_FRAME_TIME (16 * config.transition_speed)
+struct display_fade {
+	SDL_Texture *mask;
+	bool (*cb)(void);
+};
+
+/*
+ * Draw a frame of a display fade: the screen texture with the mask texture
+ * blended over it.
+ */
+static bool display_fade_frame(float alpha, void *data)
+{
+	struct display_fade *f = data;
+	SDL_CALL(SDL_SetTextureAlphaMod, f->mask, alpha * 255);
+	SDL_CALL(SDL_RenderClear, gfx.renderer);
+	SDL_CALL(SDL_RenderCopy, gfx.renderer, gfx.texture, NULL, NULL);
+	SDL_CALL(SDL_RenderCopy, gfx.renderer, f->mask, NULL, NULL);
+	SDL_RenderPresent(gfx.renderer);
+	return !f->cb || f->cb();
+}
 
 void _gfx_display_fade_out(uint32_t vm_color, unsigned ms, bool(*cb)(void))
 {
@@ -426,8 +680,6 @@ void _gfx_display_fade_out(uint32_t vm_color, unsigned ms, bool(*cb)(void))
 		return;
 	gfx.hidden = true;
 
-	int step = roundf(256.f / ((ms * config.transition_speed) / FADE_FRAME_TIME));
-
 	// create mask texture with solid color
 	SDL_Color c;
 	if (game->bpp == 8) {
@@ -440,24 +692,15 @@ void _gfx_display_fade_out(uint32_t vm_color, unsigned ms, bool(*cb)(void))
 	SDL_CALL(SDL_UpdateTexture, mask, NULL, gfx.display->pixels, gfx.display->pitch);
 	SDL_CALL(SDL_SetTextureBlendMode, mask, SDL_BLENDMODE_BLEND);
 
-	vm_timer_t timer = vm_timer_create();
-	for (int i = 0; i < 256; i += step) {
-		SDL_CALL(SDL_SetTextureAlphaMod, mask, i);
-		SDL_CALL(SDL_RenderClear, gfx.renderer);
-		SDL_CALL(SDL_RenderCopy, gfx.renderer, gfx.texture, NULL, NULL);
-		SDL_CALL(SDL_RenderCopy, gfx.renderer, mask, NULL, NULL);
-		SDL_RenderPresent(gfx.renderer);
-
-		vm_peek();
-		vm_timer_tick(&timer, FADE_FRAME_TIME);
-		if (cb && !cb())
-			break;
-	}
+	struct display_fade f = { mask, cb };
+	fade_alpha_start(0.f, 1.f, ms);
+	fade_alpha_wait(display_fade_frame, &f);
 
 	SDL_CALL(SDL_SetTextureAlphaMod, mask, 255);
 	SDL_CALL(SDL_RenderClear, gfx.renderer);
 	SDL_CALL(SDL_RenderCopy, gfx.renderer, mask, NULL, NULL);
 	SDL_RenderPresent(gfx.renderer);
+	SDL_DestroyTexture(mask);
 }
 
 void gfx_display_fade_out(uint32_t vm_color, unsigned ms)
@@ -469,7 +712,6 @@ void _gfx_display_fade_in(unsigned ms, bool(*cb)(void))
 {
 	GFX_LOG("gfx_display_fade_in(%u)", ms);
 
-	int step = roundf(256.f / ((ms * config.transition_speed) / FADE_FRAME_TIME));
 	SDL_Texture *mask = gfx_create_texture(gfx_view.w, gfx_view.h);
 	SDL_CALL(SDL_UpdateTexture, mask, NULL, gfx.display->pixels, gfx.display->pitch);
 	SDL_CALL(SDL_SetTextureBlendMode, mask, SDL_BLENDMODE_BLEND);
@@ -477,23 +719,14 @@ void _gfx_display_fade_in(unsigned ms, bool(*cb)(void))
 	SDL_CALL(SDL_BlitSurface, gfx.surface[gfx.screen].s, NULL, gfx.display, NULL);
 	SDL_CALL(SDL_UpdateTexture, gfx.texture, NULL, gfx.display->pixels, gfx.display->pitch);
 
-	vm_timer_t timer = vm_timer_create();
-	for (int i = 255; i >= 0; i -= step) {
-		SDL_CALL(SDL_SetTextureAlphaMod, mask, i);
-		SDL_CALL(SDL_RenderClear, gfx.renderer);
-		SDL_CALL(SDL_RenderCopy, gfx.renderer, gfx.texture, NULL, NULL);
-		SDL_CALL(SDL_RenderCopy, gfx.renderer, mask, NULL, NULL);
-		SDL_RenderPresent(gfx.renderer);
-
-		vm_peek();
-		vm_timer_tick(&timer, FADE_FRAME_TIME);
-		if (cb && !cb())
-			break;
-	}
+	struct display_fade f = { mask, cb };
+	fade_alpha_start(1.f, 0.f, ms);
+	fade_alpha_wait(display_fade_frame, &f);
 
 	SDL_CALL(SDL_RenderClear, gfx.renderer);
 	SDL_CALL(SDL_RenderCopy, gfx.renderer, gfx.texture, NULL, NULL);
 	SDL_RenderPresent(gfx.renderer);
+	SDL_DestroyTexture(mask);
 
 	gfx.hidden = false;
 	gfx_screen_dirty();
@@ -560,7 +793,12 @@ void _gfx_update_palette(int start, int n)
 void gfx_update_palette(int start, int n)
 {
 	_gfx_update_palette(start, n);
-	gfx_screen_dirty();
+	if (game->bpp == 8) {
+		// the rows affected by the change are found when presenting
+		gfx.surface[gfx.screen].dirty = true;
+	} else {
+		gfx_screen_dirty();
+	}
 }
 
 void _gfx_palette_set(const uint8_t *data, unsigned start, unsigned n)
@@ -648,98 +886,19 @@ void gfx_dump_surface(unsigned i, const char *filename)
 	cg_free(cg);
 }
 
-static uint8_t u8_interp(uint8_t a, uint8_t b, float rate)
-{
-	int d = b - a;
-	return a + d * rate;
-}
-
-// crossfade the given color indices
-static void _gfx_palette_crossfade_colors(SDL_Color *new, SDL_Color *old, uint8_t *colors,
-		unsigned nr_colors, unsigned max_color, unsigned ms,
-		bool (*cb)(float,void*), void *data)
-{
-	ms *= config.transition_speed;
-
-	// interpolate between new and old palette over given ms
-	unsigned start_t = vm_get_ticks();
-	unsigned t = 0;
-	while (t < ms) {
-		float rate = (float)t / (float)ms;
-		for (int i = 0; i < nr_colors; i++) {
-			uint8_t c = colors[i];
-			gfx.palette[c].r = u8_interp(old[c].r, new[c].r, rate);
-			gfx.palette[c].g = u8_interp(old[c].g, new[c].g, rate);
-			gfx.palette[c].b = u8_interp(old[c].b, new[c].b, rate);
-		}
-		gfx_update_palette(0, max_color + 1);
-
-		// update
-		vm_peek();
-		SDL_Delay(FADE_FRAME_TIME);
-		t = vm_get_ticks() - start_t;
-
-		if (cb && !cb(rate, data))
-			break;
-	}
-
-	for (int i = 0; i < nr_colors; i++) {
-		uint8_t c = colors[i];
-		gfx.palette[c].r = new[c].r;
-		gfx.palette[c].g = new[c].g;
-		gfx.palette[c].b = new[c].b;
-	}
-	gfx_update_palette(0, max_color+1);
-	gfx_update();
-}
-
-void gfx_crossfade_colors(uint8_t *pal, uint8_t *colors_in, unsigned nr_colors_in,
+void gfx_crossfade_colors(uint8_t *pal, uint8_t *colors, unsigned nr_colors,
 		unsigned ms, bool (*cb)(float,void*), void *data)
 {
 	SDL_Color new[256];
 	read_palette(new, pal, 256);
-
-	SDL_Color old[256];
-	memcpy(old, gfx_screen()->format->palette->colors, sizeof(old));
-	memcpy(gfx.palette, old, sizeof(old));
-
-	uint8_t colors[256];
-	unsigned nr_colors = 0;
-	unsigned max_color = 0;
-	for (unsigned i = 0; i < nr_colors_in; i++) {
-		uint8_t c = colors_in[i];
-		if (old[c].r != new[c].r || old[c].g != new[c].g || old[c].b != new[c].b) {
-			colors[nr_colors++] = c;
-			max_color = max(max_color, c);
-		}
-	}
-	if (unlikely(nr_colors == 0))
-		return;
-
-	_gfx_palette_crossfade_colors(new, old, colors, nr_colors, max_color, ms, cb, data);
+	fade_palette_start(new, colors, nr_colors, ms);
+	fade_wait(cb, data);
 }
 
 void _gfx_palette_crossfade(SDL_Color *new, unsigned start, unsigned n, unsigned ms)
 {
-	assert(start + n <= 256);
-	SDL_Color old[256];
-	memcpy(old, gfx_screen()->format->palette->colors, sizeof(old));
-	memcpy(gfx.palette, old, sizeof(old));
-
-	// get a list of palette indices that need to be interpolated
-	uint8_t colors[256];
-	int nr_colors = 0;
-	int max_color = 0;
-	for (int i = start; i < start+n; i++) {
-		if (old[i].r != new[i].r || old[i].g != new[i].g || old[i].b != new[i].b) {
-			colors[nr_colors++] = i;
-			max_color = max(max_color, i);
-		}
-	}
-	if(unlikely(nr_colors == 0))
-		return;
-
-	_gfx_palette_crossfade_colors(new, old, colors, nr_colors, max_color, ms, NULL, NULL);
+	fade_palette_start_range(new, start, n, ms);
+	fade_wait(NULL, NULL);
 }
 
 // crossfade a given range of colors
@@ -771,7 +930,46 @@ void gfx_set_screen_surface(unsigned i)
 	if (unlikely(i >= GFX_NR_SURFACES || !gfx.surface[i].s))
 		VM_ERROR("Invalid surface number: %u", i);
 	gfx.screen = i;
-	gfx_update_palette(0, 256);
+	_gfx_update_palette(0, 256);
+	gfx_screen_dirty();
+}
+
+/*
+ * Pan the visible region of a surface to (x,y). When the surface is
+ * displayed, the view is presented from this offset without copying it to
+ * another surface.
+ */
+void gfx_set_view_offset(unsigned i, int x, int y)
+{
+	if (unlikely(i >= GFX_NR_SURFACES || !gfx.surface[i].s)) {
+		WARNING("Invalid surface index: %u", i);
+		return;
+	}
+	struct gfx_surface *s = &gfx.surface[i];
+	s->src.x = x;
+	s->src.y = y;
+	// a panned surface is already converted; only the presented part changes
+	if ((int)i == pan.surface)
+		s->dirty = true;
+	else
+		gfx_whole_surface_dirty(i);
+}
+
+/*
+ * Shift the presented view of a surface by (x,y) in the output. The
+ * uncovered area is black.
+ */
+void gfx_set_output_offset(unsigned i, int x, int y)
+{
+	if (unlikely(i >= GFX_NR_SURFACES || !gfx.surface[i].s)) {
+		WARNING("Invalid surface index: %u", i);
+		return;
+	}
+	struct gfx_surface *s = &gfx.surface[i];
+	s->dst.x = x;
+	s->dst.y = y;
+	// nothing needs to be converted, only presented again
+	s->dirty = true;
 }
 
 /*
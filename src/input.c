@@ -19,9 +19,12 @@
 #include "nulib.h"
 
 #include "ai5.h"
+#include "asset.h"
 #include "cursor.h"
 #include "debug.h"
 #include "input.h"
+#include "replay.h"
+#include "savestate.h"
 #include "gfx_private.h"
 #include "vm.h"
 
@@ -57,6 +60,11 @@ static bool controller_rtrigger_mapped_explicitly = false;
 static uint32_t key_down_timestamp[INPUT_NR_INPUTS] = {0};
 static bool key_down[INPUT_NR_INPUTS] = {0};
 
+// turbo skip (F9 held, or --turbo)
+static bool turbo_key_down = false;
+// virtual time elapsed during turbo skip
+static uint32_t turbo_ticks = 0;
+
 uint32_t cursor_swap_event = 0;
 
 static SDL_GameController *controller = NULL;
@@ -195,7 +203,7 @@ void input_key_event(enum input_event_type type, bool down)
 	assert(type >= 0 && type < INPUT_NR_INPUTS);
 	key_down[type] = down;
 	if (down)
-		key_down_timestamp[type] = SDL_GetTicks();
+		key_down_timestamp[type] = vm_get_ticks();
 }
 
 static void key_event(SDL_KeyboardEvent *ev, bool down)
@@ -215,23 +223,13 @@ static enum input_event_type input_event_from_button(int button)
 
 static void mouse_event(SDL_MouseButtonEvent *ev, bool down)
 {
-	enum input_event_type type = input_event_from_button(ev->button);
-	if (type == INPUT_NONE)
-		return;
-	key_down[type] = down;
-	if (down)
-		key_down_timestamp[type] = SDL_GetTicks();
+	input_key_event(input_event_from_button(ev->button), down);
 }
 
 static void controller_button_event(SDL_ControllerButtonEvent *ev)
 {
 	bool down = ev->type == SDL_CONTROLLERBUTTONDOWN;
-	enum input_event_type type = input_event_from_controller_button(ev->button);
-	if (type == INPUT_NONE)
-		return;
-	key_down[type] = down;
-	if (down)
-		key_down_timestamp[type] = SDL_GetTicks();
+	input_key_event(input_event_from_controller_button(ev->button), down);
 }
 
 static vm_timer_t controller_poll_timer = 0;
@@ -253,7 +251,8 @@ static bool controller_get_trigger_down(SDL_GameControllerAxis axis)
 
 static void controller_update_analog(void)
 {
-	if (!config.controller.enabled || !controller)
+	// analog input is not recorded
+	if (!config.controller.enabled || !controller || replay_active())
 		return;
 	if (!vm_timer_tick_async(&controller_poll_timer, 33))
 		return;
@@ -321,83 +320,126 @@ static bool active_controller(int which)
 			SDL_GameControllerGetJoystick(controller));
 }
 
-void handle_events(void)
+static void handle_event(SDL_Event *e)
 {
-	SDL_Event e;
-	while (SDL_PollEvent(&e)) {
-		if (game->handle_event && game->handle_event(&e))
-			continue;
-		switch (e.type) {
-		case SDL_WINDOWEVENT:
-			handle_window_event(&e.window);
-			break;
-		case SDL_KEYDOWN:
-			if (e.key.windowID != gfx.window_id)
-				break;
-			key_event(&e.key, true);
-			switch (e.key.keysym.sym) {
-			case SDLK_F10:    gfx_screenshot(); break;
-			case SDLK_F11:    gfx_window_toggle_fullscreen(); break;
-			case SDLK_F12:    if (debug_on_F12) dbg_repl(); break;
-			case SDLK_MINUS:  gfx_window_decrease_integer_size(); break;
-			case SDLK_EQUALS: gfx_window_increase_integer_size(); break;
-			}
-			break;
-		case SDL_KEYUP:
-			if (e.key.windowID != gfx.window_id)
-				break;
-			key_event(&e.key, false);
-			break;
-		case SDL_MOUSEBUTTONDOWN:
-			if (e.button.windowID != gfx.window_id)
-				break;
-			mouse_event(&e.button, true);
-			break;
-		case SDL_MOUSEBUTTONUP:
-			if (e.button.windowID != gfx.window_id)
-				break;
-			mouse_event(&e.button, false);
-			break;
-		case SDL_MOUSEWHEEL:
-			if (e.wheel.windowID != gfx.window_id)
-				break;
-			if (e.wheel.y > 0)
-				cursor_set_direction(CURSOR_DIR_UP);
-			else if (e.wheel.y < 0)
-				cursor_set_direction(CURSOR_DIR_DOWN);
+	if (game->handle_event && game->handle_event(e))
+		return;
+	switch (e->type) {
+	case SDL_WINDOWEVENT:
+		handle_window_event(&e->window);
+		break;
+	case SDL_KEYDOWN:
+		if (e->key.windowID != gfx.window_id)
 			break;
-		case SDL_CONTROLLERDEVICEADDED:
-			if (!controller)
-				controller = SDL_GameControllerOpen(e.cdevice.which);
+		key_event(&e->key, true);
+		switch (e->key.keysym.sym) {
+		case SDLK_F5:     savestate_request_quick_save(); break;
+		case SDLK_F6:     savestate_request_rewind(); break;
+		case SDLK_F7:     savestate_request_quick_load(); break;
+		case SDLK_F9:     turbo_key_down = true; break;
+		case SDLK_F10:    gfx_screenshot(); break;
+		case SDLK_F11:    gfx_window_toggle_fullscreen(); break;
+		case SDLK_F12:    if (debug_on_F12) dbg_repl(); break;
+		case SDLK_MINUS:  gfx_window_decrease_integer_size(); break;
+		case SDLK_EQUALS: gfx_window_increase_integer_size(); break;
+		}
+		break;
+	case SDL_KEYUP:
+		if (e->key.windowID != gfx.window_id)
 			break;
-		case SDL_CONTROLLERDEVICEREMOVED:
-			if (active_controller(e.cdevice.which)) {
-				SDL_GameControllerClose(controller);
-				controller = find_controller();
-			}
+		key_event(&e->key, false);
+		if (e->key.keysym.sym == SDLK_F9)
+			turbo_key_down = false;
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+		if (e->button.windowID != gfx.window_id)
 			break;
-		case SDL_CONTROLLERBUTTONDOWN:
-		case SDL_CONTROLLERBUTTONUP:
-			if (active_controller(e.cdevice.which))
-				controller_button_event(&e.cbutton);
+		mouse_event(&e->button, true);
+		break;
+	case SDL_MOUSEBUTTONUP:
+		if (e->button.windowID != gfx.window_id)
 			break;
-		default:
-			if (e.type == cursor_swap_event)
-				cursor_swap();
+		mouse_event(&e->button, false);
+		break;
+	case SDL_MOUSEWHEEL:
+		if (e->wheel.windowID != gfx.window_id)
 			break;
+		if (e->wheel.y > 0)
+			cursor_set_direction(CURSOR_DIR_UP);
+		else if (e->wheel.y < 0)
+			cursor_set_direction(CURSOR_DIR_DOWN);
+		break;
+	case SDL_CONTROLLERDEVICEADDED:
+		if (!controller)
+			controller = SDL_GameControllerOpen(e->cdevice.which);
+		break;
+	case SDL_CONTROLLERDEVICEREMOVED:
+		if (active_controller(e->cdevice.which)) {
+			SDL_GameControllerClose(controller);
+			controller = find_controller();
 		}
+		break;
+	case SDL_CONTROLLERBUTTONDOWN:
+	case SDL_CONTROLLERBUTTONUP:
+		if (active_controller(e->cdevice.which))
+			controller_button_event(&e->cbutton);
+		break;
+	default:
+		if (e->type == cursor_swap_event)
+			cursor_swap();
+		break;
+	}
+}
+
+void handle_events(void)
+{
+	SDL_Event e;
+	replay_begin_poll();
+	while (SDL_PollEvent(&e)) {
+		if (replay_filter_event(&e))
+			continue;
+		handle_event(&e);
+	}
+	while (replay_next_event(&e)) {
+		handle_event(&e);
 	}
 	controller_update_analog();
 }
 
+bool vm_turbo(void)
+{
+	return config.turbo || turbo_key_down;
+}
+
+/*
+ * In turbo mode, delays don't sleep: instead the VM clock is advanced so
+ * that timed waits, transitions and animations complete immediately.
+ */
 void vm_delay(int ms)
 {
-	SDL_Delay(ms);
+	if (ms <= 0)
+		return;
+	if (replay_active()) {
+		replay_delay(ms);
+		return;
+	}
+	if (vm_turbo()) {
+		turbo_ticks += ms;
+		return;
+	}
+	// use the idle time for deferred I/O
+	uint32_t start = SDL_GetTicks();
+	asset_voice_prefetch_idle();
+	uint32_t t = SDL_GetTicks() - start;
+	if (t < (unsigned)ms)
+		SDL_Delay(ms - t);
 }
 
 uint32_t vm_get_ticks(void)
 {
-	return SDL_GetTicks();
+	if (replay_active())
+		return replay_get_ticks();
+	return SDL_GetTicks() + turbo_ticks;
 }
 
 static bool event_is_dir(enum input_event_type type)
@@ -456,7 +498,10 @@ bool input_down(enum input_event_type type)
 {
 	assert(type >= 0 && type < INPUT_NR_INPUTS);
 	handle_events();
-	if (key_down[type] || SDL_GetTicks() - key_down_timestamp[type] < 30)
+	if (key_down[type] || vm_get_ticks() - key_down_timestamp[type] < 30)
+		return true;
+	// turbo skip implies message skip
+	if (type == INPUT_CTRL && vm_turbo())
 		return true;
 	if (have_analog_dpad() && event_is_dir(type)) {
 		if (config.controller.left_stick == CONFIG_STICK_DPAD) {
@@ -608,16 +608,7 @@ static void util_offset_screen(struct param_list *params)
 {
 	int16_t x_off = (uint16_t)vm_expr_param(params, 1);
 	int16_t y_off = (uint16_t)vm_expr_param(params, 2);
-	struct gfx_surface *s = &gfx.surface[0];
-	if (!x_off && !y_off) {
-		s->dst = s->src;
-		s->scaled = false;
-	} else {
-		s->dst.x = x_off;
-		s->dst.y = y_off;
-		s->scaled = true;
-	}
-	gfx_screen_dirty();
+	gfx_set_output_offset(0, x_off, y_off);
 }
 
 static void util_item_cursor(struct param_list *params)
@@ -21,6 +21,7 @@
 #include "asset.h"
 #include "audio.h"
 #include "backlog.h"
+#include "compositor.h"
 #include "cursor.h"
 #include "game.h"
 #include "gfx_private.h"
@@ -584,9 +585,33 @@ static void kakyuusei_backlog_add_number(struct param_list *params)
 #define SCROLL_DELTA 2
 #define MOVE_DELTA 4
 
+static SDL_Rect scroll_saved_view;
+
+/*
+ * Surface 9 is displayed directly while scrolling. It is converted to a
+ * texture once, so that scrolling only changes the presented part of it.
+ */
+static void scroll_begin(void)
+{
+	struct gfx_surface *s = &gfx.surface[9];
+	scroll_saved_view = s->src;
+	s->src = (SDL_Rect) { 0, 0, 640, 400 };
+	gfx_set_screen_surface(9);
+	gfx_pan_begin(9);
+}
+
+static void scroll_end(void)
+{
+	gfx_pan_end();
+	gfx.surface[9].src = scroll_saved_view;
+	gfx_copy(0, 0, 640, 400, 9, 0, 0, 0);
+	gfx_set_screen_surface(0);
+	gfx_screen_dirty();
+}
+
 static void scroll_tick(int x, int y, vm_timer_t *timer)
 {
-	gfx_copy(x, y, 640, 400, 9, 0, 0, 0);
+	gfx_set_view_offset(9, x, y);
 	gfx_update();
 	vm_peek();
 	vm_timer_tick(timer, 30);
@@ -605,7 +630,11 @@ static void kakyuusei_scroll(struct param_list *params)
 
 	if (!flags) {
 		gfx_copy(0, 0, 640, 400, 9, 0, 0, 0);
-	} else if (flags & 8) {
+		return;
+	}
+
+	scroll_begin();
+	if (flags & 8) {
 		// scroll with arrow keys
 		SDL_Point cur = { 0, 0 };
 		SDL_Point limit = { w - 640, h - 400 };
@@ -694,6 +723,7 @@ static void kakyuusei_scroll(struct param_list *params)
 			scroll_tick(cur.x, cur.y, &timer);
 		}
 	}
+	scroll_end();
 }
 
 /*
@@ -713,29 +743,14 @@ static void kakyuusei_quake(struct param_list *params)
 	quake_t = min(120, quake_t * 30);
 
 	vm_timer_t timer = vm_timer_create();
-	struct gfx_surface *s = &gfx.surface[0];
-	s->scaled = true;
 	for (unsigned i = 0; i < nr_quakes; i++) {
-		if (i & 1) {
-			if (flags & 1)
-				s->dst.x = -quake_size;
-			if (flags & 2)
-				s->dst.y = -quake_size;
-		} else {
-			if (flags & 1)
-				s->dst.x = quake_size;
-			if (flags & 2)
-				s->dst.y = quake_size;
-		}
-		gfx_screen_dirty();
+		int off = i & 1 ? -(int)quake_size : (int)quake_size;
+		gfx_set_output_offset(0, flags & 1 ? off : 0, flags & 2 ? off : 0);
 		gfx_update();
 		vm_peek();
 		vm_timer_tick(&timer, quake_t);
 	}
-	s->scaled = false;
-	s->dst.x = 0;
-	s->dst.y = 0;
-	gfx_screen_dirty();
+	gfx_set_output_offset(0, 0, 0);
 	gfx_update();
 	vm_timer_tick(&timer, quake_t);
 }
@@ -896,110 +911,32 @@ static void kakyuusei_force_wait(struct param_list *params)
 	}
 }
 
-/*
- * Blit an indexed texture to an RGBA surface (with background mask).
- */
-static void blit_indexed_to_direct(SDL_Surface *src, SDL_Rect *src_r, SDL_Surface *dst,
-		SDL_Rect *dst_r, int mask)
-{
-	assert(src->format->format == SDL_PIXELFORMAT_INDEX8);
-	assert(dst->format->format == SDL_PIXELFORMAT_RGBA32);
-
-	SDL_Rect _src_r = { 0, 0, src->w, src->h };
-	SDL_Rect _dst_r = { 0, 0, dst->w, dst->h };
-	if (!src_r)
-		src_r = &_src_r;
-	if (!dst_r)
-		dst_r = &_dst_r;
-
-	for (int row = 0; row < dst_r->h; row++) {
-		if (dst_r->y + row >= dst->h)
-			break;
-		if (src_r->y + row >= src->h)
-			break;
-		uint8_t *dst_p = dst->pixels + (dst_r->y + row) * dst->pitch + dst_r->x * 4;
-		uint8_t *src_p = src->pixels + (src_r->y + row) * src->pitch + src_r->x;
-		for (int col = 0; col < dst_r->w; col++, src_p++, dst_p += 4) {
-			if (*src_p == mask) {
-				dst_p[0] = 0;
-				dst_p[1] = 0;
-				dst_p[2] = 0;
-				dst_p[3] = 0;
-			} else {
-				SDL_Color *c = &gfx.palette[*src_p];
-				dst_p[0] = c->r;
-				dst_p[1] = c->g;
-				dst_p[2] = c->b;
-				dst_p[3] = 255;
-			}
-		}
-	}
-}
-
-/*
- * Convert credits texture to RGBA.
- */
-static SDL_Texture *get_credits_texture(void)
-{
-	SDL_Surface *src = gfx_get_surface(1);
-	SDL_Surface *dst;
-	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, dst, 0, 320, 864 * 4,
-			32, SDL_PIXELFORMAT_RGBA32);
-
-	for (int col = 0; col < 4; col++) {
-		SDL_Rect src_r = { 320 * col, 0, 320, 864 };
-		SDL_Rect dst_r = { 0, 864 * col, 320, 864 };
-		blit_indexed_to_direct(src, &src_r, dst, &dst_r, 0);
-	}
-
-	SDL_Texture *t;
-	SDL_CTOR(SDL_CreateTexture, t, gfx.renderer, SDL_PIXELFORMAT_RGBA32,
-			SDL_TEXTUREACCESS_STATIC, 320, 864 * 4);
-	SDL_CALL(SDL_SetTextureBlendMode, t, SDL_BLENDMODE_BLEND);
-	SDL_CALL(SDL_UpdateTexture, t, NULL, dst->pixels, dst->pitch);
-	return t;
-}
-
-/*
- * Convert background texture to RGBA.
- */
-static SDL_Texture *get_bg_texture(void)
-{
-	SDL_Surface *src = gfx_get_surface(2);
-	SDL_Surface *dst;
-	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, dst, 0, 640, 400,
-			32, SDL_PIXELFORMAT_RGBA32);
-	blit_indexed_to_direct(src, NULL, dst, NULL, -1);
-
-	SDL_Texture *t;
-	SDL_CTOR(SDL_CreateTexture, t, gfx.renderer, SDL_PIXELFORMAT_RGBA32,
-			SDL_TEXTUREACCESS_STATIC, 640, 400);
-	SDL_CALL(SDL_UpdateTexture, t, NULL, dst->pixels, dst->pitch);
-	return t;
-}
-
 /*
  * Ending credits roll animation. The credits text fades in/out at the bottom/top of screen.
  */
 static void kakyuusei_ending(struct param_list *params)
 {
-	// XXX: we do this with RGBA textures to simplify blending
-	SDL_Texture *bg = get_bg_texture();
-	SDL_Texture *credits = get_credits_texture();
+	struct gfx_layer *bg = gfx_layer_new(640, 400);
+	gfx_layer_add_source(bg, 2, 0, 0, 640, 400, 0, 0, GFX_LAYER_NO_MASK);
+	// the 4 columns of credits text on surface 1 are stacked vertically
+	struct gfx_layer *credits = gfx_layer_new(320, 864 * 4);
+	for (int col = 0; col < 4; col++) {
+		gfx_layer_add_source(credits, 1, 320 * col, 0, 320, 864, 0, 864 * col, 0);
+	}
 
 	int src_top_y = 0;
 	int dst_top_y = 399;
 	vm_timer_t timer = vm_timer_create();
 	while (src_top_y < 2872) {
-		SDL_CALL(SDL_RenderClear, gfx.renderer);
-		SDL_CALL(SDL_RenderCopy, gfx.renderer, bg, NULL, NULL);
+		gfx_compositor_begin();
+		gfx_compositor_quad(bg, NULL, NULL, 255, 255);
 
 		// top fade
-		for (int dst_y = dst_top_y; dst_y < 64; dst_y++) {
-			SDL_Rect src_r = { 0, src_top_y + (dst_y - dst_top_y), 320, 1 };
-			SDL_Rect dst_r = { 0, dst_y, 320, 1 };
-			SDL_CALL(SDL_SetTextureAlphaMod, credits, dst_y * 4);
-			SDL_CALL(SDL_RenderCopy, gfx.renderer, credits, &src_r, &dst_r);
+		if (dst_top_y < 64) {
+			int h = 64 - dst_top_y;
+			SDL_Rect src_r = { 0, src_top_y, 320, h };
+			SDL_Rect dst_r = { 0, dst_top_y, 320, h };
+			gfx_compositor_quad(credits, &src_r, &dst_r, dst_top_y * 4, 255);
 		}
 		// solid portion
 		if (dst_top_y < 337) {
@@ -1008,19 +945,15 @@ static void kakyuusei_ending(struct param_list *params)
 			int h = 337 - dst_y;
 			SDL_Rect src_r = { 0, src_y, 320, h };
 			SDL_Rect dst_r = { 0, dst_y, 320, h };
-			SDL_CALL(SDL_SetTextureAlphaMod, credits, 255);
-			SDL_CALL(SDL_RenderCopy, gfx.renderer, credits, &src_r, &dst_r);
+			gfx_compositor_quad(credits, &src_r, &dst_r, 255, 255);
 		}
 		// bottom fade
-		for (int dst_y = max(dst_top_y, 337); dst_y < 400; dst_y++) {
-			int src_y = src_top_y + (dst_y - dst_top_y);
-			SDL_Rect src_r = { 0, src_y, 320, 1 };
-			SDL_Rect dst_r = { 0, dst_y, 320, 1 };
-			SDL_CALL(SDL_SetTextureAlphaMod, credits, (400 - dst_y) * 4);
-			SDL_CALL(SDL_RenderCopy, gfx.renderer, credits, &src_r, &dst_r);
-		}
+		int dst_y = max(dst_top_y, 337);
+		SDL_Rect src_r = { 0, src_top_y + (dst_y - dst_top_y), 320, 400 - dst_y };
+		SDL_Rect dst_r = { 0, dst_y, 320, 400 - dst_y };
+		gfx_compositor_quad(credits, &src_r, &dst_r, (400 - dst_y) * 4, 0);
 
-		SDL_RenderPresent(gfx.renderer);
+		gfx_compositor_present();
 		vm_peek();
 		vm_timer_tick(&timer, 60);
 		if (dst_top_y > 0) {
@@ -1030,8 +963,8 @@ static void kakyuusei_ending(struct param_list *params)
 		}
 	}
 
-	SDL_DestroyTexture(bg);
-	SDL_DestroyTexture(credits);
+	gfx_layer_free(bg);
+	gfx_layer_free(credits);
 
 	// copy final frame to screen surface
 	gfx_copy_masked(320 * 3, 279, 320, 400, 1, 0, 0, 0, 0);
@@ -17,7 +17,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <time.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -39,6 +38,8 @@
 #include "ini.h"
 #include "input.h"
 #include "memory.h"
+#include "profile.h"
+#include "replay.h"
 #include "vm.h"
 
 #include "../version.h"
@@ -57,6 +58,9 @@ struct config config = {
 	.volume.se = -1,
 	.volume.effect = -1,
 	.volume.voice = -1,
+	.audio = {
+		.frequency = 44100,
+	},
 	.controller = {
 		.enabled = true,
 		.dead_zone = 0.15f,
@@ -79,6 +83,21 @@ static enum config_stick_behavior parse_stick_behavior(const char *str)
 	return CONFIG_STICK_DISABLED;
 }
 
+/*
+ * Parse an integer option in the range [min_value, max_value]. On error a
+ * warning is printed and the current value is kept.
+ */
+static void parse_int_option(const char *section, const char *name, const char *value,
+		long min_value, long max_value, unsigned *out)
+{
+	char *endptr;
+	long i = strtol(value, &endptr, 10);
+	if (*value == '\0' || *endptr != '\0' || i < min_value || i > max_value)
+		WARNING("Invalid value for %s.%s: \"%s\"", section, name, value);
+	else
+		*out = i;
+}
+
 static int cfg_handler(void *user, const char *section, const char *name, const char *value)
 {
 	struct config *config = user;
@@ -229,6 +248,12 @@ static int cfg_handler(void *user, const char *section, const char *name, const
 		config->no_warp_mouse = !!atoi(value);
 	} else if (MATCH("AI5SDL2", "MAPNOWALLSLIDE")) {
 		config->map_no_wallslide = !!atoi(value);
+	} else if (MATCH("AI5SDL2", "AUDIOFREQUENCY")) {
+		parse_int_option(section, name, value, 8000, 192000, &config->audio.frequency);
+	} else if (MATCH("AI5SDL2", "AUDIOBUFFER")) {
+		parse_int_option(section, name, value, 0, 16384, &config->audio.buffer_size);
+	} else if (MATCH("AI5SDL2", "AUDIOCHUNK")) {
+		parse_int_option(section, name, value, 0, 16384, &config->audio.chunk_size);
 	} else if (MATCH("CONTROLLER", "ENABLED")) {
 		config->controller.enabled = !!atoi(value);
 	} else if (MATCH("CONTROLLER", "DEADZONE")) {
@@ -239,12 +264,7 @@ static int cfg_handler(void *user, const char *section, const char *name, const
 		else
 			config->controller.dead_zone = f;
 	} else if (MATCH("CONTROLLER", "CURSORSPEED")) {
-		char *endptr;
-		long i = strtol(value, &endptr, 10);
-		if (*value == '\0' || *endptr != '\0' || i < 0 || i > 128)
-			WARNING("Invalid value for CONTROLLER.CURSORSPEED: \"%s\"", value);
-		else
-			config->controller.cursor_speed = i;
+		parse_int_option(section, name, value, 0, 128, &config->controller.cursor_speed);
 	} else if (MATCH("CONTROLLER", "LEFTANALOG")) {
 		config->controller.left_stick = parse_stick_behavior(value);
 	} else if (MATCH("CONTROLLER", "RIGHTANALOG")) {
@@ -344,9 +364,13 @@ static void usage(void)
 	printf("    --msg-skip-delay=<ms>          Set the message skip delay time (default: %u)\n",
 			DEFAULT_MSG_SKIP_DELAY);
 	printf("    --no-warp-mouse                Don't move the mouse\n");
+	printf("    --profile=<file>               Profile scripts and write folded stacks on exit\n");
+	printf("    --record=<file>                Record input to a replay file\n");
+	printf("    --replay=<file>                Play back a replay file and exit\n");
 	printf("    --texthook-clipboard           Copy text to the system clipboard\n");
 	printf("    --texthook-stdout              Copy text to standard output\n");
 	printf("    --transition-speed=<ms>        Set the speed of CG transition effects (default: 1.0)\n");
+	printf("    --turbo                        Run in turbo skip mode (as if F9 were held)\n");
 	printf("    --version                      Display the AI5-SDL2 version and exit\n");
 
 	if (ai5_target_game == GAME_DOUKYUUSEI) {
@@ -465,10 +489,14 @@ enum {
 	LOPT_GAME,
 	LOPT_MAP_NO_WALLSLIDE,
 	LOPT_NO_WARP_MOUSE,
+	LOPT_PROFILE,
+	LOPT_RECORD,
+	LOPT_REPLAY,
 	LOPT_MSG_SKIP_DELAY,
 	LOPT_TEXTHOOK_CLIPBOARD,
 	LOPT_TEXTHOOK_STDOUT,
 	LOPT_TRANSITION_SPEED,
+	LOPT_TURBO,
 };
 
 static int saved_argc;
@@ -495,6 +523,9 @@ int main(int argc, char *argv[])
 	bool have_game = false;
 	char *ini_name = NULL;
 	bool debug = false;
+	char *profile_path = NULL;
+	char *record_path = NULL;
+	char *replay_path = NULL;
 
 	while (1) {
 		static struct option long_options[] = {
@@ -509,9 +540,13 @@ int main(int argc, char *argv[])
 			{ "help", no_argument, 0, LOPT_HELP },
 			{ "msg-skip-delay", required_argument, 0, LOPT_MSG_SKIP_DELAY },
 			{ "no-warp-mouse", no_argument, 0, LOPT_NO_WARP_MOUSE },
+			{ "profile", required_argument, 0, LOPT_PROFILE },
+			{ "record", required_argument, 0, LOPT_RECORD },
+			{ "replay", required_argument, 0, LOPT_REPLAY },
 			{ "texthook-clipboard", no_argument, 0, LOPT_TEXTHOOK_CLIPBOARD },
 			{ "texthook-stdout", no_argument, 0, LOPT_TEXTHOOK_STDOUT },
 			{ "transition-speed", required_argument, 0, LOPT_TRANSITION_SPEED },
+			{ "turbo", no_argument, 0, LOPT_TURBO },
 			{ "version", no_argument, 0, LOPT_VERSION },
 			// doukyuusei-specific
 			{ "map-no-wallslide", no_argument, 0, LOPT_MAP_NO_WALLSLIDE },
@@ -579,6 +614,15 @@ int main(int argc, char *argv[])
 		case LOPT_NO_WARP_MOUSE:
 			config.no_warp_mouse = true;
 			break;
+		case LOPT_PROFILE:
+			profile_path = strdup(optarg);
+			break;
+		case LOPT_RECORD:
+			record_path = strdup(optarg);
+			break;
+		case LOPT_REPLAY:
+			replay_path = strdup(optarg);
+			break;
 		case LOPT_TEXTHOOK_CLIPBOARD:
 			config.texthook_clipboard = true;
 			break;
@@ -591,6 +635,9 @@ int main(int argc, char *argv[])
 		case LOPT_MAP_NO_WALLSLIDE:
 			config.map_no_wallslide = true;
 			break;
+		case LOPT_TURBO:
+			config.turbo = true;
+			break;
 		}
 	}
 	argc -= optind;
@@ -688,8 +735,11 @@ int main(int argc, char *argv[])
 	DEFAULT_NAME(config.file.priv, "PRIV.ARC");
 #undef DEFAULT_NAME
 
+	if (record_path && replay_path)
+		usage_error("--record and --replay are mutually exclusive");
+
 	// intitialize subsystems
-	srand(time(NULL));
+	replay_init(record_path, replay_path);
 	asset_init();
 	game->mem_init();
 	gfx_init(config.title);
@@ -705,6 +755,10 @@ int main(int argc, char *argv[])
 
 	// execute start mes file
 	vm_load_mes(config.start_mes);
+	if (profile_path) {
+		profile_dump_on_exit(profile_path);
+		profile_start();
+	}
 	if (debug)
 		dbg_repl();
 	game->vm.exec();
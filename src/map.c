@@ -53,6 +53,10 @@
 #define MAP_FRAME_TIME 54
 
 #define NO_TILE 0xffff
+
+// maximum size of the screen (in tiles) for incremental redraw
+#define MAP_MAX_SCREEN_TW 64
+#define MAP_MAX_SCREEN_TH 64
 #define NO_LOCATION 0xffff
 
 enum map_version map_version = MAP_VERSION_OLD;
@@ -116,6 +120,16 @@ static struct {
 	struct map_tile tile_data[MAP_MAX_TILES];
 	// on-screen tiles (dynamic)
 	struct tile tiles[480][640];
+	// on-screen tiles as last drawn to surface 0
+	struct {
+		bool valid;
+		unsigned tw;
+		unsigned th;
+		uint8_t mask_color;
+		struct tile tiles[MAP_MAX_SCREEN_TH][MAP_MAX_SCREEN_TW];
+		// tile was overwritten since it was drawn
+		bool stale[MAP_MAX_SCREEN_TH][MAP_MAX_SCREEN_TW];
+	} drawn;
 	// frame rate timer
 	vm_timer_t timer;
 	// pathing data
@@ -170,6 +184,7 @@ void map_load_bitmap(const char *name, unsigned col, unsigned row, unsigned whic
 	case 3:  copy_to_bmp_cha(0, file); break;
 	default: copy_to_bmp_cha(0x7800 + col, file); break;
 	}
+	map.drawn.valid = false;
 }
 
 void map_load_palette(const char *name, unsigned which)
@@ -191,6 +206,7 @@ void map_load_palette(const char *name, unsigned which)
 		else
 			map.pal_map[i] = gfx_decode_bgr555(le_get16(file->data, i * 2));
 	}
+	map.drawn.valid = false;
 }
 
 // Bitmaps }}}
@@ -429,18 +445,93 @@ static void draw_tile_kakyuusei(struct tile *tile, int x, int y)
 	gfx_unlock_surface(sprite_s);
 }
 
+static bool tile_equal(struct tile *a, struct tile *b)
+{
+	return a->bg == b->bg && a->fg == b->fg && a->sp == b->sp && a->sp2 == b->sp2
+		&& a->fg_cha == b->fg_cha;
+}
+
+/*
+ * Check whether the tiles drawn by the previous call to map_draw_tiles are
+ * still on surface 0. Tiles overlapping any region written by something
+ * other than the map since then are marked stale.
+ */
+static bool drawn_tiles_valid(void)
+{
+	SDL_Rect written[GFX_MAX_WRITTEN];
+	unsigned nr_written = gfx_take_written(0, written);
+	bool valid = map.drawn.valid && map.drawn.tw == map.screen.tw
+		&& map.drawn.th == map.screen.th;
+	if (map_version == MAP_VERSION_OLD) {
+		// tile graphics are read from surfaces 2 and 3
+		if (gfx_take_written(2, NULL))
+			valid = false;
+		if (gfx_take_written(3, NULL))
+			valid = false;
+		if (mem_get_sysvar16(mes_sysvar16_mask_color) != map.drawn.mask_color)
+			valid = false;
+	}
+	if (!valid)
+		return false;
+
+	SDL_Rect screen = { 0, 0, map.drawn.tw * 16, map.drawn.th * 16 };
+	for (unsigned i = 0; i < nr_written; i++) {
+		SDL_Rect r;
+		if (!SDL_IntersectRect(&written[i], &screen, &r))
+			continue;
+		for (int row = r.y / 16; row * 16 < r.y + r.h; row++) {
+			for (int col = r.x / 16; col * 16 < r.x + r.w; col++) {
+				map.drawn.stale[row][col] = true;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * Draw the on-screen tiles to surface 0. Only tiles which changed since the
+ * previous call (i.e. tiles covered by sprites which moved or animated) or
+ * which were overwritten in the meantime are redrawn.
+ */
 void map_draw_tiles(void)
 {
+	bool incremental = map.screen.tw <= MAP_MAX_SCREEN_TW
+		&& map.screen.th <= MAP_MAX_SCREEN_TH
+		&& drawn_tiles_valid();
+
+	unsigned min_col = map.screen.tw, min_row = map.screen.th;
+	unsigned max_col = 0, max_row = 0;
 	for (unsigned row = 0; row < map.screen.th; row++) {
 		for (unsigned col = 0; col < map.screen.tw; col++) {
+			struct tile *tile = &map.tiles[row][col];
+			if (incremental && !map.drawn.stale[row][col]
+					&& tile_equal(tile, &map.drawn.tiles[row][col]))
+				continue;
 			if (map_version == MAP_VERSION_OLD)
-				draw_tile_kakyuusei(&map.tiles[row][col], col * 16, row * 16);
+				draw_tile_kakyuusei(tile, col * 16, row * 16);
 			else
-				draw_tile(&map.tiles[row][col], col * 16, row * 16);
+				draw_tile(tile, col * 16, row * 16);
+			min_col = min(min_col, col);
+			min_row = min(min_row, row);
+			max_col = max(max_col, col + 1);
+			max_row = max(max_row, row + 1);
+			if (row < MAP_MAX_SCREEN_TH && col < MAP_MAX_SCREEN_TW) {
+				map.drawn.tiles[row][col] = *tile;
+				map.drawn.stale[row][col] = false;
+			}
 		}
 	}
 
-	gfx_whole_surface_dirty(0);
+	if (min_col < max_col) {
+		gfx_dirty(0, min_col * 16, min_row * 16, (max_col - min_col) * 16,
+				(max_row - min_row) * 16);
+	}
+	// the map's own writes don't invalidate anything
+	gfx_take_written(0, NULL);
+	map.drawn.valid = map.screen.tw <= MAP_MAX_SCREEN_TW && map.screen.th <= MAP_MAX_SCREEN_TH;
+	map.drawn.tw = map.screen.tw;
+	map.drawn.th = map.screen.th;
+	map.drawn.mask_color = mem_get_sysvar16(mes_sysvar16_mask_color);
 
 	// XXX: If shift is held down, we double the frame rate.
 	//      This is not what AI5WIN.EXE does (it doubles the amount of movement that
@@ -590,6 +681,10 @@ static void place_sprite(struct ccd_sprite *sp)
 	int off_ty = (int)sp->y - map.screen.ty;
 	int screen_tw = map.screen.tw;
 	int screen_th = map.screen.th;
+	// skip sprites which are entirely off-screen
+	if (off_tx >= screen_tw || off_ty >= screen_th || off_tx + (int)sp->w <= 0
+			|| off_ty + (int)sp->h <= 0)
+		return;
 	for (int row = 0, sp_t = 0; row < sp->h && off_ty + row < screen_th; row++) {
 		for (int col = 0; col < sp->w && off_tx + col < screen_tw; col++, sp_t++) {
 			if (off_tx + col < 0 || off_ty + row < 0)
@@ -0,0 +1,105 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "nulib.h"
+
+#include "memory.h"
+
+uint32_t memory_high_water[MEMORY_NR_REGIONS] = {0};
+
+static const struct {
+	const char *name;
+	size_t off;
+	size_t size;
+} regions[MEMORY_NR_REGIONS] = {
+	[MEMORY_REGION_MEM16] = {
+		"mem16",
+		offsetof(struct memory, mem16),
+		sizeof(((struct memory*)0)->mem16)
+	},
+	[MEMORY_REGION_FILE_DATA] = {
+		"file_data",
+		offsetof(struct memory, file_data),
+		sizeof(((struct memory*)0)->file_data)
+	},
+	[MEMORY_REGION_BACKLOG] = {
+		"backlog",
+		offsetof(struct memory, backlog),
+		sizeof(((struct memory*)0)->backlog)
+	},
+};
+
+// Get the end of the last non-zero byte in a region.
+uint32_t mem_nonzero_end(const uint8_t *p, uint32_t size)
+{
+	while (size > 0 && !p[size-1])
+		size--;
+	return size;
+}
+
+#ifdef __linux__
+static bool get_resident(const uint8_t *p, size_t size, uint32_t *out)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)p & ~(page_size - 1);
+	uintptr_t end = ((uintptr_t)p + size + page_size - 1) & ~(page_size - 1);
+	size_t nr_pages = (end - start) / page_size;
+	unsigned char *vec = xmalloc(nr_pages);
+	if (mincore((void*)start, end - start, vec)) {
+		free(vec);
+		return false;
+	}
+	uint32_t resident = 0;
+	for (size_t i = 0; i < nr_pages; i++) {
+		if (vec[i] & 1)
+			resident += page_size;
+	}
+	free(vec);
+	*out = resident;
+	return true;
+}
+#else
+static bool get_resident(const uint8_t *p, size_t size, uint32_t *out)
+{
+	return false;
+}
+#endif
+
+/*
+ * Get usage statistics for each region. The high-water mark is the larger
+ * of the tracked value and the end of the last non-zero byte (which catches
+ * writes made directly by scripts). Scanning only reads, so untouched pages
+ * remain unbacked.
+ */
+void memory_get_usage(struct memory_usage usage[MEMORY_NR_REGIONS])
+{
+	for (int i = 0; i < MEMORY_NR_REGIONS; i++) {
+		const uint8_t *p = memory_raw + regions[i].off;
+		usage[i].name = regions[i].name;
+		usage[i].size = regions[i].size;
+		usage[i].high_water = max(memory_high_water[i],
+				mem_nonzero_end(p, regions[i].size));
+		usage[i].have_resident = get_resident(p, regions[i].size, &usage[i].resident);
+	}
+}
@@ -15,10 +15,12 @@
  * along with this program; if not, see <http://gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/fifo.h>
 #include <libavutil/imgutils.h>
+#include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 
 #include "nulib.h"
@@ -33,6 +35,11 @@
 
 #define QUEUE_SIZE 10
 
+// number of frames handed to the mixer per audio callback
+#define AUDIO_BLOCK_FRAMES 1024
+// capacity of the converted audio buffer (in frames)
+#define AUDIO_BUF_FRAMES 16384
+
 struct decoder {
 	AVFormatContext *format_ctx;
 	AVStream *stream;
@@ -59,18 +66,39 @@ struct movie_context {
 	unsigned video_current_frame;
 
 	sts_mixer_stream_t sts_stream;
-	int bytes_per_sample;
 	int voice;
 	int volume;
-	bool interleaved;
+
+	// Audio converted to stereo float at the mixer rate. Only touched by
+	// the audio thread once playback starts.
+	struct SwrContext *swr_ctx;
+	unsigned audio_rate;
+	unsigned audio_len;
+	unsigned audio_consumed;
+	uint64_t audio_frames_played;
+	bool audio_eof;
+	float audio_buf[AUDIO_BUF_FRAMES * 2];
 
 	// Time keeping data. Written by audio handler and referenced by video
-	// handler (i.e. we sync the video to the audio).
-	double stream_time; // in seconds
-	uint32_t wall_time_ms;
-	SDL_mutex *timer_mutex;
+	// handler (i.e. we sync the video to the audio). The stream time (ms)
+	// is packed into the high 32 bits and the wall time (ms) at which it
+	// was recorded into the low 32 bits, so that both can be updated
+	// without a lock.
+	_Atomic uint64_t clock;
 };
 
+static void clock_set(struct movie_context *mc, uint32_t stream_ms, uint32_t wall_ms)
+{
+	atomic_store(&mc->clock, ((uint64_t)stream_ms << 32) | wall_ms);
+}
+
+static void clock_get(struct movie_context *mc, uint32_t *stream_ms, uint32_t *wall_ms)
+{
+	uint64_t clock = atomic_load(&mc->clock);
+	*stream_ms = clock >> 32;
+	*wall_ms = clock & 0xffffffff;
+}
+
 static void free_decoder(struct decoder *dec)
 {
 	if (dec->format_ctx)
@@ -172,55 +200,66 @@ static bool decode_frame(struct decoder *dec)
 }
 
 #ifndef USE_SDL_MIXER
+/*
+ * Convert decoded audio frames into mc->audio_buf until it holds at least
+ * `frames` frames (or the stream ends).
+ */
+static void fill_audio_buf(struct movie_context *mc, unsigned frames)
+{
+	while (mc->audio_len < frames && !mc->audio_eof) {
+		uint8_t *out = (uint8_t*)(mc->audio_buf + mc->audio_len * 2);
+		int n;
+		if (decode_frame(&mc->audio)) {
+			n = swr_convert(mc->swr_ctx, &out, AUDIO_BUF_FRAMES - mc->audio_len,
+					(const uint8_t**)mc->audio.frame->extended_data,
+					mc->audio.frame->nb_samples);
+		} else {
+			// drain samples buffered in the resampler
+			n = swr_convert(mc->swr_ctx, &out, AUDIO_BUF_FRAMES - mc->audio_len,
+					NULL, 0);
+			mc->audio_eof = true;
+		}
+		if (n < 0) {
+			WARNING("swr_convert failed: %d", n);
+			mc->audio_eof = true;
+			break;
+		}
+		mc->audio_len += n;
+	}
+}
+
 static int audio_callback(sts_mixer_sample_t *sample, void *data)
 {
 	struct movie_context *mc = data;
 	assert(sample == &mc->sts_stream.sample);
 
-	if (!decode_frame(&mc->audio)) {
-		free(sample->data);
+	// discard the block consumed by the mixer
+	if (mc->audio_consumed) {
+		mc->audio_len -= mc->audio_consumed;
+		memmove(mc->audio_buf, mc->audio_buf + mc->audio_consumed * 2,
+				mc->audio_len * 2 * sizeof(float));
+		mc->audio_consumed = 0;
+	}
+
+	fill_audio_buf(mc, AUDIO_BLOCK_FRAMES);
+	if (!mc->audio_len) {
 		sample->length = 0;
-		sample->data = NULL;
 		mc->voice = -1;
 		return STS_STREAM_COMPLETE;
 	}
 
-	const int nr_channels = 2;
-	unsigned samples = 0;
-	if (mc->interleaved) {
-		samples = mc->audio.frame->linesize[0] / (mc->bytes_per_sample * 2);
-		if (samples * nr_channels != sample->length) {
-			free(sample->data);
-			sample->length = samples * nr_channels;
-			sample->data = xmalloc(sample->length * mc->bytes_per_sample);
-		}
-		memcpy(sample->data, mc->audio.frame->data[0], samples * mc->bytes_per_sample * 2);
-	} else {
-		samples = mc->audio.frame->linesize[0] / mc->bytes_per_sample;
-		if (samples * nr_channels != sample->length) {
-			free(sample->data);
-			sample->length = samples * nr_channels;
-			sample->data = xmalloc(sample->length * mc->bytes_per_sample);
-		}
-		// Interleave.
-		uint8_t *l = mc->audio.frame->data[0];
-		uint8_t *r = mc->audio.frame->data[mc->audio.ctx->ch_layout.nb_channels > 1 ? 1 : 0];
-		uint8_t *out = sample->data;
-		for (unsigned i = 0; i < samples; i++) {
-			memcpy(out, l, mc->bytes_per_sample);
-			out += mc->bytes_per_sample;
-			l += mc->bytes_per_sample;
-			memcpy(out, r, mc->bytes_per_sample);
-			out += mc->bytes_per_sample;
-			r += mc->bytes_per_sample;
-		}
+	// pad the final block with silence
+	unsigned frames = min(mc->audio_len, AUDIO_BLOCK_FRAMES);
+	if (frames < AUDIO_BLOCK_FRAMES) {
+		memset(mc->audio_buf + frames * 2, 0,
+				(AUDIO_BLOCK_FRAMES - frames) * 2 * sizeof(float));
 	}
+	mc->audio_consumed = frames;
+	sample->length = AUDIO_BLOCK_FRAMES * 2;
 
 	// Update the timestamp.
-	SDL_LockMutex(mc->timer_mutex);
-	mc->stream_time += (double)samples / mc->audio.ctx->sample_rate;
-	mc->wall_time_ms = SDL_GetTicks();
-	SDL_UnlockMutex(mc->timer_mutex);
+	mc->audio_frames_played += frames;
+	clock_set(mc, mc->audio_frames_played * 1000 / mc->audio_rate, SDL_GetTicks());
 	return STS_STREAM_CONTINUE;
 }
 #endif
@@ -300,7 +339,6 @@ struct movie_context *_movie_load(struct movie_context *mc, AVFormatContext *vid
 		goto error;
 	}
 
-	mc->timer_mutex = SDL_CreateMutex();
 	mc->volume = 100;
 
 	preload_packets(mc);
@@ -454,13 +492,10 @@ void movie_free(struct movie_context *mc)
 #ifndef USE_SDL_MIXER
 	if (mc->voice >= 0)
 		mixer_sts_stream_stop(mc->voice);
-	if (mc->sts_stream.sample.data)
-		free(mc->sts_stream.sample.data);
+	if (mc->swr_ctx)
+		swr_free(&mc->swr_ctx);
 #endif
 
-	if (mc->timer_mutex)
-		SDL_DestroyMutex(mc->timer_mutex);
-
 	free_decoder(&mc->video);
 	free_decoder(&mc->audio);
 
@@ -483,14 +518,13 @@ int movie_draw(struct movie_context *mc)
 	double pts = av_q2d(mc->video.stream->time_base) * mc->video.frame->best_effort_timestamp + mc->video_rewind_time;
 
 	// Get current time (and update stream time if no audio stream)
-	SDL_LockMutex(mc->timer_mutex);
-	unsigned now_ms = SDL_GetTicks();
-	double now = mc->stream_time + (now_ms - mc->wall_time_ms) / 1000.0;
+	uint32_t stream_ms, wall_ms;
+	clock_get(mc, &stream_ms, &wall_ms);
+	uint32_t now_ms = SDL_GetTicks();
+	double now = (stream_ms + (now_ms - wall_ms)) / 1000.0;
 	if (!mc->audio.stream) {
-		mc->stream_time = now;
-		mc->wall_time_ms = now_ms;
+		clock_set(mc, stream_ms + (now_ms - wall_ms), now_ms);
 	}
-	SDL_UnlockMutex(mc->timer_mutex);
 
 	// If timestamp is in the future, save frame and return.
 	if (pts > now) {
@@ -554,39 +588,27 @@ bool movie_is_end(struct movie_context *mc)
 bool movie_play(struct movie_context *mc)
 {
 	// Start the audio stream.
-	mc->stream_time = 0.0;
-	mc->wall_time_ms = SDL_GetTicks();
+	clock_set(mc, 0, SDL_GetTicks());
 
 #ifndef USE_SDL_MIXER
 	if (mc->audio.stream) {
-		mc->sts_stream.userdata = mc;
-		mc->sts_stream.callback = audio_callback;
-		mc->sts_stream.sample.frequency = mc->audio.ctx->sample_rate;
-		switch (mc->audio.ctx->sample_fmt) {
-		case AV_SAMPLE_FMT_S16:
-			mc->sts_stream.sample.audio_format = STS_MIXER_SAMPLE_FORMAT_16;
-			mc->bytes_per_sample = 2;
-			mc->interleaved = true;
-			break;
-		case AV_SAMPLE_FMT_S16P:
-			mc->sts_stream.sample.audio_format = STS_MIXER_SAMPLE_FORMAT_16;
-			mc->bytes_per_sample = 2;
-			mc->interleaved = false;
-			break;
-		case AV_SAMPLE_FMT_S32P:
-			mc->sts_stream.sample.audio_format = STS_MIXER_SAMPLE_FORMAT_32;
-			mc->bytes_per_sample = 4;
-			mc->interleaved = false;
-			break;
-		case AV_SAMPLE_FMT_FLTP:
-			mc->sts_stream.sample.audio_format = STS_MIXER_SAMPLE_FORMAT_FLOAT;
-			mc->bytes_per_sample = 4;
-			mc->interleaved = false;
-			break;
-		default:
+		// convert to stereo float at the mixer rate
+		AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+		mc->audio_rate = mixer_get_frequency();
+		if (swr_alloc_set_opts2(&mc->swr_ctx, &stereo, AV_SAMPLE_FMT_FLT, mc->audio_rate,
+					&mc->audio.ctx->ch_layout, mc->audio.ctx->sample_fmt,
+					mc->audio.ctx->sample_rate, 0, NULL) < 0
+				|| swr_init(mc->swr_ctx) < 0) {
 			WARNING("Unsupported audio format %d", mc->audio.ctx->sample_fmt);
 			return false;
 		}
+
+		mc->sts_stream.userdata = mc;
+		mc->sts_stream.callback = audio_callback;
+		mc->sts_stream.sample.frequency = mc->audio_rate;
+		mc->sts_stream.sample.audio_format = STS_MIXER_SAMPLE_FORMAT_FLOAT;
+		mc->sts_stream.sample.length = 0;
+		mc->sts_stream.sample.data = mc->audio_buf;
 		mc->voice = mixer_sts_stream_play(&mc->sts_stream, mc->volume);
 	}
 #endif
@@ -603,10 +625,9 @@ bool movie_play(struct movie_context *mc)
 
 int movie_get_position(struct movie_context *mc)
 {
-	SDL_LockMutex(mc->timer_mutex);
-	int ms = mc->wall_time_ms ? mc->stream_time * 1000 + SDL_GetTicks() - mc->wall_time_ms : 0;
-	SDL_UnlockMutex(mc->timer_mutex);
-	return ms;
+	uint32_t stream_ms, wall_ms;
+	clock_get(mc, &stream_ms, &wall_ms);
+	return wall_ms ? stream_ms + SDL_GetTicks() - wall_ms : 0;
 }
 
 bool movie_set_volume(struct movie_context *mc, int volume)
@@ -0,0 +1,124 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "nulib.h"
+
+#include "gfx.h"
+#include "particle.h"
+
+#define FIELDS(X) \
+	X(x) \
+	X(y) \
+	X(size) \
+	X(speed) \
+	X(frame) \
+	X(tick) \
+	X(age)
+
+/*
+ * Initialize a particle system with room for `max` particles, all inactive.
+ * Storage is allocated on first use and reused when an effect is restarted.
+ */
+void particles_init(struct particles *ps, unsigned max, unsigned surface)
+{
+	if (ps->max != max) {
+		particles_free(ps);
+		ps->max = max;
+		ps->active = xcalloc(max, sizeof(bool));
+#define ALLOC(f) ps->f = xcalloc(max, sizeof(int));
+		FIELDS(ALLOC)
+#undef ALLOC
+		ps->flags = xcalloc(max, sizeof(uint8_t));
+	} else {
+		memset(ps->active, 0, max * sizeof(bool));
+#define CLEAR(f) memset(ps->f, 0, max * sizeof(int));
+		FIELDS(CLEAR)
+#undef CLEAR
+		memset(ps->flags, 0, max * sizeof(uint8_t));
+	}
+	ps->nr_active = 0;
+	ps->surface = surface;
+	ps->damaged = (SDL_Rect){0};
+}
+
+void particles_free(struct particles *ps)
+{
+	free(ps->active);
+#define FREE(f) free(ps->f);
+	FIELDS(FREE)
+#undef FREE
+	free(ps->flags);
+	memset(ps, 0, sizeof(struct particles));
+}
+
+/*
+ * Activate the first inactive particle. Returns its index, or -1 if all
+ * particles are active. The fields of the new particle are zeroed.
+ */
+int particles_spawn(struct particles *ps)
+{
+	if (ps->nr_active >= ps->max)
+		return -1;
+	unsigned i;
+	for (i = 0; i < ps->max && ps->active[i]; i++);
+	assert(i < ps->max);
+
+	ps->active[i] = true;
+#define ZERO(f) ps->f[i] = 0;
+	FIELDS(ZERO)
+#undef ZERO
+	ps->flags[i] = 0;
+	ps->nr_active++;
+	return i;
+}
+
+void particles_kill(struct particles *ps, unsigned i)
+{
+	if (!ps->active[i])
+		return;
+	ps->active[i] = false;
+	ps->nr_active--;
+}
+
+/*
+ * Record that a region of the surface was modified during the update.
+ */
+void particles_damage(struct particles *ps, int x, int y, int w, int h)
+{
+	SDL_Rect r = { x, y, w, h };
+	SDL_UnionRect(&ps->damaged, &r, &ps->damaged);
+}
+
+/*
+ * Run `update` on each active particle and mark the region they modified
+ * as dirty.
+ */
+void particles_update(struct particles *ps, void (*update)(struct particles*, unsigned))
+{
+	for (unsigned i = 0; i < ps->max && ps->nr_active; i++) {
+		if (ps->active[i])
+			update(ps, i);
+	}
+	if (!SDL_RectEmpty(&ps->damaged)) {
+		gfx_dirty(ps->surface, ps->damaged.x, ps->damaged.y, ps->damaged.w,
+				ps->damaged.h);
+		ps->damaged = (SDL_Rect){0};
+	}
+}
@@ -248,14 +248,14 @@ static void delayed_open(struct menu_window *parent, struct menu_entry *entry,
 	for (int i = 0; i < POPUP_MAX_DELAYED; i++) {
 		struct popup_delayed_open *d = &delayed_opens[i];
 		if (!d->t) {
-			d->t = SDL_GetTicks() + ms;
+			d->t = vm_get_ticks() + ms;
 			d->menu = child;
 			d->entry = entry;
 			d->parent = parent;
 			return;
 		}
 		if (d->menu == child && d->parent == parent) {
-			d->t = SDL_GetTicks() + ms;
+			d->t = vm_get_ticks() + ms;
 			return;
 		}
 	}
@@ -267,12 +267,12 @@ static void delayed_close(struct menu_window *w, int ms)
 	for (int i = 0; i < POPUP_MAX_DELAYED; i++) {
 		struct popup_delayed_close *d = &delayed_closes[i];
 		if (!d->t) {
-			d->t = SDL_GetTicks() + ms;
+			d->t = vm_get_ticks() + ms;
 			d->window = w;
 			return;
 		}
 		if (d->window == w) {
-			d->t = SDL_GetTicks() + ms;
+			d->t = vm_get_ticks() + ms;
 			return;
 		}
 	}
@@ -835,7 +835,7 @@ void popup_menu_run(struct menu *m, int x, int y)
 	w.opened = true;
 	vm_timer_t timer = vm_timer_create();
 	while (w.opened) {
-		uint32_t ticks = SDL_GetTicks();
+		uint32_t ticks = vm_get_ticks();
 		for (int i = 0; i < POPUP_MAX_DELAYED; i++) {
 			struct popup_delayed_open *open = &delayed_opens[i];
 			if (open->t && open->t <= ticks) {
@@ -0,0 +1,348 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <SDL.h>
+
+#include "nulib.h"
+#include "nulib/file.h"
+
+#include "memory.h"
+#include "profile.h"
+
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_PRINT_TOP 20
+
+struct profile_node {
+	struct profile_node *parent;
+	struct profile_node *children;
+	struct profile_node *next;
+	enum profile_frame_type type;
+	uint32_t id;
+	uint32_t addr;
+	char *name;
+	uint64_t count;
+	// in performance counter ticks
+	uint64_t total;
+	uint64_t self;
+};
+
+struct profile_frame {
+	struct profile_node *node;
+	uint64_t start;
+	uint64_t child;
+};
+
+bool profile_enabled = false;
+uint64_t profile_expr_ops = 0;
+uint64_t profile_frames = 0;
+
+static struct profile_node *roots = NULL;
+static struct profile_frame stack[PROFILE_MAX_DEPTH];
+static unsigned depth = 0;
+// set when a MES file is loaded while the top frame isn't a MES frame
+static bool mes_pending = false;
+static char *dump_path = NULL;
+
+static char *node_name(enum profile_frame_type type, uint32_t id, uint32_t addr)
+{
+	char buf[64];
+	switch (type) {
+	case PROFILE_MES:
+		break;
+	case PROFILE_PROC:
+		snprintf(buf, sizeof(buf), "proc_%u@0x%x", id, addr);
+		return xstrdup(buf);
+	case PROFILE_STMT:
+		if (id > 0xff)
+			return xstrdup("text");
+		snprintf(buf, sizeof(buf), "stmt_%02x", id);
+		return xstrdup(buf);
+	case PROFILE_SYS:
+		snprintf(buf, sizeof(buf), "System.function[%u]", id);
+		return xstrdup(buf);
+	case PROFILE_UTIL:
+		snprintf(buf, sizeof(buf), "Util.function[%u]", id);
+		return xstrdup(buf);
+	}
+	return xstrdup("?");
+}
+
+static struct profile_node *get_node(struct profile_node *parent, enum profile_frame_type type,
+		uint32_t id, uint32_t addr, const char *mes_name)
+{
+	struct profile_node **list = parent ? &parent->children : &roots;
+	for (struct profile_node *n = *list; n; n = n->next) {
+		if (n->type != type || n->id != id || n->addr != addr)
+			continue;
+		if (type == PROFILE_MES && strcmp(n->name, mes_name))
+			continue;
+		return n;
+	}
+
+	struct profile_node *n = xcalloc(1, sizeof(struct profile_node));
+	n->parent = parent;
+	n->type = type;
+	n->id = id;
+	n->addr = addr;
+	n->name = type == PROFILE_MES ? xstrdup(mes_name) : node_name(type, id, addr);
+	n->next = *list;
+	*list = n;
+	return n;
+}
+
+static unsigned push(enum profile_frame_type type, uint32_t id, uint32_t addr,
+		const char *mes_name)
+{
+	if (depth == PROFILE_MAX_DEPTH)
+		return 0;
+	struct profile_node *parent = depth ? stack[depth-1].node : NULL;
+	struct profile_frame *f = &stack[depth++];
+	f->node = get_node(parent, type, id, addr, mes_name);
+	f->node->count++;
+	f->child = 0;
+	f->start = SDL_GetPerformanceCounter();
+	return depth;
+}
+
+static void close_frame(struct profile_frame *f, uint64_t now)
+{
+	uint64_t elapsed = now - f->start;
+	f->node->total += elapsed;
+	f->node->self += elapsed - min(elapsed, f->child);
+}
+
+/*
+ * Replace the MES frame on top of the stack if a different MES file was
+ * loaded (i.e. the script jumped to another file).
+ */
+static void switch_mes(void)
+{
+	mes_pending = false;
+	struct profile_frame *f = &stack[depth-1];
+	const char *name = mem_mes_name();
+	if (!strcmp(f->node->name, name))
+		return;
+
+	uint64_t now = SDL_GetPerformanceCounter();
+	close_frame(f, now);
+	if (depth > 1)
+		stack[depth-2].child += now - f->start;
+	f->node = get_node(f->node->parent, PROFILE_MES, 0, 0, name);
+	f->node->count++;
+	f->child = 0;
+	f->start = now;
+}
+
+unsigned _profile_push(enum profile_frame_type type, uint32_t id, uint32_t addr)
+{
+	return push(type, id, addr, NULL);
+}
+
+unsigned _profile_push_mes(const char *name)
+{
+	mes_pending = false;
+	return push(PROFILE_MES, 0, 0, name);
+}
+
+void _profile_pop(unsigned token)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+	while (depth >= token && depth > 0) {
+		struct profile_frame *f = &stack[--depth];
+		close_frame(f, now);
+		if (depth)
+			stack[depth-1].child += now - f->start;
+	}
+	if (mes_pending && depth && stack[depth-1].node->type == PROFILE_MES)
+		switch_mes();
+}
+
+void profile_mes_loaded(void)
+{
+	mes_pending = true;
+	if (depth && stack[depth-1].node->type == PROFILE_MES)
+		switch_mes();
+}
+
+void profile_start(void)
+{
+	if (profile_enabled)
+		return;
+	profile_enabled = true;
+	if (!depth)
+		push(PROFILE_MES, 0, 0, mem_mes_name());
+}
+
+void profile_stop(void)
+{
+	profile_enabled = false;
+}
+
+static void free_nodes(struct profile_node *n)
+{
+	while (n) {
+		struct profile_node *next = n->next;
+		free_nodes(n->children);
+		free(n->name);
+		free(n);
+		n = next;
+	}
+}
+
+/*
+ * Discard the collected data. Frames that are still open (the reset may
+ * happen in the middle of a statement) are re-entered in the new tree so
+ * that their pending pops stay balanced.
+ */
+void profile_reset(void)
+{
+	struct profile_node *old = roots;
+	uint64_t now = SDL_GetPerformanceCounter();
+	roots = NULL;
+	for (unsigned i = 0; i < depth; i++) {
+		struct profile_frame *f = &stack[i];
+		struct profile_node *parent = i ? stack[i-1].node : NULL;
+		f->node = get_node(parent, f->node->type, f->node->id, f->node->addr,
+				f->node->name);
+		f->node->count = 1;
+		f->child = 0;
+		f->start = now;
+	}
+	free_nodes(old);
+	profile_expr_ops = 0;
+	profile_frames = 0;
+	if (profile_enabled && !depth)
+		push(PROFILE_MES, 0, 0, mem_mes_name());
+}
+
+static uint64_t ticks_to_us(uint64_t ticks)
+{
+	// split to avoid overflowing ticks * 1000000
+	uint64_t freq = SDL_GetPerformanceFrequency();
+	return (ticks / freq) * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
+static void dump_node(FILE *f, struct profile_node *n, char *path, size_t len, size_t cap)
+{
+	for (; n; n = n->next) {
+		size_t name_len = strlen(n->name);
+		if (len + name_len + 2 >= cap)
+			continue;
+		size_t n_len = len;
+		if (len)
+			path[n_len++] = ';';
+		memcpy(path + n_len, n->name, name_len);
+		n_len += name_len;
+		path[n_len] = '\0';
+
+		uint64_t self_us = ticks_to_us(n->self);
+		if (self_us)
+			fprintf(f, "%s %llu\n", path, (unsigned long long)self_us);
+		dump_node(f, n->children, path, n_len, cap);
+	}
+}
+
+/*
+ * Write the profile as folded stacks, weighted by self time in microseconds.
+ */
+bool profile_dump(const char *path)
+{
+	FILE *f = file_open_utf8(path, "wb");
+	if (!f) {
+		WARNING("Failed to open \"%s\": %s", path, strerror(errno));
+		return false;
+	}
+	char buf[4096];
+	buf[0] = '\0';
+	dump_node(f, roots, buf, 0, sizeof(buf));
+	if (fclose(f)) {
+		WARNING("fclose: %s", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static void dump_at_exit(void)
+{
+	// account for frames that are still open (e.g. exiting from a System call)
+	uint64_t now = SDL_GetPerformanceCounter();
+	while (depth > 0) {
+		struct profile_frame *f = &stack[--depth];
+		close_frame(f, now);
+		if (depth)
+			stack[depth-1].child += now - f->start;
+	}
+	if (profile_dump(dump_path))
+		NOTICE("Wrote profile to \"%s\"", dump_path);
+}
+
+void profile_dump_on_exit(const char *path)
+{
+	if (!dump_path)
+		atexit(dump_at_exit);
+	free(dump_path);
+	dump_path = xstrdup(path);
+}
+
+static unsigned collect_nodes(struct profile_node *n, struct profile_node **out, unsigned i)
+{
+	for (; n; n = n->next) {
+		if (out)
+			out[i] = n;
+		i = collect_nodes(n->children, out, i + 1);
+	}
+	return i;
+}
+
+static int node_self_cmp(const void *_a, const void *_b)
+{
+	const struct profile_node *a = *(const struct profile_node**)_a;
+	const struct profile_node *b = *(const struct profile_node**)_b;
+	if (a->self == b->self)
+		return 0;
+	return a->self < b->self ? 1 : -1;
+}
+
+/*
+ * Print the hottest frames (by self time).
+ */
+void profile_print(void)
+{
+	unsigned nr_nodes = collect_nodes(roots, NULL, 0);
+	struct profile_node **nodes = xcalloc(nr_nodes, sizeof(struct profile_node*));
+	collect_nodes(roots, nodes, 0);
+	qsort(nodes, nr_nodes, sizeof(struct profile_node*), node_self_cmp);
+
+	printf("%-32s %10s %12s %12s\n", "frame", "calls", "total (ms)", "self (ms)");
+	for (unsigned i = 0; i < min(nr_nodes, PROFILE_PRINT_TOP); i++) {
+		struct profile_node *n = nodes[i];
+		char name[33];
+		if (n->parent)
+			snprintf(name, sizeof(name), "%s<%s", n->name, n->parent->name);
+		else
+			snprintf(name, sizeof(name), "%s", n->name);
+		printf("%-32s %10llu %12.2f %12.2f\n", name, (unsigned long long)n->count,
+				ticks_to_us(n->total) / 1000.0, ticks_to_us(n->self) / 1000.0);
+	}
+	printf("expression ops: %llu", (unsigned long long)profile_expr_ops);
+	if (profile_frames)
+		printf(" (%llu per frame)", (unsigned long long)(profile_expr_ops / profile_frames));
+	printf("\nframes presented: %llu\n", (unsigned long long)profile_frames);
+	free(nodes);
+}
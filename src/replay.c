@@ -0,0 +1,497 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <SDL.h>
+
+#include "nulib.h"
+#include "nulib/file.h"
+
+#include "gfx_private.h"
+#include "replay.h"
+#include "vm.h"
+
+/*
+ * File format:
+ *
+ *   "AI5R" version:u8 seed:varint
+ *   record*
+ *
+ * where each record is:
+ *
+ *   poll_delta:varint tick_delta:varint kind:u8 payload
+ *
+ * Audio records are written after the input events of the same poll; their
+ * position within the poll is given by the number of audio queries made
+ * since the poll began.
+ *
+ * Signed values are zigzag-encoded varints.
+ */
+
+#define REPLAY_MAGIC "AI5R"
+#define REPLAY_VERSION 2
+#define REPLAY_MAX_AUDIO_KEYS 16
+
+enum replay_kind {
+	REPLAY_KEY_DOWN,      // sym
+	REPLAY_KEY_UP,        // sym
+	REPLAY_BUTTON_DOWN,   // button:u8 x y
+	REPLAY_BUTTON_UP,     // button:u8 x y
+	REPLAY_MOTION,        // x y
+	REPLAY_WHEEL,         // y
+	REPLAY_AUDIO,         // query:varint key:u8 state:u8
+	REPLAY_END,
+};
+
+struct replay_record {
+	uint32_t poll;
+	uint32_t tick;
+	enum replay_kind kind;
+	int32_t sym;
+	uint8_t button;
+	int32_t x, y;
+	uint32_t query;
+	uint8_t key;
+	bool state;
+};
+
+enum replay_mode replay_mode = REPLAY_OFF;
+
+static FILE *replay_file = NULL;
+static char *replay_path = NULL;
+
+// number of event polls so far
+static uint32_t poll_no = 0;
+// virtual clock
+static uint32_t replay_ticks = 0;
+
+// poll/tick of the last record (for delta coding)
+static uint32_t last_poll = 0;
+static uint32_t last_tick = 0;
+
+// mouse position as of the last delivered event
+static int mouse_x = 0;
+static int mouse_y = 0;
+
+// result last returned by each audio query
+static bool audio_state[REPLAY_MAX_AUDIO_KEYS];
+// number of audio queries since the start of the current poll
+static uint32_t audio_query_no = 0;
+
+// next record to deliver (playback)
+static struct replay_record next;
+static bool desync_warned = false;
+static uint64_t play_start;
+
+static void put_varint(uint32_t v)
+{
+	while (v >= 0x80) {
+		fputc((v & 0x7f) | 0x80, replay_file);
+		v >>= 7;
+	}
+	fputc(v, replay_file);
+}
+
+static void put_svarint(int32_t v)
+{
+	put_varint(((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+static bool get_varint(uint32_t *out)
+{
+	uint32_t v = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		int c = fgetc(replay_file);
+		if (c == EOF)
+			return false;
+		v |= (uint32_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*out = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool get_svarint(int32_t *out)
+{
+	uint32_t v;
+	if (!get_varint(&v))
+		return false;
+	*out = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+	return true;
+}
+
+static void write_record(struct replay_record *r)
+{
+	put_varint(poll_no - last_poll);
+	put_varint(replay_ticks - last_tick);
+	fputc(r->kind, replay_file);
+	last_poll = poll_no;
+	last_tick = replay_ticks;
+
+	switch (r->kind) {
+	case REPLAY_KEY_DOWN:
+	case REPLAY_KEY_UP:
+		put_varint(r->sym);
+		break;
+	case REPLAY_BUTTON_DOWN:
+	case REPLAY_BUTTON_UP:
+		fputc(r->button, replay_file);
+		put_svarint(r->x);
+		put_svarint(r->y);
+		break;
+	case REPLAY_MOTION:
+		put_svarint(r->x);
+		put_svarint(r->y);
+		break;
+	case REPLAY_WHEEL:
+		put_svarint(r->y);
+		break;
+	case REPLAY_AUDIO:
+		put_varint(r->query);
+		fputc(r->key, replay_file);
+		fputc(r->state, replay_file);
+		break;
+	case REPLAY_END:
+		break;
+	}
+}
+
+static bool read_record(struct replay_record *r)
+{
+	uint32_t poll_delta, tick_delta, sym;
+	int kind;
+	if (!get_varint(&poll_delta) || !get_varint(&tick_delta))
+		return false;
+	if ((kind = fgetc(replay_file)) == EOF)
+		return false;
+	last_poll += poll_delta;
+	last_tick += tick_delta;
+	r->poll = last_poll;
+	r->tick = last_tick;
+	r->kind = kind;
+
+	switch (r->kind) {
+	case REPLAY_KEY_DOWN:
+	case REPLAY_KEY_UP:
+		if (!get_varint(&sym))
+			return false;
+		r->sym = sym;
+		return true;
+	case REPLAY_BUTTON_DOWN:
+	case REPLAY_BUTTON_UP: {
+		int button = fgetc(replay_file);
+		if (button == EOF)
+			return false;
+		r->button = button;
+		return get_svarint(&r->x) && get_svarint(&r->y);
+	}
+	case REPLAY_MOTION:
+		return get_svarint(&r->x) && get_svarint(&r->y);
+	case REPLAY_WHEEL:
+		return get_svarint(&r->y);
+	case REPLAY_AUDIO: {
+		int key, state;
+		if (!get_varint(&r->query) || (key = fgetc(replay_file)) == EOF
+				|| (state = fgetc(replay_file)) == EOF)
+			return false;
+		r->key = key;
+		r->state = state;
+		return key < REPLAY_MAX_AUDIO_KEYS;
+	}
+	case REPLAY_END:
+		return true;
+	}
+	return false;
+}
+
+static void replay_next_record(void)
+{
+	if (!read_record(&next)) {
+		WARNING("Replay file \"%s\" is truncated", replay_path);
+		next.kind = REPLAY_END;
+		next.poll = poll_no;
+	}
+}
+
+static void record_fini(void)
+{
+	struct replay_record r = { .kind = REPLAY_END };
+	write_record(&r);
+	if (fclose(replay_file))
+		WARNING("fclose: %s", strerror(errno));
+	NOTICE("Recorded %u event polls to \"%s\"", poll_no, replay_path);
+}
+
+void replay_init(const char *record_path, const char *play_path)
+{
+	uint32_t seed = time(NULL);
+	if (record_path) {
+		if (!(replay_file = file_open_utf8(record_path, "wb")))
+			ERROR("Failed to open \"%s\": %s", record_path, strerror(errno));
+		replay_path = xstrdup(record_path);
+		replay_mode = REPLAY_RECORD;
+		fwrite(REPLAY_MAGIC, 4, 1, replay_file);
+		fputc(REPLAY_VERSION, replay_file);
+		put_varint(seed);
+		atexit(record_fini);
+	} else if (play_path) {
+		if (!(replay_file = file_open_utf8(play_path, "rb")))
+			ERROR("Failed to open \"%s\": %s", play_path, strerror(errno));
+		replay_path = xstrdup(play_path);
+		replay_mode = REPLAY_PLAY;
+		char magic[4];
+		if (fread(magic, 4, 1, replay_file) != 1 || memcmp(magic, REPLAY_MAGIC, 4))
+			ERROR("\"%s\" is not a replay file", play_path);
+		if (fgetc(replay_file) != REPLAY_VERSION)
+			ERROR("Unsupported replay file version");
+		if (!get_varint(&seed))
+			ERROR("Replay file \"%s\" is truncated", play_path);
+		replay_next_record();
+		play_start = SDL_GetPerformanceCounter();
+	}
+	srand(seed);
+}
+
+void replay_begin_poll(void)
+{
+	if (!replay_active())
+		return;
+	poll_no++;
+	audio_query_no = 0;
+	if (replay_mode != REPLAY_PLAY)
+		return;
+
+	// audio records which weren't consumed in their poll
+	while (next.kind == REPLAY_AUDIO && next.poll < poll_no) {
+		if (!desync_warned) {
+			WARNING("Replay desynchronized at poll %u (unused audio record)", poll_no);
+			desync_warned = true;
+		}
+		audio_state[next.key] = next.state;
+		replay_next_record();
+	}
+	if (next.kind != REPLAY_END || next.poll > poll_no)
+		return;
+
+	uint64_t us = (SDL_GetPerformanceCounter() - play_start) * 1000000
+		/ SDL_GetPerformanceFrequency();
+	NOTICE("Replay finished: %u event polls, %u virtual ms, %u.%03u ms real time",
+			poll_no, replay_ticks, (unsigned)(us / 1000), (unsigned)(us % 1000));
+	sys_exit(0);
+}
+
+static bool is_input_event(SDL_Event *e)
+{
+	switch (e->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+	case SDL_MOUSEMOTION:
+	case SDL_MOUSEWHEEL:
+	case SDL_CONTROLLERBUTTONDOWN:
+	case SDL_CONTROLLERBUTTONUP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static uint32_t event_window(SDL_Event *e)
+{
+	switch (e->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		return e->key.windowID;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		return e->button.windowID;
+	case SDL_MOUSEMOTION:
+		return e->motion.windowID;
+	case SDL_MOUSEWHEEL:
+		return e->wheel.windowID;
+	default:
+		return gfx.window_id;
+	}
+}
+
+/*
+ * Filter an event received from SDL. When recording, input events are
+ * written to the replay file. During playback, live input is discarded
+ * (returns true).
+ */
+bool replay_filter_event(SDL_Event *e)
+{
+	if (likely(!replay_active()) || !is_input_event(e))
+		return false;
+	if (replay_mode == REPLAY_PLAY)
+		return true;
+
+	// input for other windows is passed through unrecorded
+	if (event_window(e) != gfx.window_id)
+		return false;
+
+	struct replay_record r = {0};
+	switch (e->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		// key repeat isn't recorded, so it's dropped while recording too
+		if (e->key.repeat)
+			return true;
+		r.kind = e->type == SDL_KEYDOWN ? REPLAY_KEY_DOWN : REPLAY_KEY_UP;
+		r.sym = e->key.keysym.sym;
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		r.kind = e->type == SDL_MOUSEBUTTONDOWN ? REPLAY_BUTTON_DOWN : REPLAY_BUTTON_UP;
+		r.button = e->button.button;
+		r.x = mouse_x = e->button.x;
+		r.y = mouse_y = e->button.y;
+		break;
+	case SDL_MOUSEMOTION:
+		r.kind = REPLAY_MOTION;
+		r.x = mouse_x = e->motion.x;
+		r.y = mouse_y = e->motion.y;
+		break;
+	case SDL_MOUSEWHEEL:
+		r.kind = REPLAY_WHEEL;
+		r.y = e->wheel.y;
+		break;
+	default:
+		// controller input is not recorded
+		return true;
+	}
+	write_record(&r);
+	return false;
+}
+
+/*
+ * Get the next recorded event to be delivered during the current poll.
+ */
+bool replay_next_event(SDL_Event *e)
+{
+	if (likely(replay_mode != REPLAY_PLAY) || next.kind == REPLAY_END
+			|| next.kind == REPLAY_AUDIO || next.poll != poll_no)
+		return false;
+	if (next.tick != replay_ticks && !desync_warned) {
+		WARNING("Replay desynchronized at poll %u (tick %u, expected %u)",
+				poll_no, replay_ticks, next.tick);
+		desync_warned = true;
+	}
+
+	memset(e, 0, sizeof(SDL_Event));
+	switch (next.kind) {
+	case REPLAY_KEY_DOWN:
+	case REPLAY_KEY_UP:
+		e->type = next.kind == REPLAY_KEY_DOWN ? SDL_KEYDOWN : SDL_KEYUP;
+		e->key.windowID = gfx.window_id;
+		e->key.state = next.kind == REPLAY_KEY_DOWN ? SDL_PRESSED : SDL_RELEASED;
+		e->key.keysym.sym = next.sym;
+		break;
+	case REPLAY_BUTTON_DOWN:
+	case REPLAY_BUTTON_UP:
+		e->type = next.kind == REPLAY_BUTTON_DOWN ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+		e->button.windowID = gfx.window_id;
+		e->button.button = next.button;
+		e->button.x = mouse_x = next.x;
+		e->button.y = mouse_y = next.y;
+		break;
+	case REPLAY_MOTION:
+		e->type = SDL_MOUSEMOTION;
+		e->motion.windowID = gfx.window_id;
+		e->motion.x = mouse_x = next.x;
+		e->motion.y = mouse_y = next.y;
+		break;
+	case REPLAY_WHEEL:
+		e->type = SDL_MOUSEWHEEL;
+		e->wheel.windowID = gfx.window_id;
+		e->wheel.y = next.y;
+		break;
+	case REPLAY_AUDIO:
+	case REPLAY_END:
+		break;
+	}
+	replay_next_record();
+	return true;
+}
+
+/*
+ * Get the mouse position (in window coordinates) as of the last delivered
+ * event. Returns false if not recording/replaying.
+ */
+bool replay_get_mouse_state(int *x, int *y)
+{
+	if (likely(!replay_active()))
+		return false;
+	*x = mouse_x;
+	*y = mouse_y;
+	return true;
+}
+
+uint32_t replay_get_ticks(void)
+{
+	return replay_ticks;
+}
+
+void replay_delay(int ms)
+{
+	replay_ticks += ms;
+	// playback runs as fast as possible
+	if (replay_mode == REPLAY_RECORD && !vm_turbo())
+		SDL_Delay(ms);
+}
+
+/*
+ * Filter the result of an audio query. When recording, changes in the result
+ * are written to the replay file. During playback, the recorded result is
+ * returned instead of `state`.
+ */
+bool replay_audio_query(unsigned key, bool state)
+{
+	if (likely(!replay_active()) || key >= REPLAY_MAX_AUDIO_KEYS)
+		return state;
+
+	uint32_t query_no = audio_query_no++;
+	if (replay_mode == REPLAY_RECORD) {
+		if (state != audio_state[key]) {
+			struct replay_record r = {
+				.kind = REPLAY_AUDIO,
+				.query = query_no,
+				.key = key,
+				.state = state,
+			};
+			write_record(&r);
+			audio_state[key] = state;
+		}
+		return state;
+	}
+
+	if (next.kind == REPLAY_AUDIO && next.poll == poll_no && next.query == query_no) {
+		if (next.key != key && !desync_warned) {
+			WARNING("Replay desynchronized at poll %u (audio query %u)", poll_no,
+					query_no);
+			desync_warned = true;
+		}
+		audio_state[next.key] = next.state;
+		replay_next_record();
+	}
+	return audio_state[key];
+}
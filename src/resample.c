@@ -0,0 +1,237 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nulib.h"
+
+#include "resample.h"
+
+// number of filter taps per output sample
+#define RESAMPLE_TAPS 16
+// maximum number of filter phases (interpolation factor) for the polyphase path
+#define RESAMPLE_MAX_PHASES 512
+
+/*
+ * A polyphase filter for the rate ratio up/down. Filters are shared between
+ * all resamplers with the same ratio and are never freed.
+ */
+struct resample_filter {
+	struct resample_filter *next;
+	unsigned up;
+	unsigned down;
+	float coef[];
+};
+
+struct resampler {
+	// polyphase filter (NULL = linear interpolation)
+	struct resample_filter *filter;
+	// number of input frames needed before/after the current position
+	unsigned hist;
+	unsigned ahead;
+	// polyphase position (in 1/up input frames)
+	unsigned phase;
+	// linear position (32.32 fixed point)
+	uint64_t step;
+	uint32_t frac;
+	// input buffer (stereo frames)
+	unsigned pos;
+	unsigned len;
+	unsigned cap;
+	unsigned pending;
+	float *buf;
+};
+
+static struct resample_filter *filters = NULL;
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+	while (b) {
+		unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double sinc(double x)
+{
+	if (fabs(x) < 1e-9)
+		return 1.0;
+	return sin(M_PI * x) / (M_PI * x);
+}
+
+static double blackman(double x)
+{
+	// x in [-RESAMPLE_TAPS/2, RESAMPLE_TAPS/2]
+	double t = 2.0 * M_PI * x / RESAMPLE_TAPS;
+	return 0.42 + 0.5 * cos(t) + 0.08 * cos(2.0 * t);
+}
+
+static struct resample_filter *get_filter(unsigned up, unsigned down)
+{
+	for (struct resample_filter *f = filters; f; f = f->next) {
+		if (f->up == up && f->down == down)
+			return f;
+	}
+
+	struct resample_filter *f = xmalloc(sizeof(struct resample_filter)
+			+ up * RESAMPLE_TAPS * sizeof(float));
+	f->up = up;
+	f->down = down;
+
+	// when downsampling, cut off at the output nyquist frequency
+	double cutoff = 0.95 * min(1.0, (double)up / (double)down);
+	for (unsigned p = 0; p < up; p++) {
+		float *c = f->coef + p * RESAMPLE_TAPS;
+		double sum = 0.0;
+		for (int t = 0; t < RESAMPLE_TAPS; t++) {
+			double x = (double)(t - (RESAMPLE_TAPS/2 - 1)) - (double)p / up;
+			double v = cutoff * sinc(cutoff * x) * blackman(x);
+			c[t] = v;
+			sum += v;
+		}
+		// normalize for unity gain at DC
+		for (int t = 0; t < RESAMPLE_TAPS; t++) {
+			c[t] /= sum;
+		}
+	}
+
+	f->next = filters;
+	filters = f;
+	return f;
+}
+
+struct resampler *resampler_new(unsigned in_rate, unsigned out_rate, unsigned max_out_frames)
+{
+	struct resampler *r = xcalloc(1, sizeof(struct resampler));
+	unsigned g = gcd(in_rate, out_rate);
+	unsigned up = out_rate / g;
+	unsigned down = in_rate / g;
+	if (up <= RESAMPLE_MAX_PHASES) {
+		r->filter = get_filter(up, down);
+		r->hist = RESAMPLE_TAPS/2 - 1;
+		r->ahead = RESAMPLE_TAPS/2;
+	} else {
+		r->step = ((uint64_t)in_rate << 32) / out_rate;
+		r->hist = 0;
+		r->ahead = 1;
+	}
+	r->cap = r->hist + r->ahead + 4 + (uint64_t)max_out_frames * in_rate / out_rate;
+	r->buf = xcalloc(r->cap * 2, sizeof(float));
+	resampler_reset(r);
+	return r;
+}
+
+void resampler_free(struct resampler *r)
+{
+	free(r->buf);
+	free(r);
+}
+
+void resampler_reset(struct resampler *r)
+{
+	memset(r->buf, 0, r->hist * 2 * sizeof(float));
+	r->pos = r->hist;
+	r->len = r->hist;
+	r->phase = 0;
+	r->frac = 0;
+	r->pending = 0;
+}
+
+/*
+ * Get the number of input frames which must be written to resampler_input()
+ * before calling resampler_run() for the given number of output frames.
+ */
+unsigned resampler_frames_needed(struct resampler *r, unsigned out_frames)
+{
+	unsigned last;
+	if (r->filter) {
+		last = r->pos + (r->phase + (uint64_t)(out_frames - 1) * r->filter->down)
+			/ r->filter->up;
+	} else {
+		last = r->pos + (((uint64_t)r->frac + (uint64_t)(out_frames - 1) * r->step) >> 32);
+	}
+	unsigned need = last + r->ahead + 1;
+	r->pending = need > r->len ? need - r->len : 0;
+	assert(r->len + r->pending <= r->cap);
+	return r->pending;
+}
+
+float *resampler_input(struct resampler *r)
+{
+	return r->buf + r->len * 2;
+}
+
+static void run_polyphase(struct resampler *r, float *out, unsigned out_frames)
+{
+	const struct resample_filter *f = r->filter;
+	for (unsigned i = 0; i < out_frames; i++) {
+		const float *c = f->coef + r->phase * RESAMPLE_TAPS;
+		const float *in = r->buf + (r->pos - r->hist) * 2;
+		float left = 0.f, right = 0.f;
+		for (int t = 0; t < RESAMPLE_TAPS; t++) {
+			left += c[t] * in[t*2];
+			right += c[t] * in[t*2+1];
+		}
+		out[i*2] = left;
+		out[i*2+1] = right;
+
+		r->phase += f->down;
+		if (r->phase >= f->up) {
+			r->pos += r->phase / f->up;
+			r->phase %= f->up;
+		}
+	}
+}
+
+static void run_linear(struct resampler *r, float *out, unsigned out_frames)
+{
+	for (unsigned i = 0; i < out_frames; i++) {
+		const float *in = r->buf + r->pos * 2;
+		float t = (float)r->frac * (1.f / 4294967296.f);
+		out[i*2] = in[0] + (in[2] - in[0]) * t;
+		out[i*2+1] = in[1] + (in[3] - in[1]) * t;
+
+		uint64_t next = (uint64_t)r->frac + r->step;
+		r->pos += next >> 32;
+		r->frac = next;
+	}
+}
+
+/*
+ * Produce `out_frames` stereo frames from the buffered input.
+ */
+void resampler_run(struct resampler *r, float *out, unsigned out_frames)
+{
+	r->len += r->pending;
+	r->pending = 0;
+
+	if (r->filter)
+		run_polyphase(r, out, out_frames);
+	else
+		run_linear(r, out, out_frames);
+
+	// discard input frames which are no longer needed
+	unsigned start = min(r->pos - r->hist, r->len);
+	if (start > 0) {
+		memmove(r->buf, r->buf + start * 2, (r->len - start) * 2 * sizeof(float));
+		r->len -= start;
+		r->pos -= start;
+	}
+}
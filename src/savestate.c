@@ -0,0 +1,682 @@
+/* Copyright (C) 2023 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "nulib.h"
+#include "nulib/little_endian.h"
+
+#include "anim.h"
+#include "audio.h"
+#include "backlog.h"
+#include "fade.h"
+#include "gfx_private.h"
+#include "memory.h"
+#include "savestate.h"
+#include "vm.h"
+
+// size of an uncompressed block
+#define BLOCK_SIZE (16 * 1024)
+// maximum size of a compressed block (worst case for incompressible data)
+#define BLOCK_MAX_COMPRESSED (BLOCK_SIZE + BLOCK_SIZE / 255 + 16)
+
+// memory budget for the rewind buffer (all live block data is counted)
+#define REWIND_MAX_BYTES (64 * 1024 * 1024)
+#define REWIND_MAX_STATES 256
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/*
+ * A (possibly compressed) block of state data. Blocks are reference counted
+ * so that unchanged blocks can be shared between consecutive states.
+ */
+struct savestate_block {
+	unsigned ref;
+	uint32_t size;
+	bool compressed;
+	// all zero (no data is stored)
+	bool zero;
+	uint8_t data[];
+};
+
+struct savestate_surface {
+	int w, h, pitch;
+	uint32_t format;
+};
+
+struct savestate {
+	unsigned nr_blocks;
+	struct savestate_block **blocks;
+	// layout of the image (used to detect incompatible surfaces on load)
+	size_t image_size;
+	struct savestate_surface surface[GFX_NR_SURFACES];
+	unsigned screen;
+	// BGM and voice playing when the state was taken (NULL if none), and
+	// their positions in milliseconds
+	char *bgm_name;
+	unsigned bgm_pos;
+	char *voice_name;
+	unsigned voice_pos;
+};
+
+/*
+ * A contiguous range of memory that is part of the state image.
+ */
+struct region {
+	void *data;
+	size_t size;
+};
+
+// number of regions preceding the surfaces
+#define NR_FIXED_REGIONS 7
+#define MAX_REGIONS (NR_FIXED_REGIONS + GFX_NR_SURFACES)
+
+static struct region regions[MAX_REGIONS];
+static unsigned nr_regions = 0;
+static void *anim_buf = NULL;
+static void *backlog_buf = NULL;
+
+// blocks of the most recently saved state (new blocks are compared against
+// these, so that unchanged blocks can be shared)
+static struct savestate_block **last_blocks = NULL;
+static unsigned last_nr_blocks = 0;
+static size_t last_image_size = 0;
+static struct savestate_surface last_surface[GFX_NR_SURFACES];
+
+// total size of all live blocks
+static size_t block_bytes = 0;
+
+static struct savestate *quick_state = NULL;
+static bool quick_save_pending = false;
+static bool quick_load_pending = false;
+
+// ring buffer of states taken at text waits (oldest first)
+static struct savestate *rewind_states[REWIND_MAX_STATES];
+static unsigned rewind_start = 0;
+static unsigned rewind_count = 0;
+static bool rewind_pending = false;
+// set when the newest rewind state was taken at the wait of the current statement
+static bool rewind_at_wait = false;
+// set when a rewind state was just loaded (its wait is re-entered next)
+static bool rewind_restored = false;
+
+static void add_region(void *data, size_t size)
+{
+	assert(nr_regions < MAX_REGIONS);
+	regions[nr_regions++] = (struct region) { data, size };
+}
+
+/*
+ * Build the list of memory regions which make up the state image. Surfaces
+ * are included as they currently exist; their geometry is recorded in the
+ * state so that a mismatched surface can be skipped on load.
+ */
+static size_t init_regions(struct savestate_surface *surface)
+{
+	if (!anim_buf)
+		anim_buf = xmalloc(anim_state_size());
+	// zeroed so that padding doesn't differ between states
+	if (!backlog_buf)
+		backlog_buf = xcalloc(1, backlog_state_size());
+
+	nr_regions = 0;
+	add_region(&memory, sizeof(memory));
+	add_region(&vm, sizeof(vm));
+	add_region(aiw_menu_entries, sizeof(aiw_menu_entries));
+	add_region(aiw_menu_nr_entries, sizeof(aiw_menu_nr_entries));
+	add_region(gfx.palette, sizeof(gfx.palette));
+	add_region(anim_buf, anim_state_size());
+	add_region(backlog_buf, backlog_state_size());
+	for (int i = 0; i < GFX_NR_SURFACES; i++) {
+		SDL_Surface *s = gfx.surface[i].s;
+		if (!s) {
+			surface[i] = (struct savestate_surface) {0};
+			continue;
+		}
+		surface[i].w = s->w;
+		surface[i].h = s->h;
+		surface[i].pitch = s->pitch;
+		surface[i].format = s->format->format;
+		add_region(s->pixels, (size_t)s->h * s->pitch);
+	}
+
+	size_t size = 0;
+	for (unsigned i = 0; i < nr_regions; i++) {
+		size += regions[i].size;
+	}
+	return size;
+}
+
+static unsigned region_nr_blocks(struct region *r)
+{
+	return (r->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/*
+ * LZ77 compression in the style of LZ4: a sequence of (literals, match)
+ * pairs where each pair is introduced by a token byte whose high nibble is
+ * the literal length and whose low nibble is the match length minus 4
+ * (lengths >= 15 are continued in following bytes). Matches are encoded as a
+ * 16-bit backwards offset. The final sequence contains only literals.
+ */
+
+static uint32_t lz_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint8_t *lz_put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *op_end, const uint8_t *lit,
+		size_t lit_len, size_t offset, size_t match_len)
+{
+	// worst case size of the sequence
+	if (op + 1 + lit_len + lit_len / 255 + 1 + 2 + match_len / 255 + 1 > op_end)
+		return NULL;
+
+	uint8_t *token = op++;
+	unsigned lit_nibble = min(lit_len, 15);
+	unsigned match_nibble = match_len ? min(match_len - LZ_MIN_MATCH, 15) : 0;
+	*token = (lit_nibble << 4) | match_nibble;
+	if (lit_len >= 15)
+		op = lz_put_length(op, lit_len - 15);
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+	if (!match_len)
+		return op;
+
+	le_put16(op, 0, offset);
+	op += 2;
+	if (match_len - LZ_MIN_MATCH >= 15)
+		op = lz_put_length(op, match_len - LZ_MIN_MATCH - 15);
+	return op;
+}
+
+/*
+ * Compress `n` bytes from `src` into `dst`. Returns the compressed size, or
+ * 0 if the data did not fit in `cap` bytes.
+ */
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+	uint8_t *op = dst;
+	uint8_t *op_end = dst + cap;
+	size_t ip = 0, anchor = 0;
+	size_t limit = n > 12 ? n - 12 : 0;
+
+	// NOTE: the hash table is not reset between blocks; stale entries are
+	//       rejected by the range and content checks below.
+	while (ip < limit) {
+		uint32_t v = read32(src + ip);
+		uint32_t h = lz_hash(v);
+		size_t ref = lz_table[h];
+		lz_table[h] = ip;
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(src + ref) != v) {
+			ip++;
+			continue;
+		}
+
+		size_t len = LZ_MIN_MATCH;
+		while (ip + len < n && src[ref + len] == src[ip + len])
+			len++;
+		op = lz_put_sequence(op, op_end, src + anchor, ip - anchor, ip - ref, len);
+		if (!op)
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+
+	op = lz_put_sequence(op, op_end, src + anchor, n - anchor, 0, 0);
+	if (!op)
+		return 0;
+	return op - dst;
+}
+
+static bool lz_get_length(const uint8_t **ip, const uint8_t *ip_end, size_t *len)
+{
+	uint8_t b;
+	do {
+		if (*ip >= ip_end)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+static bool lz_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t n)
+{
+	const uint8_t *ip = src;
+	const uint8_t *ip_end = src + src_size;
+	uint8_t *op = dst;
+	uint8_t *op_end = dst + n;
+
+	while (ip < ip_end) {
+		uint8_t token = *ip++;
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && !lz_get_length(&ip, ip_end, &lit_len))
+			return false;
+		if (lit_len > (size_t)(ip_end - ip) || lit_len > (size_t)(op_end - op))
+			return false;
+		memcpy(op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if (op == op_end)
+			return true;
+
+		if (ip_end - ip < 2)
+			return false;
+		size_t offset = le_get16(ip, 0);
+		ip += 2;
+		size_t match_len = token & 0xf;
+		if (match_len == 15 && !lz_get_length(&ip, ip_end, &match_len))
+			return false;
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(op - dst) || match_len > (size_t)(op_end - op))
+			return false;
+		// byte-wise copy: the match may overlap the output
+		const uint8_t *ref = op - offset;
+		for (size_t i = 0; i < match_len; i++) {
+			op[i] = ref[i];
+		}
+		op += match_len;
+	}
+	return op == op_end;
+}
+
+static struct savestate_block *block_new(const uint8_t *data, size_t size)
+{
+	static uint8_t buf[BLOCK_MAX_COMPRESSED];
+	if (!mem_nonzero_end(data, size)) {
+		struct savestate_block *b = xcalloc(1, sizeof(struct savestate_block));
+		b->ref = 1;
+		b->zero = true;
+		return b;
+	}
+
+	size_t csize = lz_compress(data, size, buf, sizeof(buf));
+	// store raw if compression didn't help
+	bool compressed = csize && csize < size;
+	if (!compressed)
+		csize = size;
+
+	struct savestate_block *b = xmalloc(sizeof(struct savestate_block) + csize);
+	b->ref = 1;
+	b->size = csize;
+	block_bytes += csize;
+	b->compressed = compressed;
+	b->zero = false;
+	memcpy(b->data, compressed ? buf : data, csize);
+	return b;
+}
+
+static void block_unref(struct savestate_block *b)
+{
+	if (--b->ref == 0) {
+		block_bytes -= b->size;
+		free(b);
+	}
+}
+
+static bool block_read(struct savestate_block *b, uint8_t *dst, size_t size)
+{
+	// avoid writing to (and thereby backing) pages that are already zero
+	if (b->zero) {
+		memset(dst, 0, mem_nonzero_end(dst, size));
+		return true;
+	}
+	if (!b->compressed) {
+		if (b->size != size)
+			return false;
+		memcpy(dst, b->data, size);
+		return true;
+	}
+	return lz_decompress(b->data, b->size, dst, size);
+}
+
+/*
+ * Check if a block holds the given data. Compressed blocks are decompressed
+ * to a temporary buffer.
+ */
+static bool block_equal(struct savestate_block *b, const uint8_t *data, size_t size)
+{
+	static uint8_t buf[BLOCK_SIZE];
+	if (b->zero)
+		return !mem_nonzero_end(data, size);
+	if (!b->compressed)
+		return b->size == size && !memcmp(b->data, data, size);
+	return lz_decompress(b->data, b->size, buf, size) && !memcmp(buf, data, size);
+}
+
+static void set_last_blocks(struct savestate *st)
+{
+	for (unsigned i = 0; i < last_nr_blocks; i++) {
+		block_unref(last_blocks[i]);
+	}
+	free(last_blocks);
+	last_blocks = xmalloc(st->nr_blocks * sizeof(struct savestate_block*));
+	last_nr_blocks = st->nr_blocks;
+	for (unsigned i = 0; i < st->nr_blocks; i++) {
+		last_blocks[i] = st->blocks[i];
+		last_blocks[i]->ref++;
+	}
+}
+
+struct savestate *savestate_save(void)
+{
+	struct savestate *st = xcalloc(1, sizeof(struct savestate));
+	st->image_size = init_regions(st->surface);
+	st->screen = gfx.screen;
+	const char *name = audio_get_playing(AUDIO_CH_BGM, &st->bgm_pos);
+	if (name)
+		st->bgm_name = xstrdup(name);
+	if ((name = audio_get_playing(AUDIO_CH_VOICE0, &st->voice_pos)))
+		st->voice_name = xstrdup(name);
+	anim_save_state(anim_buf);
+	backlog_save_state(backlog_buf);
+
+	for (unsigned i = 0; i < nr_regions; i++) {
+		st->nr_blocks += region_nr_blocks(&regions[i]);
+	}
+	st->blocks = xmalloc(st->nr_blocks * sizeof(struct savestate_block*));
+
+	// blocks can only be shared if the layout is the same as the last state
+	bool can_share = last_blocks && last_nr_blocks == st->nr_blocks
+		&& last_image_size == st->image_size
+		&& !memcmp(last_surface, st->surface, sizeof(last_surface));
+	last_image_size = st->image_size;
+	memcpy(last_surface, st->surface, sizeof(last_surface));
+
+	unsigned block_no = 0;
+	for (unsigned i = 0; i < nr_regions; i++) {
+		const uint8_t *data = regions[i].data;
+		for (size_t off = 0; off < regions[i].size; off += BLOCK_SIZE, block_no++) {
+			size_t size = min(BLOCK_SIZE, regions[i].size - off);
+			struct savestate_block *prev = can_share ? last_blocks[block_no] : NULL;
+			if (prev && block_equal(prev, data + off, size)) {
+				st->blocks[block_no] = prev;
+				prev->ref++;
+				continue;
+			}
+			st->blocks[block_no] = block_new(data + off, size);
+		}
+	}
+
+	set_last_blocks(st);
+	return st;
+}
+
+/*
+ * Decompress the blocks of a region into `dst`. If `dst` is NULL, the
+ * region's blocks are skipped.
+ */
+static void load_region(struct savestate *st, unsigned *block_no, uint8_t *dst, size_t size)
+{
+	unsigned nr_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (*block_no + nr_blocks > st->nr_blocks)
+		ERROR("Corrupt save state");
+	if (!dst) {
+		*block_no += nr_blocks;
+		return;
+	}
+	for (size_t off = 0; off < size; off += BLOCK_SIZE) {
+		size_t n = min(BLOCK_SIZE, size - off);
+		if (!block_read(st->blocks[(*block_no)++], dst + off, n))
+			ERROR("Corrupt save state");
+	}
+}
+
+void savestate_load(struct savestate *st)
+{
+	struct savestate_surface surface[GFX_NR_SURFACES];
+	init_regions(surface);
+
+	unsigned block_no = 0;
+	for (unsigned i = 0; i < NR_FIXED_REGIONS; i++) {
+		load_region(st, &block_no, regions[i].data, regions[i].size);
+	}
+
+	// surfaces are only restored if their geometry is unchanged
+	unsigned region_no = NR_FIXED_REGIONS;
+	for (int i = 0; i < GFX_NR_SURFACES; i++) {
+		uint8_t *dst = NULL;
+		if (surface[i].h) {
+			if (!memcmp(&surface[i], &st->surface[i], sizeof(surface[i])))
+				dst = regions[region_no].data;
+			region_no++;
+		}
+		if (!st->surface[i].h)
+			continue;
+		if (!dst)
+			WARNING("Surface %d changed since state was saved; not restored", i);
+		load_region(st, &block_no, dst, (size_t)st->surface[i].h * st->surface[i].pitch);
+		if (dst)
+			gfx_whole_surface_dirty(i);
+	}
+	assert(block_no == st->nr_blocks);
+
+	anim_load_state(anim_buf);
+	backlog_load_state(backlog_buf);
+	// a fade in progress would overwrite the restored palette
+	fade_cancel(false);
+	vm_update_logging();
+
+	if (st->screen < GFX_NR_SURFACES && gfx.surface[st->screen].s)
+		gfx.screen = st->screen;
+	gfx_update_palette(0, 256);
+
+	if (st->bgm_name) {
+		audio_bgm_play(st->bgm_name, true);
+		audio_seek(AUDIO_CH_BGM, st->bgm_pos);
+	} else {
+		audio_stop(AUDIO_CH_BGM);
+	}
+	if (st->voice_name) {
+		audio_voice_play(st->voice_name, 0);
+		audio_seek(AUDIO_CH_VOICE0, st->voice_pos);
+	} else {
+		audio_stop(AUDIO_CH_VOICE0);
+	}
+}
+
+void savestate_free(struct savestate *st)
+{
+	if (!st)
+		return;
+	for (unsigned i = 0; i < st->nr_blocks; i++) {
+		block_unref(st->blocks[i]);
+	}
+	free(st->blocks);
+	free(st->bgm_name);
+	free(st->voice_name);
+	free(st);
+}
+
+size_t savestate_size(struct savestate *st)
+{
+	size_t size = 0;
+	for (unsigned i = 0; i < st->nr_blocks; i++) {
+		size += st->blocks[i]->size;
+	}
+	return size;
+}
+
+void savestate_request_quick_save(void)
+{
+	quick_save_pending = true;
+}
+
+void savestate_request_quick_load(void)
+{
+	quick_load_pending = true;
+}
+
+void savestate_request_rewind(void)
+{
+	rewind_pending = true;
+}
+
+static struct savestate **rewind_newest(void)
+{
+	return &rewind_states[(rewind_start + rewind_count - 1) % REWIND_MAX_STATES];
+}
+
+static void rewind_drop_oldest(void)
+{
+	savestate_free(rewind_states[rewind_start]);
+	rewind_start = (rewind_start + 1) % REWIND_MAX_STATES;
+	rewind_count--;
+}
+
+/*
+ * Take a state inside a wait for input. The wait must be the first effect of
+ * the statement executing at the top level: the state is saved as if that
+ * statement had not started yet, so loading it re-enters the wait without
+ * running any other script.
+ */
+static struct savestate *save_at_wait(void)
+{
+	struct vm_pointer ip = vm.ip;
+	vm.ip = vm_top_level_ip();
+	struct savestate *st = savestate_save();
+	vm.ip = ip;
+	return st;
+}
+
+static void rewind_push(struct savestate *st)
+{
+	if (rewind_count == REWIND_MAX_STATES)
+		rewind_drop_oldest();
+	rewind_count++;
+	*rewind_newest() = st;
+	while (rewind_count > 1 && block_bytes > REWIND_MAX_BYTES)
+		rewind_drop_oldest();
+}
+
+/*
+ * Note that the current statement is waiting for a click, and take a rewind
+ * state (see save_at_wait). Waits which are not the first effect of their
+ * statement must not call this.
+ */
+void savestate_rewind_mark(void)
+{
+	if (vm_turbo() || !vm_is_top_level())
+		return;
+	// re-entering the wait of a state which was just rewound to
+	if (rewind_restored) {
+		rewind_restored = false;
+		rewind_at_wait = true;
+		return;
+	}
+	rewind_push(save_at_wait());
+	rewind_at_wait = true;
+}
+
+/*
+ * Service save state requests during a wait for input, which must be the
+ * first effect of its statement (see save_at_wait). A quick save is taken
+ * at the wait itself. Returns true if the wait should be abandoned so that a
+ * pending load or rewind can be carried out once the statement has finished.
+ */
+bool savestate_wait_poll(void)
+{
+	if (likely(!quick_save_pending && !quick_load_pending && !rewind_pending))
+		return false;
+	if (!vm_is_top_level())
+		return false;
+	if (quick_save_pending) {
+		savestate_free(quick_state);
+		quick_state = save_at_wait();
+		quick_save_pending = false;
+		NOTICE("Quick save: %zu KiB", savestate_size(quick_state) / 1024);
+	}
+	return (quick_load_pending && quick_state) || (rewind_pending && rewind_count);
+}
+
+static void rewind(bool at_wait)
+{
+	if (!rewind_count) {
+		NOTICE("Nothing to rewind");
+		return;
+	}
+	// if the newest state is the wait that was just abandoned, restoring it
+	// would only return to the current page
+	if (at_wait && rewind_count > 1) {
+		savestate_free(*rewind_newest());
+		rewind_count--;
+	}
+	savestate_load(*rewind_newest());
+	rewind_restored = true;
+}
+
+/*
+ * Carry out pending save/load/rewind requests. Must only be called between
+ * statements at the top level of the VM.
+ */
+void savestate_poll(void)
+{
+	if (likely(!quick_save_pending && !quick_load_pending && !rewind_pending
+				&& !rewind_at_wait && !rewind_restored))
+		return;
+	// the statement (and its wait, if any) has finished
+	bool at_wait = rewind_at_wait;
+	rewind_at_wait = false;
+	rewind_restored = false;
+	if (!quick_save_pending && !quick_load_pending && !rewind_pending)
+		return;
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	if (rewind_pending) {
+		rewind(at_wait);
+		NOTICE("Rewind (%u states, %zu KiB)", rewind_count, block_bytes / 1024);
+	} else if (quick_save_pending) {
+		savestate_free(quick_state);
+		quick_state = savestate_save();
+		NOTICE("Quick save: %zu KiB", savestate_size(quick_state) / 1024);
+	} else if (quick_state) {
+		savestate_load(quick_state);
+		NOTICE("Quick load");
+	} else {
+		NOTICE("No quick save");
+	}
+	uint64_t us = (SDL_GetPerformanceCounter() - start) * 1000000
+		/ SDL_GetPerformanceFrequency();
+	NOTICE("... took %u.%03u ms", (unsigned)(us / 1000), (unsigned)(us % 1000));
+
+	quick_save_pending = false;
+	quick_load_pending = false;
+	rewind_pending = false;
+}
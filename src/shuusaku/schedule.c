@@ -35,6 +35,19 @@
 #define COL_W 80
 #define ROW_H 32
 
+#define CELL_CAM_TYPE    0x7f
+#define CELL_CAM_EXPIRED 0x80
+
+// the state that a cell on the schedule is composed from
+struct sched_cell {
+	int t;
+	uint8_t flags;
+	uint8_t nr_heads;
+	uint8_t heads[4];
+	uint8_t cam;
+	bool pink;
+};
+
 static struct {
 	bool open;
 	uint32_t window_id;
@@ -42,8 +55,14 @@ static struct {
 	SDL_Renderer *renderer;
 	SDL_Texture *texture;
 	SDL_Surface *parts;
+	// headers and cells (cached between draws)
+	SDL_Surface *base;
+	SDL_Rect base_damaged;
+	int header_t[8];
+	struct sched_cell cells[NR_LOC][8];
+	// base layer + flashing boxes
 	SDL_Surface *display;
-	SDL_Surface *saved;
+	SDL_Rect display_damaged;
 	unsigned start_t;
 	int current_t;
 	int plan_t;
@@ -226,15 +245,72 @@ void shuusaku_schedule_set_flag(unsigned location, unsigned day, unsigned t, uin
 }
 
 /*
- * Wrapper to copy from the parts CG to the display surface.
+ * Wrapper to copy from the parts CG to the base layer.
  */
 static void blit_parts(int src_x, int src_y, int w, int h, int dst_x, int dst_y)
 {
 	SDL_Rect src_r = { src_x, src_y, w, h };
 	SDL_Rect dst_r = { dst_x, dst_y, w, h };
-	SDL_CALL(SDL_BlitSurface, schedule.parts, &src_r, schedule.display, &dst_r);
+	SDL_CALL(SDL_BlitSurface, schedule.parts, &src_r, schedule.base, &dst_r);
+}
+
+static void base_dirty(int x, int y, int w, int h)
+{
+	SDL_Rect r = { x, y, w, h };
+	SDL_UnionRect(&schedule.base_damaged, &r, &schedule.base_damaged);
+}
+
+static void display_dirty(int x, int y, int w, int h)
+{
+	SDL_Rect r = { x, y, w, h };
+	SDL_UnionRect(&schedule.display_damaged, &r, &schedule.display_damaged);
+}
+
+static bool cell_equal(struct sched_cell *a, struct sched_cell *b)
+{
+	if (a->t != b->t || a->flags != b->flags || a->nr_heads != b->nr_heads
+			|| a->cam != b->cam || a->pink != b->pink)
+		return false;
+	return !memcmp(a->heads, b->heads, a->nr_heads);
 }
 
+static void draw_cell(struct sched_cell *cell, int i, int loc)
+{
+	int x = 160 + i*COL_W;
+	int y = 24 + loc*ROW_H;
+
+	// draw cell background
+	if (cell->flags < 8) {
+		SDL_Point pos = get_bg_pos(cell->flags);
+		blit_parts(pos.x, pos.y, 80, 32, x, y);
+	}
+
+	// draw faces
+	for (int j = 0; j < cell->nr_heads; j++) {
+		SDL_Point pos = get_head_pos(cell->heads[j]);
+		blit_parts(pos.x, pos.y, 32, 32, x + 48 - j * 16, y);
+	}
+
+	// draw camera
+	if (cell->cam) {
+		blit_parts(160 + ((cell->cam & CELL_CAM_TYPE) - 1) * 80, 312, 80, 32, x, y);
+		if (cell->cam & CELL_CAM_EXPIRED)
+			blit_parts(320, 312, 80, 32, x, y);
+	}
+
+	if (cell->pink)
+		blit_parts(160, 256, 80, 32, x, y);
+
+	base_dirty(x, y, COL_W, ROW_H);
+}
+
+/*
+ * Update the schedule display. The headers and cells are composed on the base
+ * layer, which is cached: a cell is only recomposed when the state it depends
+ * on (its flags, faces, camera and pink state) changes or when the window is
+ * scrolled. The flashing boxes are drawn on top of the base layer on the
+ * display surface.
+ */
 void schedule_window_draw(void)
 {
 	if (!schedule.open)
@@ -248,79 +324,67 @@ void schedule_window_draw(void)
 	}
 
 	for (int i = 0; i < 8; i++) {
-		SDL_Point header_pos = get_header_pos(schedule.start_t + i);
+		int t = schedule.start_t + i;
+		if (schedule.header_t[i] == t)
+			continue;
+		SDL_Point header_pos = get_header_pos(t);
 		blit_parts(header_pos.x, header_pos.y, 80, 24, 160 + i*COL_W, 0);
+		base_dirty(160 + i*COL_W, 0, COL_W, 24);
+		schedule.header_t[i] = t;
 	}
 
 	for (int loc = 0; loc < NR_LOC; loc++) {
-		// draw cell background
 		unsigned flag_no = schedule_flag_no(schedule.start_t, loc);
-		for (int i = 0; i < 8; i++) {
-			uint8_t flags = mem_get_var4_packed(flag_no + i);
-			if (flags < 8) {
-				SDL_Point pos = get_bg_pos(flags);
-				blit_parts(pos.x, pos.y, 80, 32, 160 + i*COL_W, 24 + loc*ROW_H);
-			}
-		}
+		unsigned cam_type, cam_placed, cam_elapsed;
+		get_camera_info(loc, &cam_type, &cam_placed, &cam_elapsed);
+		bool pink;
+		unsigned pink_start_t;
+		get_pink_info(loc, &pink, &pink_start_t);
 
-		// draw faces
 		for (int i = 0; i < 8; i++) {
-			if (!away_events[loc])
-				continue;
-			struct sched_away_event *ev = &away_events[loc][(schedule.start_t+i)*4];
-			unsigned dst_x = 160 + i*COL_W + 48;
-			for (int j = 0; j < 4; j++, ev++) {
-				if (!ev->flag_no)
-					break;
-				if (mem_get_var4_packed(ev->flag_no) > 1) {
-					SDL_Point pos = get_head_pos(ev->character);
-					blit_parts(pos.x, pos.y, 32, 32, dst_x, 24 + loc*ROW_H);
-					dst_x -= 16;
+			unsigned cell_t = schedule.start_t + i;
+			struct sched_cell cell = {
+				.t = cell_t,
+				.flags = mem_get_var4_packed(flag_no + i),
+			};
+
+			if (away_events[loc]) {
+				struct sched_away_event *ev = &away_events[loc][cell_t*4];
+				for (int j = 0; j < 4; j++, ev++) {
+					if (!ev->flag_no)
+						break;
+					if (mem_get_var4_packed(ev->flag_no) > 1)
+						cell.heads[cell.nr_heads++] = ev->character;
 				}
 			}
-		}
 
-		// draw cameras
-		unsigned cam_type, cam_placed, cam_elapsed;
-		get_camera_info(loc, &cam_type, &cam_placed, &cam_elapsed);
-		for (int i = 0; i < 8; i++) {
-			unsigned cell_t = schedule.start_t + i;
 			if (cam_type != CAM_NONE && cam_placed <= cell_t
 					&& cam_placed + cam_elapsed >= cell_t) {
-				blit_parts(160 + (cam_type-1) * 80, 312, 80, 32,
-						160 + i*COL_W, 24 + loc*ROW_H);
 				unsigned cam_end_t = cam_placed + (cam_type == CAM_DIGI ? 4 : 8);
-				if (cell_t >= cam_end_t) {
-					blit_parts(320, 312, 80, 32, 160 + i*COL_W, 24 + loc*ROW_H);
-				}
+				cell.cam = cam_type;
+				if (cell_t >= cam_end_t)
+					cell.cam |= CELL_CAM_EXPIRED;
 			}
-		}
 
-		bool pink;
-		unsigned pink_start_t;
-		get_pink_info(loc, &pink, &pink_start_t);
-		for (int i = 0; i < 8; i++) {
-			unsigned cell_t = schedule.start_t + i;
-			if (pink && cell_t >= pink_start_t) {
-				blit_parts(160, 256, 80, 32, 160 + i*COL_W, 24 + loc*ROW_H);
-			}
-		}
-	}
+			cell.pink = pink && cell_t >= pink_start_t;
 
-	// save area behind yellow flashing box (current time)
-	int i = schedule.current_t - (int)schedule.start_t;
-	if (i >= 0 && i < 8) {
-		SDL_Rect src_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
-		SDL_Rect dst_r = { 0, 0, 80, SCHEDULE_WINDOW_H };
-		SDL_CALL(SDL_BlitSurface, schedule.display, &src_r, schedule.saved, &dst_r);
+			// cells without a background are drawn over the previous
+			// contents, so they are always redrawn
+			struct sched_cell *cached = &schedule.cells[loc][i];
+			if (cell.flags < 8 && cell_equal(&cell, cached))
+				continue;
+			draw_cell(&cell, i, loc);
+			*cached = cell;
+		}
 	}
 
-	// save area behind red flashing box (plan time)
-	i = schedule.plan_t - (int)schedule.start_t;
-	if (i >= 0 && i < 8) {
-		SDL_Rect src_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
-		SDL_Rect dst_r = { 80, 0, 80, SCHEDULE_WINDOW_H };
-		SDL_CALL(SDL_BlitSurface, schedule.display, &src_r, schedule.saved, &dst_r);
+	// copy updated part of the base layer to the display
+	SDL_Rect *r = &schedule.base_damaged;
+	if (!SDL_RectEmpty(r)) {
+		SDL_Rect dst_r = *r;
+		SDL_CALL(SDL_BlitSurface, schedule.base, r, schedule.display, &dst_r);
+		display_dirty(r->x, r->y, r->w, r->h);
+		*r = (SDL_Rect){0};
 	}
 }
 
@@ -342,12 +406,21 @@ void schedule_window_init(void)
 	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, schedule.parts, 0,
 			SCHEDULE_WINDOW_W, SCHEDULE_WINDOW_H,
 			GFX_INDEXED_BPP, GFX_INDEXED_FORMAT);
-	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, schedule.display, 0,
+	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, schedule.base, 0,
 			SCHEDULE_WINDOW_W, SCHEDULE_WINDOW_H,
 			GFX_DIRECT_BPP, GFX_DIRECT_FORMAT);
-	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, schedule.saved, 0,
-			160, SCHEDULE_WINDOW_H,
+	SDL_CTOR(SDL_CreateRGBSurfaceWithFormat, schedule.display, 0,
+			SCHEDULE_WINDOW_W, SCHEDULE_WINDOW_H,
 			GFX_DIRECT_BPP, GFX_DIRECT_FORMAT);
+	display_dirty(0, 0, SCHEDULE_WINDOW_W, SCHEDULE_WINDOW_H);
+	for (int i = 0; i < 8; i++) {
+		schedule.header_t[i] = -1;
+	}
+	for (int loc = 0; loc < NR_LOC; loc++) {
+		for (int i = 0; i < 8; i++) {
+			schedule.cells[loc][i].t = -1;
+		}
+	}
 
 	SDL_Surface *icon = icon_get(1);
 	if (icon)
@@ -384,6 +457,7 @@ void schedule_window_init(void)
 
 	// draw static part of display (room names)
 	blit_parts(0, 0, 160, SCHEDULE_WINDOW_H, 0, 0);
+	base_dirty(0, 0, 160, SCHEDULE_WINDOW_H);
 
 	shuusaku_init_away_events(away_events);
 	schedule.current_t = -1;
@@ -441,8 +515,13 @@ void schedule_window_update(void)
 		schedule_close();
 		return;
 	}
-	SDL_CALL(SDL_UpdateTexture, schedule.texture, NULL, schedule.display->pixels,
-			schedule.display->pitch);
+	SDL_Rect *r = &schedule.display_damaged;
+	if (!SDL_RectEmpty(r)) {
+		uint8_t *p = schedule.display->pixels + r->y * schedule.display->pitch
+			+ r->x * GFX_DIRECT_BPP / 8;
+		SDL_CALL(SDL_UpdateTexture, schedule.texture, r, p, schedule.display->pitch);
+		*r = (SDL_Rect){0};
+	}
 	SDL_CALL(SDL_RenderClear, schedule.renderer);
 	SDL_CALL(SDL_RenderCopy, schedule.renderer, schedule.texture, NULL, NULL);
 	SDL_RenderPresent(schedule.renderer);
@@ -465,6 +544,7 @@ static void draw_current_time_box(void)
 	SDL_Rect src_r = { 480, 0, 80, SCHEDULE_WINDOW_H };
 	SDL_Rect dst_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
 	SDL_CALL(SDL_BlitSurface, schedule.parts, &src_r, schedule.display, &dst_r);
+	display_dirty(160 + i * 80, 0, 80, SCHEDULE_WINDOW_H);
 	schedule_window_update();
 }
 
@@ -478,6 +558,7 @@ static void draw_plan_time_box(void)
 	SDL_Rect src_r = { 560, 0, 80, SCHEDULE_WINDOW_H };
 	SDL_Rect dst_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
 	SDL_CALL(SDL_BlitSurface, schedule.parts, &src_r, schedule.display, &dst_r);
+	display_dirty(160 + i * 80, 0, 80, SCHEDULE_WINDOW_H);
 	schedule_window_update();
 }
 
@@ -488,9 +569,10 @@ static void clear_current_time_box(void)
 	int i = schedule.current_t - (int)schedule.start_t;
 	if (i < 0 || i >= 8)
 		return;
-	SDL_Rect src_r = { 0, 0, 80, SCHEDULE_WINDOW_H };
-	SDL_Rect dst_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
-	SDL_CALL(SDL_BlitSurface, schedule.saved, &src_r, schedule.display, &dst_r);
+	SDL_Rect src_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
+	SDL_Rect dst_r = src_r;
+	SDL_CALL(SDL_BlitSurface, schedule.base, &src_r, schedule.display, &dst_r);
+	display_dirty(160 + i * 80, 0, 80, SCHEDULE_WINDOW_H);
 	schedule_window_update();
 }
 
@@ -501,9 +583,10 @@ static void clear_plan_time_box(void)
 	int i = schedule.plan_t - (int)schedule.start_t;
 	if (i < 0 || i >= 8)
 		return;
-	SDL_Rect src_r = { 80, 0, 80, SCHEDULE_WINDOW_H };
-	SDL_Rect dst_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
-	SDL_CALL(SDL_BlitSurface, schedule.saved, &src_r, schedule.display, &dst_r);
+	SDL_Rect src_r = { 160 + i * 80, 0, 80, SCHEDULE_WINDOW_H };
+	SDL_Rect dst_r = src_r;
+	SDL_CALL(SDL_BlitSurface, schedule.base, &src_r, schedule.display, &dst_r);
+	display_dirty(160 + i * 80, 0, 80, SCHEDULE_WINDOW_H);
 	schedule_window_update();
 }
 
@@ -553,6 +636,37 @@ static bool have_cam_event(struct sched_cam_event *ev)
 
 bool shuusaku_running_cam_event = false;
 
+/*
+ * The part of surface 0 which camera events draw over. The buffer is kept
+ * between events.
+ */
+static uint8_t *cam_saved_screen = NULL;
+
+static void cam_save_screen(SDL_Surface *screen)
+{
+	if (!cam_saved_screen)
+		cam_saved_screen = xmalloc(640 * 480);
+	if (screen->pitch == 640) {
+		memcpy(cam_saved_screen, screen->pixels, 640 * 480);
+		return;
+	}
+	for (int row = 0; row < 480; row++) {
+		memcpy(cam_saved_screen+row*640, screen->pixels+row*screen->pitch, 640);
+	}
+}
+
+static void cam_restore_screen(SDL_Surface *screen)
+{
+	if (screen->pitch == 640) {
+		memcpy(screen->pixels, cam_saved_screen, 640 * 480);
+	} else {
+		for (int row = 0; row < 480; row++) {
+			memcpy(screen->pixels+row*screen->pitch, cam_saved_screen+row*640, 640);
+		}
+	}
+	gfx_dirty(0, 0, 0, 640, 480);
+}
+
 static void run_cam_event(struct sched_cam_event *ev)
 {
 	if (shuusaku_running_cam_event)
@@ -566,10 +680,7 @@ static void run_cam_event(struct sched_cam_event *ev)
 
 	// save surface 0 pixels
 	SDL_Surface *screen = gfx_get_surface(0);
-	uint8_t *saved = xcalloc(640, 480);
-	for (int row = 0; row < 480; row++) {
-		memcpy(saved+row*640, screen->pixels+row*screen->pitch, 640);
-	}
+	cam_save_screen(screen);
 	// save palettes
 	uint8_t mem_palette[256*4];
 	memcpy(mem_palette, memory.palette, 256*4);
@@ -587,7 +698,7 @@ static void run_cam_event(struct sched_cam_event *ev)
 		// TODO: animated cursor
 		//cursor_load(2, 1, NULL);
 		shuusaku_crossfade_to(0, 0, 0);
-		gfx.surface[0].src.y = 0;
+		gfx_set_view_offset(0, 0, 0);
 
 		char name[16];
 		if (flag & 2) {
@@ -631,20 +742,17 @@ static void run_cam_event(struct sched_cam_event *ev)
 	}
 
 	shuusaku_crossfade_to(0, 0, 0);
-	gfx.surface[0].src.y = saved_screen_y;
+	gfx_set_view_offset(0, 0, saved_screen_y);
 
 	// restore palette
 	memcpy(memory.palette, mem_palette, sizeof(mem_palette));
 
-	for (int row = 0; row < 480; row++) {
-		memcpy(screen->pixels+row*screen->pitch, saved+row*640, 640);
-	}
-	free(saved);
+	cam_restore_screen(screen);
 
 	// crossfade to original palette/pixels
 	_gfx_palette_crossfade(gfx_palette, 0, 256, mem_get_sysvar16(13) * 16);
 
-	gfx.surface[0].src.y = saved_screen_y;
+	gfx_set_view_offset(0, 0, saved_screen_y);
 	game->flags[FLAG_ANIM_ENABLE] = FLAG_ALWAYS_ON;
 	shuusaku_running_cam_event = false;
 }
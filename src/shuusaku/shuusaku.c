@@ -62,8 +62,7 @@ static int screen_y(void)
 
 static void set_screen_y(int y)
 {
-	gfx.surface[0].src.y = y;
-	gfx_screen_dirty();
+	gfx_set_view_offset(0, 0, y);
 }
 
 static void shuusaku_mem_restore(void)
@@ -140,7 +139,7 @@ static void stmt_txt(void)
 }
 
 #define PARAMS(name) \
-	struct param_list name = {0}; \
+	struct param_list name; \
 	game->vm.read_params(&name);
 
 static const char *aiw_save_name(struct param_list *params)
@@ -275,19 +274,7 @@ static void stmt_wait(void)
 	PARAMS(params);
 	texthook_commit();
 	if (params.nr_params == 0 || vm_expr_param(&params, 0) == 0) {
-		while (true) {
-			if (input_down(INPUT_CTRL)) {
-				vm_peek();
-				vm_delay(config.msg_skip_delay);
-				return;
-			}
-			if (input_down(INPUT_ACTIVATE)) {
-				input_wait_until_up(INPUT_ACTIVATE);
-				return;
-			}
-			vm_peek();
-			vm_delay(16);
-		}
+		sys_wait_for_click(true);
 	} else {
 		vm_timer_t timer = vm_timer_create();
 		vm_timer_t target_t = timer + (params.params[0].val) * 10;
@@ -101,6 +101,9 @@ static void blit_unhover(struct char_select *ch)
 
 static int char_hovered;
 
+// characters whose "complete" stamp has been drawn on the enabled/hover layers
+static bool char_stamped[NR_CHAR];
+
 static int char_select_handle_input(void)
 {
 	if (input_down(INPUT_CANCEL))
@@ -144,6 +147,11 @@ unsigned shuusaku_scene_viewer_char_select(void)
 	// kanryou.gpx on surface 6
 	char_hovered = -1;
 
+	// The enabled/hover layers keep their stamps until they are reloaded,
+	// so they only need to be drawn on the screen.
+	if (gfx_take_written(CS_ENABLED, NULL) | gfx_take_written(CS_HOVER, NULL))
+		memset(char_stamped, 0, sizeof(char_stamped));
+
 	for (int i = 0; i < NR_CHAR; i++) {
 		SDL_Rect *r = &characters[i].pos;
 		characters[i].enabled = mem_get_var4_packed(characters[i].enabled_flag) == 9;
@@ -153,10 +161,17 @@ unsigned shuusaku_scene_viewer_char_select(void)
 		if (mem_get_var4_packed(10 + i)) {
 			int x = (i == CHAR_ERI) ? 151 : 0;
 			gfx_copy_masked(x, 0, 151, 206, 6, r->x+1, r->y+1, SCREEN, MASK_COLOR);
-			gfx_copy_masked(x, 0, 151, 206, 6, r->x+1, r->y+1, CS_ENABLED, MASK_COLOR);
-			gfx_copy_masked(x, 0, 151, 206, 6, r->x+1, r->y+1, CS_HOVER, MASK_COLOR);
+			if (!char_stamped[i]) {
+				gfx_copy_masked(x, 0, 151, 206, 6, r->x+1, r->y+1, CS_ENABLED,
+						MASK_COLOR);
+				gfx_copy_masked(x, 0, 151, 206, 6, r->x+1, r->y+1, CS_HOVER,
+						MASK_COLOR);
+				char_stamped[i] = true;
+			}
 		}
 	}
+	gfx_take_written(CS_ENABLED, NULL);
+	gfx_take_written(CS_HOVER, NULL);
 
 	shuusaku_crossfade(memory.palette, false);
 
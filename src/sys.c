@@ -33,6 +33,7 @@
 #include "input.h"
 #include "menu.h"
 #include "savedata.h"
+#include "savestate.h"
 #include "sys.h"
 #include "texthook.h"
 #include "vm_private.h"
@@ -379,23 +380,38 @@ void sys_graphics_copy_progressive(struct param_list *params)
 	gfx_copy_progressive(src_x, src_y, src_w, src_h, src_i, dst_x, dst_y, dst_i);
 }
 
+/*
+ * Wait for a click (or skip while CTRL is held). If `rewind_point` is true,
+ * the wait is the first effect of the current statement, and save states
+ * may be taken/restored at it.
+ */
+void sys_wait_for_click(bool rewind_point)
+{
+	if (rewind_point)
+		savestate_rewind_mark();
+	while (true) {
+		// abandon the wait; the load is carried out after this statement
+		if (rewind_point && savestate_wait_poll())
+			return;
+		if (input_down(INPUT_CTRL)) {
+			vm_peek();
+			vm_delay(config.msg_skip_delay);
+			return;
+		}
+		if (input_down(INPUT_ACTIVATE)) {
+			input_wait_until_up(INPUT_ACTIVATE);
+			return;
+		}
+		vm_peek();
+		vm_delay(16);
+	}
+}
+
 void sys_wait(struct param_list *params)
 {
 	texthook_commit();
 	if (params->nr_params == 0 || vm_expr_param(params, 0) == 0) {
-		while (true) {
-			if (input_down(INPUT_CTRL)) {
-				vm_peek();
-				vm_delay(config.msg_skip_delay);
-				return;
-			}
-			if (input_down(INPUT_ACTIVATE)) {
-				input_wait_until_up(INPUT_ACTIVATE);
-				return;
-			}
-			vm_peek();
-			vm_delay(16);
-		}
+		sys_wait_for_click(true);
 	} else {
 		vm_timer_t timer = vm_timer_create();
 		vm_timer_t target_t = timer + (params->params[0].val / 4) * 15;
@@ -35,11 +35,14 @@
 #include "backlog.h"
 #include "char.h"
 #include "debug.h"
+#include "fade.h"
 #include "game.h"
 #include "gfx.h"
 #include "input.h"
 #include "memory.h"
 #include "menu.h"
+#include "profile.h"
+#include "savestate.h"
 #include "texthook.h"
 #include "vm_private.h"
 
@@ -81,7 +84,7 @@ void vm_init(void)
 	vm.ip.code = memory.file_data;
 }
 
-#define LOGGING (vm_flag_is_on(FLAG_LOG) && vm_flag_is_on(FLAG_LOG_ENABLE))
+#define LOGGING (vm.logging)
 
 static uint8_t vm_read_byte(void)
 {
@@ -134,10 +137,16 @@ static uint32_t vm_stack_pop(void)
 	return vm.stack[--vm.stack_ptr];
 }
 
+// incremented on every file load to invalidate cached compiled expressions
+// (0 = never valid)
+static uint32_t vm_code_gen = 1;
+
 void vm_load_file(struct archive_data *file, uint32_t offset)
 {
+	vm_code_gen++;
 	dbg_invalidate(offsetof(struct memory, file_data) + offset, file->size);
 	memcpy(memory.file_data + offset, file->data, file->size);
+	mem_update_high_water(MEMORY_REGION_FILE_DATA, offset + file->size);
 	dbg_load_file(file->name, offsetof(struct memory, file_data) + offset, file->size);
 }
 
@@ -157,7 +166,7 @@ end:
 	archive_data_release(data);
 }
 
-void vm_load_mes(char *name)
+void vm_load_mes(const char *name)
 {
 	char *mem_name = mem_mes_name();
 	if (name != mem_name)
@@ -170,6 +179,8 @@ void vm_load_mes(char *name)
 		VM_ERROR("Failed to load MES file \"%s\"", name);
 	vm_load_file(file, 0);
 	archive_data_release(file);
+	if (unlikely(profile_enabled))
+		profile_mes_loaded();
 }
 
 void vm_expr_var16(void)
@@ -343,10 +354,331 @@ static uint32_t vm_expr_end(void)
 	return r;
 }
 
+/*
+ * Expression compiler.
+ *
+ * Expressions built only from constants, variable reads and arithmetic (as
+ * identified by their handlers in game->expr_op) are compiled the first
+ * time they are evaluated into a short postfix program. Constant
+ * subexpressions are folded and variable reads with a constant index are
+ * resolved at compile time. Programs of the shapes `x` and `x op imm` are
+ * evaluated directly; others run on a small local stack (the depth is
+ * checked at compile time), never touching vm.stack. The AIW encoding
+ * (immediates below 0x80, var32 reads in 0x80-0x9f) is compiled the same way.
+ *
+ * Compiled expressions are cached by address and keep a copy of their
+ * source bytes; an entry is only used while those bytes are unchanged, so
+ * scripts writing into file_data fall back to the interpreter. The cache is
+ * invalidated on every file load, and bypassed while logging since the
+ * backlog records the raw bytes of each expression as it is read.
+ */
+#define VM_CEXPR_CACHE_SIZE 2048
+#define VM_CEXPR_MAX_BYTES 48
+#define VM_CEXPR_MAX_INSNS 24
+#define VM_CEXPR_MAX_DEPTH 16
+
+enum vm_cexpr_opcode {
+	// push
+	CX_IMM,
+	CX_VAR4,
+	CX_VAR4_PACKED,
+	CX_VAR16,
+	CX_SYSVAR16,
+	CX_VAR32,
+	// replace top of stack
+	CX_VAR4_X,
+	CX_VAR4_PACKED_X,
+	CX_VAR16_X,
+	CX_SYSVAR16_X,
+	// binary operators
+	CX_ADD,
+	CX_SUB,
+	CX_SUB_UNSIGNED,
+	CX_MUL,
+	CX_DIV,
+	CX_MOD,
+	CX_AND,
+	CX_OR,
+	CX_BITAND,
+	CX_BITIOR,
+	CX_BITXOR,
+	CX_LT,
+	CX_GT,
+	CX_LTE,
+	CX_GTE,
+	CX_EQ,
+	CX_NEQ,
+};
+
+#define CX_IS_LOAD(op) ((op) <= CX_VAR32)
+#define CX_IS_INDEXED(op) ((op) >= CX_VAR4_X && (op) <= CX_SYSVAR16_X)
+#define CX_IS_BINOP(op) ((op) >= CX_ADD)
+
+struct vm_cexpr_insn {
+	uint8_t op;
+	uint32_t arg;
+};
+
+struct vm_cexpr {
+	uint32_t gen;
+	uint32_t ptr;
+	// false if the expression could not be compiled
+	bool ok;
+	uint8_t len;
+	uint8_t nr_insns;
+	uint8_t raw[VM_CEXPR_MAX_BYTES];
+	struct vm_cexpr_insn insns[VM_CEXPR_MAX_INSNS];
+};
+
+static struct vm_cexpr vm_cexpr_cache[VM_CEXPR_CACHE_SIZE];
+
+static inline uint32_t cx_load(uint8_t op, uint32_t i)
+{
+	switch (op) {
+	case CX_VAR4:
+	case CX_VAR4_X:
+		return mem_get_var4(i);
+	case CX_VAR4_PACKED:
+	case CX_VAR4_PACKED_X:
+		return mem_get_var4_packed(i);
+	case CX_VAR16:
+	case CX_VAR16_X:
+		return mem_get_var16(i);
+	case CX_SYSVAR16:
+	case CX_SYSVAR16_X:
+		return mem_get_sysvar16(i);
+	case CX_VAR32:
+		return mem_get_var32(i);
+	}
+	return i;
+}
+
+static inline uint32_t cx_binop(uint8_t op, uint32_t a, uint32_t b)
+{
+	switch (op) {
+	case CX_ADD:    return a + b;
+	case CX_SUB:    return a - b;
+	case CX_SUB_UNSIGNED: return b > a ? 0 : a - b;
+	case CX_MUL:    return a * b;
+	case CX_DIV:    return a / b;
+	case CX_MOD:    return a % b;
+	case CX_AND:    return a && b;
+	case CX_OR:     return a || b;
+	case CX_BITAND: return a & b;
+	case CX_BITIOR: return a | b;
+	case CX_BITXOR: return a ^ b;
+	case CX_LT:     return a < b;
+	case CX_GT:     return a > b;
+	case CX_LTE:    return a <= b;
+	case CX_GTE:    return a >= b;
+	case CX_EQ:     return a == b;
+	case CX_NEQ:    return a != b;
+	}
+	return 0;
+}
+
+/*
+ * Map an expression handler to a compiled opcode. `operand` is set to the
+ * size of the handler's immediate operand.
+ */
+static int cx_opcode(void (*fn)(void), unsigned *operand)
+{
+	static const struct {
+		void (*fn)(void);
+		uint8_t op;
+		uint8_t operand;
+	} map[] = {
+		{ vm_expr_var16,             CX_VAR16,         1 },
+		{ vm_expr_var16_const16,     CX_VAR16,         2 },
+		{ vm_expr_var16_expr,        CX_VAR16_X,       0 },
+		{ vm_expr_sysvar16_const16,  CX_SYSVAR16,      2 },
+		{ vm_expr_sysvar16_expr,     CX_SYSVAR16_X,    0 },
+		{ vm_expr_var32,             CX_VAR32,         1 },
+		{ vm_expr_imm16,             CX_IMM,           2 },
+		{ vm_expr_imm32,             CX_IMM,           4 },
+		{ vm_expr_cflag,             CX_VAR4,          2 },
+		{ vm_expr_cflag_packed,      CX_VAR4_PACKED,   2 },
+		{ vm_expr_eflag,             CX_VAR4_X,        0 },
+		{ vm_expr_eflag_packed,      CX_VAR4_PACKED_X, 0 },
+		{ vm_expr_plus,              CX_ADD,           0 },
+		{ vm_expr_minus,             CX_SUB,           0 },
+		{ vm_expr_minus_unsigned,    CX_SUB_UNSIGNED,  0 },
+		{ vm_expr_mul,               CX_MUL,           0 },
+		{ vm_expr_div,               CX_DIV,           0 },
+		{ vm_expr_mod,               CX_MOD,           0 },
+		{ vm_expr_and,               CX_AND,           0 },
+		{ vm_expr_or,                CX_OR,            0 },
+		{ vm_expr_bitand,            CX_BITAND,        0 },
+		{ vm_expr_bitior,            CX_BITIOR,        0 },
+		{ vm_expr_bitxor,            CX_BITXOR,        0 },
+		{ vm_expr_lt,                CX_LT,            0 },
+		{ vm_expr_gt,                CX_GT,            0 },
+		{ vm_expr_lte,               CX_LTE,           0 },
+		{ vm_expr_gte,               CX_GTE,           0 },
+		{ vm_expr_eq,                CX_EQ,            0 },
+		{ vm_expr_neq,               CX_NEQ,           0 },
+	};
+	for (unsigned i = 0; i < ARRAY_SIZE(map); i++) {
+		if (map[i].fn == fn) {
+			*operand = map[i].operand;
+			return map[i].op;
+		}
+	}
+	return -1;
+}
+
+static bool cx_compile(struct vm_cexpr *e, uint32_t ptr, bool aiw)
+{
+	const uint8_t *code = memory.file_data;
+	// whether each stack slot is a constant (i.e. a single CX_IMM)
+	bool is_const[VM_CEXPR_MAX_DEPTH];
+	unsigned depth = 0;
+	unsigned n = 0;
+	uint32_t p = ptr;
+
+	while (true) {
+		if (p - ptr >= VM_CEXPR_MAX_BYTES || p >= MEMORY_FILE_DATA_SIZE)
+			return false;
+		uint8_t b = code[p++];
+		if (b == 0xff)
+			break;
+
+		unsigned operand = 0;
+		int op = CX_IMM;
+		uint32_t arg = b;
+		if (aiw && b < 0xe0) {
+			if (b >= 0xa0)
+				return false;
+			if (b >= 0x80) {
+				op = CX_VAR32;
+				arg = b - 0x80;
+			}
+		} else if (game->expr_op[b]) {
+			if ((op = cx_opcode(game->expr_op[b], &operand)) < 0)
+				return false;
+			if (p + operand - ptr > VM_CEXPR_MAX_BYTES || p + operand > MEMORY_FILE_DATA_SIZE)
+				return false;
+			if (operand == 1)
+				arg = code[p];
+			else if (operand == 2)
+				arg = le_get16(code, p);
+			else if (operand == 4)
+				arg = le_get32(code, p);
+			p += operand;
+		} else if (aiw) {
+			return false;
+		}
+
+		if (CX_IS_LOAD(op)) {
+			if (depth >= VM_CEXPR_MAX_DEPTH || n >= VM_CEXPR_MAX_INSNS)
+				return false;
+			e->insns[n++] = (struct vm_cexpr_insn) { op, arg };
+			is_const[depth++] = op == CX_IMM;
+		} else if (CX_IS_INDEXED(op)) {
+			if (depth < 1 || n >= VM_CEXPR_MAX_INSNS)
+				return false;
+			if (is_const[depth-1]) {
+				// constant index: resolve to a direct load
+				static const uint8_t direct[] = {
+					[CX_VAR4_X] = CX_VAR4,
+					[CX_VAR4_PACKED_X] = CX_VAR4_PACKED,
+					[CX_VAR16_X] = CX_VAR16,
+					[CX_SYSVAR16_X] = CX_SYSVAR16,
+				};
+				e->insns[n-1].op = direct[op];
+				is_const[depth-1] = false;
+			} else {
+				e->insns[n++] = (struct vm_cexpr_insn) { op, 0 };
+			}
+		} else {
+			if (depth < 2 || n >= VM_CEXPR_MAX_INSNS)
+				return false;
+			uint32_t b_val = e->insns[n-1].arg;
+			if (is_const[depth-1] && is_const[depth-2]
+					&& !((op == CX_DIV || op == CX_MOD) && b_val == 0)) {
+				// constant subexpression: fold
+				e->insns[n-2].arg = cx_binop(op, e->insns[n-2].arg, b_val);
+				n--;
+			} else {
+				e->insns[n++] = (struct vm_cexpr_insn) { op, 0 };
+				is_const[depth-2] = false;
+			}
+			depth--;
+		}
+	}
+	if (depth != 1)
+		return false;
+
+	e->nr_insns = n;
+	e->len = p - ptr;
+	memcpy(e->raw, code + ptr, e->len);
+	return true;
+}
+
+static uint32_t cx_run(const struct vm_cexpr_insn *in, unsigned nr_insns)
+{
+	// specialized shapes: `x` and `x op imm`
+	if (nr_insns == 1)
+		return cx_load(in[0].op, in[0].arg);
+	if (nr_insns == 3 && CX_IS_LOAD(in[0].op) && in[1].op == CX_IMM
+			&& CX_IS_BINOP(in[2].op))
+		return cx_binop(in[2].op, cx_load(in[0].op, in[0].arg), in[1].arg);
+
+	uint32_t stack[VM_CEXPR_MAX_DEPTH];
+	unsigned sp = 0;
+	for (unsigned i = 0; i < nr_insns; i++) {
+		uint8_t op = in[i].op;
+		if (CX_IS_LOAD(op)) {
+			stack[sp++] = cx_load(op, in[i].arg);
+		} else if (CX_IS_INDEXED(op)) {
+			stack[sp-1] = cx_load(op, stack[sp-1]);
+		} else {
+			sp--;
+			stack[sp-1] = cx_binop(op, stack[sp-1], stack[sp]);
+		}
+	}
+	return stack[0];
+}
+
+static uint32_t cx_exec(const struct vm_cexpr *e)
+{
+	return cx_run(e->insns, e->nr_insns);
+}
+
+/*
+ * Evaluate the expression at the instruction pointer using its compiled
+ * form. Returns false if the expression cannot be compiled, in which case
+ * it must be interpreted.
+ */
+static bool vm_eval_compiled(uint32_t *result, bool aiw)
+{
+	uint32_t ptr = vm.ip.ptr;
+	struct vm_cexpr *e = &vm_cexpr_cache[ptr % VM_CEXPR_CACHE_SIZE];
+	if (e->gen != vm_code_gen || e->ptr != ptr
+			|| (e->ok && memcmp(memory.file_data + ptr, e->raw, e->len))) {
+		e->gen = vm_code_gen;
+		e->ptr = ptr;
+		e->ok = cx_compile(e, ptr, aiw);
+	}
+	if (!e->ok)
+		return false;
+	*result = cx_exec(e);
+	if (unlikely(profile_enabled))
+		profile_expr_ops += e->nr_insns;
+	vm.ip.ptr += e->len;
+	return true;
+}
+
 uint32_t vm_eval(void)
 {
+	uint32_t r;
+	if (vm.ip.code == memory.file_data && !LOGGING && vm_eval_compiled(&r, false))
+		return r;
+
 	while (true) {
 		uint8_t op = vm_read_byte();
+		if (unlikely(profile_enabled))
+			profile_expr_ops++;
 		if (op == 0xff)
 			return vm_expr_end();
 		if (game->expr_op[op])
@@ -359,8 +691,14 @@ uint32_t vm_eval(void)
 
 uint32_t vm_eval_aiw(void)
 {
+	uint32_t r;
+	if (vm.ip.code == memory.file_data && !LOGGING && vm_eval_compiled(&r, true))
+		return r;
+
 	while (true) {
 		uint8_t op = vm_read_byte();
+		if (unlikely(profile_enabled))
+			profile_expr_ops++;
 		if (op == 0xff)
 			return vm_expr_end();
 		if (op < 0x80) {
@@ -379,16 +717,55 @@ uint32_t vm_eval_aiw(void)
 	return 0;
 }
 
-static void read_string_param(char *str, uint8_t term)
+/*
+ * Read a NUL-terminated string parameter. The returned string points into
+ * the code buffer and is not copied, but it is still limited to
+ * STRING_PARAM_SIZE (including the terminator) since handlers copy string
+ * parameters into fixed-size buffers.
+ */
+static const char *read_string_param(void)
+{
+	const char *str = (const char*)vm.ip.code + vm.ip.ptr;
+	size_t len = strnlen(str, memory_end - (const uint8_t*)str);
+	if (unlikely((const uint8_t*)str + len >= memory_end))
+		VM_ERROR("Unterminated string parameter");
+	if (unlikely(len >= STRING_PARAM_SIZE))
+		VM_ERROR("String parameter overflowed buffer");
+	if (LOGGING) {
+		for (size_t i = 0; i <= len; i++) {
+			backlog_push_byte(str[i]);
+		}
+	}
+	vm.ip.ptr += len + 1;
+	return str;
+}
+
+/*
+ * AIW string parameters are terminated by 0xff rather than NUL, so they are
+ * copied out of the code buffer. Statements nest (e.g. procedure calls), so
+ * the copies are allocated from a stack which vm_exec_aiw unwinds after each
+ * statement.
+ */
+#define AIW_STR_STACK_SIZE 8192
+static char aiw_str_stack[AIW_STR_STACK_SIZE];
+static unsigned aiw_str_top = 0;
+
+static const char *read_string_param_aiw(void)
 {
+	char *str = aiw_str_stack + aiw_str_top;
+	size_t avail = min(STRING_PARAM_SIZE, AIW_STR_STACK_SIZE - aiw_str_top);
 	size_t str_i = 0;
 	uint8_t c;
-	for (str_i = 0; (c = vm_read_byte()) != term; str_i++) {
-		if (unlikely(str_i >= STRING_PARAM_SIZE))
+	if (unlikely(!avail))
+		VM_ERROR("String parameter overflowed buffer");
+	for (str_i = 0; (c = vm_read_byte()) != 0xff; str_i++) {
+		if (unlikely(str_i + 1 >= avail))
 			VM_ERROR("String parameter overflowed buffer");
 		str[str_i] = c;
 	}
 	str[str_i] = '\0';
+	aiw_str_top += str_i + 1;
+	return str;
 }
 
 void vm_read_params(struct param_list *params)
@@ -402,7 +779,7 @@ void vm_read_params(struct param_list *params)
 		if (b == MES_PARAM_EXPRESSION) {
 			params->params[i].val = game->vm.eval();
 		} else {
-			read_string_param(params->params[i].str, 0);
+			params->params[i].str = read_string_param();
 		}
 	}
 	params->nr_params = i;
@@ -418,7 +795,7 @@ void vm_read_params_aiw(struct param_list *params)
 		if (b == 0xf5) {
 			vm_read_byte();
 			params->params[i].type = MES_PARAM_STRING;
-			read_string_param(params->params[i].str, 0xff);
+			params->params[i].str = read_string_param_aiw();
 		} else {
 			params->params[i].type = MES_PARAM_EXPRESSION;
 			params->params[i].val = game->vm.eval();
@@ -428,9 +805,9 @@ void vm_read_params_aiw(struct param_list *params)
 	vm_read_byte();
 }
 
-char *vm_string_param(struct param_list *params, int i)
+const char *vm_string_param(struct param_list *params, int i)
 {
-	if (params->nr_params < i)
+	if (params->nr_params <= i)
 		VM_ERROR("Too few parameters");
 	if (params->params[i].type != MES_PARAM_STRING)
 		VM_ERROR("Expected string parameter");
@@ -967,7 +1344,7 @@ void vm_stmt_jmp(void)
 static void _vm_stmt_sys(void)
 {
 	uint32_t no = game->vm.eval();
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 
 	if (unlikely(no >= GAME_MAX_SYS))
@@ -975,7 +1352,9 @@ static void _vm_stmt_sys(void)
 	if (unlikely(!game->sys[no]))
 		VM_ERROR("System.function[%u] not implemented", no);
 
+	unsigned prof = profile_push(PROFILE_SYS, no, 0);
 	game->sys[no](&params);
+	profile_pop(prof);
 }
 
 void vm_stmt_sys(void)
@@ -1003,7 +1382,7 @@ void vm_stmt_sys_old_log(void)
 
 void vm_stmt_mesjmp(void)
 {
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 
 	vm_load_mes(vm_string_param(&params, 0));
@@ -1013,7 +1392,7 @@ void vm_stmt_mesjmp(void)
 
 static void _vm_stmt_mescall(bool save_procedures)
 {
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 	vm_string_param(&params, 0);
 
@@ -1029,7 +1408,9 @@ static void _vm_stmt_mescall(bool save_procedures)
 	vm.ip.ptr = 0;
 	vm.ip.code = memory.file_data;
 	vm_load_mes(params.params[0].str);
+	unsigned prof = profile_push_mes(mem_mes_name());
 	game->vm.exec();
+	profile_pop(prof);
 
 	// restore previous VM state
 	frame = &vm.mes_call_stack[--vm.mes_call_stack_ptr];
@@ -1058,7 +1439,7 @@ void vm_stmt_mescall_save_procedures(void)
 
 void vm_stmt_defmenu(void)
 {
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 	uint32_t addr = vm_read_dword();
 	menu_define(vm_expr_param(&params, 0), addr == vm.ip.ptr + 1);
@@ -1091,7 +1472,9 @@ void vm_call_procedure(unsigned no)
 
 	struct vm_pointer saved_ip = vm.ip;
 	vm.ip = vm.procedures[no];
+	unsigned prof = profile_push(PROFILE_PROC, no, vm.ip.ptr);
 	game->vm.exec();
+	profile_pop(prof);
 	vm.ip = saved_ip;
 }
 
@@ -1100,7 +1483,7 @@ void vm_stmt_call(void)
 	bool flag_on = vm_flag_is_on(FLAG_PROC_CLEAR);
 	vm_flag_off(FLAG_PROC_CLEAR);
 
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 	vm_call_procedure(vm_expr_param(&params, 0));
 
@@ -1115,7 +1498,7 @@ void vm_stmt_call_old_log(void)
 		if (vm_flag_is_on(FLAG_LOG_ENABLE))
 			backlog_push_byte(mes_code_tables.stmt_op_to_int[MES_STMT_CALL_PROC]);
 	}
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 	if (vm_flag_is_on(FLAG_LOG))
 		vm_flag_off(FLAG_LOG);
@@ -1124,7 +1507,7 @@ void vm_stmt_call_old_log(void)
 
 void vm_stmt_util(void)
 {
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 	if (unlikely(params.nr_params < 1))
 		VM_ERROR("Util without parameters");
@@ -1133,7 +1516,9 @@ void vm_stmt_util(void)
 		VM_ERROR("Invalid Util number: %u", no);
 	if (unlikely(!game->util[no]))
 		VM_ERROR("Util.function[%u] not implemented", no);
+	unsigned prof = profile_push(PROFILE_UTIL, no, 0);
 	game->util[no](&params);
+	profile_pop(prof);
 }
 
 void vm_stmt_line(void)
@@ -1176,7 +1561,262 @@ void vm_stmt_menuexec(void)
 	menu_exec();
 }
 
-bool vm_exec_statement(void)
+/*
+ * Statement translation. The shared handlers for branches and variable
+ * assignments are translated the first time a statement executes: its
+ * operands are parsed and its expressions compiled into a vm_insn, which
+ * carries the function that executes it. Later executions of the statement
+ * skip the opcode table and operand decoding entirely. Statements with other
+ * handlers, or with expressions that can't be compiled, are interpreted.
+ *
+ * Like a compiled expression, a translated statement keeps a copy of the
+ * bytes it was decoded from and is only used while they are unchanged, so
+ * scripts writing into file_data fall back to the interpreter. Translations
+ * are discarded on every file load, and bypassed while logging since the
+ * backlog records the raw bytes of each statement. The translated statements
+ * only branch and assign to variables.
+ */
+#define VM_INSN_CACHE_SIZE 1024
+#define VM_INSN_MAX_BYTES 64
+#define VM_INSN_MAX_EXPRS 8
+#define VM_INSN_MAX_OPS 32
+
+enum vm_insn_dst {
+	INSN_VAR4,
+	INSN_VAR4_PACKED,
+	INSN_VAR16,
+	INSN_SYSVAR16,
+	INSN_VAR32,
+};
+
+enum vm_insn_val {
+	INSN_VAL,
+	INSN_VAL_WRAP4,
+	INSN_VAL_SAT4,
+	INSN_VAL_SAT16,
+};
+
+struct vm_insn {
+	uint32_t gen;
+	uint32_t ptr;
+	// NULL if the statement could not be translated
+	void (*exec)(const struct vm_insn *in);
+	// address of the following statement
+	uint32_t next;
+	// branch target
+	uint32_t target;
+	// assignments: the first index is either a constant or expression 0
+	uint8_t dst;
+	uint8_t val;
+	bool index_expr;
+	bool index_signed;
+	uint32_t index;
+	uint32_t index_mask;
+	// expression i is ops[expr[i]] .. ops[expr[i+1]-1]
+	uint8_t nr_exprs;
+	uint8_t expr[VM_INSN_MAX_EXPRS+1];
+	struct vm_cexpr_insn ops[VM_INSN_MAX_OPS];
+	uint8_t len;
+	uint8_t raw[VM_INSN_MAX_BYTES];
+};
+
+static struct vm_insn vm_insn_cache[VM_INSN_CACHE_SIZE];
+
+/*
+ * Assignment statements which can be translated. The index of the first
+ * variable is either a constant of `index` bytes or an expression, and the
+ * values are a list of expressions (separated by nonzero bytes, or for AIW
+ * terminated by 0xff).
+ */
+static const struct {
+	void (*fn)(void);
+	uint8_t dst;
+	uint8_t val;
+	uint8_t index;
+	bool index_signed;
+	uint32_t index_mask;
+	bool aiw_list;
+	bool single;
+} insn_assign_stmt[] = {
+	{ vm_stmt_set_flag_const16,               INSN_VAR4,        INSN_VAL,       2, false, 0xffff },
+	{ vm_stmt_set_flag_const16_4bit_wrap,     INSN_VAR4,        INSN_VAL_WRAP4, 2, false, 0xffff },
+	{ vm_stmt_set_flag_const16_4bit_saturate, INSN_VAR4,        INSN_VAL_SAT4,  2, false, 0xffff },
+	{ vm_stmt_set_flag_expr,                  INSN_VAR4,        INSN_VAL,       0, true,  0xffffffff },
+	{ vm_stmt_set_flag_expr_4bit_wrap,        INSN_VAR4,        INSN_VAL_WRAP4, 0, true,  0xffffffff },
+	{ vm_stmt_set_flag_expr_4bit_saturate,    INSN_VAR4,        INSN_VAL_SAT4,  0, true,  0xffffffff },
+	{ vm_stmt_set_flag_const16_aiw,           INSN_VAR4_PACKED, INSN_VAL_SAT4,  2, false, 0xffff, true },
+	{ vm_stmt_set_flag_expr_aiw,              INSN_VAR4_PACKED, INSN_VAL_SAT4,  0, true,  0xffffffff, true },
+	{ vm_stmt_set_var16_const8,               INSN_VAR16,       INSN_VAL,       1, false, 0xff },
+	{ vm_stmt_set_var16_const16_aiw,          INSN_VAR16,       INSN_VAL_SAT16, 2, false, 0xffff, true },
+	{ vm_stmt_set_var16_expr_aiw,             INSN_VAR16,       INSN_VAL_SAT16, 0, false, 0xffffffff, true },
+	{ vm_stmt_set_var32_const8,               INSN_VAR32,       INSN_VAL,       1, true,  0xffffffff },
+	{ vm_stmt_set_var32_const8_aiw,           INSN_VAR32,       INSN_VAL,       1, false, 0xff, false, true },
+	{ vm_stmt_set_sysvar16_const16_aiw,       INSN_SYSVAR16,    INSN_VAL_SAT16, 2, false, 0xffff, true },
+	{ vm_stmt_set_sysvar16_expr_aiw,          INSN_SYSVAR16,    INSN_VAL_SAT16, 0, true,  0xffffffff, true },
+};
+
+static uint32_t insn_eval(const struct vm_insn *in, unsigned i)
+{
+	unsigned n = in->expr[i+1] - in->expr[i];
+	if (unlikely(profile_enabled))
+		profile_expr_ops += n;
+	return cx_run(in->ops + in->expr[i], n);
+}
+
+static void insn_jmp(const struct vm_insn *in)
+{
+	vm.ip.ptr = in->target;
+}
+
+static void insn_jz(const struct vm_insn *in)
+{
+	vm.ip.ptr = insn_eval(in, 0) == 1 ? in->next : in->target;
+}
+
+// same bounds check as the interpreted handlers, including index signedness
+static bool insn_dst_valid(const struct vm_insn *in, uint32_t i)
+{
+	uint8_t *base;
+	int size;
+	switch (in->dst) {
+	case INSN_VAR4:
+	case INSN_VAR4_PACKED: base = memory_ptr.var4;         size = 1; break;
+	case INSN_VAR16:       base = memory_ptr.var16;        size = 2; break;
+	case INSN_SYSVAR16:    base = memory_ptr.system_var16; size = 2; break;
+	default:               base = memory_ptr.var32;        size = 4; break;
+	}
+	if (in->index_signed)
+		return mem_ptr_valid(base + (int32_t)i * size, size);
+	return mem_ptr_valid(base + i * size, size);
+}
+
+static void insn_assign(const struct vm_insn *in)
+{
+	unsigned e = 0;
+	uint32_t i = in->index_expr ? insn_eval(in, e++) : in->index;
+	for (; e < in->nr_exprs; e++) {
+		if (unlikely(!insn_dst_valid(in, i)))
+			VM_ERROR("Out of bounds write");
+		uint32_t v = insn_eval(in, e);
+		switch (in->val) {
+		case INSN_VAL_WRAP4: v &= 0xf; break;
+		case INSN_VAL_SAT4:  v = min(v, 0xf); break;
+		case INSN_VAL_SAT16: v = min(v, 0xffff); break;
+		}
+		switch (in->dst) {
+		case INSN_VAR4:        mem_set_var4(i, v); break;
+		case INSN_VAR4_PACKED: mem_set_var4_packed(i, v); break;
+		case INSN_VAR16:       mem_set_var16(i, v); break;
+		case INSN_SYSVAR16:    mem_set_sysvar16(i, v); break;
+		case INSN_VAR32:       mem_set_var32(i, v); break;
+		}
+		i = (i + 1) & in->index_mask;
+	}
+	vm.ip.ptr = in->next;
+}
+
+static bool insn_compile_expr(struct vm_insn *in, uint32_t *p, bool aiw)
+{
+	struct vm_cexpr e;
+	if (in->nr_exprs >= VM_INSN_MAX_EXPRS || !cx_compile(&e, *p, aiw))
+		return false;
+	unsigned start = in->expr[in->nr_exprs];
+	if (start + e.nr_insns > VM_INSN_MAX_OPS)
+		return false;
+	memcpy(in->ops + start, e.insns, e.nr_insns * sizeof(e.insns[0]));
+	in->expr[++in->nr_exprs] = start + e.nr_insns;
+	*p += e.len;
+	return true;
+}
+
+static bool insn_translate(struct vm_insn *in, uint32_t ptr)
+{
+	const uint8_t *code = memory.file_data;
+	const uint32_t end = min(MEMORY_FILE_DATA_SIZE, ptr + VM_INSN_MAX_BYTES);
+	bool aiw = game->vm.eval == vm_eval_aiw;
+	if (!aiw && game->vm.eval != vm_eval)
+		return false;
+	if (ptr >= end)
+		return false;
+
+	void (*fn)(void) = game->stmt_op[code[ptr]];
+	if (!fn)
+		return false;
+	uint32_t p = ptr + 1;
+	in->nr_exprs = 0;
+	in->expr[0] = 0;
+
+	if (fn == vm_stmt_jmp || fn == vm_stmt_jz) {
+		if (fn == vm_stmt_jz && !insn_compile_expr(in, &p, aiw))
+			return false;
+		if (p + 4 > end)
+			return false;
+		in->target = le_get32(code, p);
+		p += 4;
+		in->exec = fn == vm_stmt_jz ? insn_jz : insn_jmp;
+		goto done;
+	}
+
+	for (unsigned s = 0; s < ARRAY_SIZE(insn_assign_stmt); s++) {
+		if (insn_assign_stmt[s].fn != fn)
+			continue;
+		in->dst = insn_assign_stmt[s].dst;
+		in->val = insn_assign_stmt[s].val;
+		in->index_signed = insn_assign_stmt[s].index_signed;
+		in->index_mask = insn_assign_stmt[s].index_mask;
+		in->index_expr = !insn_assign_stmt[s].index;
+		if (in->index_expr) {
+			if (!insn_compile_expr(in, &p, aiw))
+				return false;
+		} else {
+			if (p + insn_assign_stmt[s].index > end)
+				return false;
+			in->index = insn_assign_stmt[s].index == 1 ? code[p] : le_get16(code, p);
+			p += insn_assign_stmt[s].index;
+		}
+		while (true) {
+			if (!insn_compile_expr(in, &p, aiw) || p >= end)
+				return false;
+			if (insn_assign_stmt[s].single)
+				break;
+			if (insn_assign_stmt[s].aiw_list) {
+				if (code[p] == 0xff) {
+					p++;
+					break;
+				}
+			} else if (!code[p++]) {
+				break;
+			}
+		}
+		in->exec = insn_assign;
+		goto done;
+	}
+	return false;
+done:
+	in->next = p;
+	in->len = p - ptr;
+	memcpy(in->raw, code + ptr, in->len);
+	return true;
+}
+
+/*
+ * Get the translation of the statement at `ptr`, or NULL if it must be
+ * interpreted.
+ */
+static const struct vm_insn *insn_lookup(uint32_t ptr)
+{
+	struct vm_insn *in = &vm_insn_cache[ptr % VM_INSN_CACHE_SIZE];
+	if (in->gen != vm_code_gen || in->ptr != ptr
+			|| (in->exec && memcmp(memory.file_data + ptr, in->raw, in->len))) {
+		in->gen = vm_code_gen;
+		in->ptr = ptr;
+		if (!insn_translate(in, ptr))
+			in->exec = NULL;
+	}
+	return in->exec ? in : NULL;
+}
+
+static bool _vm_exec_statement(void)
 {
 #if 0
 	if (!game_is_aiwin() || vm.ip.code[vm.ip.ptr] != 0x13) {
@@ -1195,7 +1835,16 @@ bool vm_exec_statement(void)
 	}
 #endif
 
+	vm_update_logging();
+	if (!LOGGING && vm.ip.code == memory.file_data) {
+		const struct vm_insn *in = insn_lookup(vm.ip.ptr);
+		if (in) {
+			in->exec(in);
+			return true;
+		}
+	}
 	uint8_t op = vm_peek_byte();
+
 retry:
 	if (unlikely(!game->stmt_op[op])) {
 		if (op == game->vm.end_code)
@@ -1222,11 +1871,24 @@ retry:
 	return true;
 }
 
+bool vm_exec_statement(void)
+{
+	if (likely(!profile_enabled))
+		return _vm_exec_statement();
+	// unprefixed text is counted as a single pseudo-statement
+	uint8_t op = vm_peek_byte();
+	unsigned prof = _profile_push(PROFILE_STMT, game->stmt_op[op] ? op : 0x100, 0);
+	bool r = _vm_exec_statement();
+	profile_pop(prof);
+	return r;
+}
+
 void vm_peek(void)
 {
 	handle_events();
 	anim_execute();
 	audio_update();
+	fade_tick();
 
 	// XXX: prevent re-entrant update calls
 	static bool in_game_update = false;
@@ -1239,9 +1901,29 @@ void vm_peek(void)
 	gfx_update();
 }
 
+// nesting level of vm_exec/vm_exec_aiw (save states are only safe at level 1)
+static unsigned exec_depth = 0;
+// address of the statement being executed at level 1
+static struct vm_pointer top_level_ip;
+
+/*
+ * Returns false if a nested call is in progress (in which case part of the
+ * VM state lives on the C stack).
+ */
+bool vm_is_top_level(void)
+{
+	return exec_depth == 1;
+}
+
+struct vm_pointer vm_top_level_ip(void)
+{
+	return top_level_ip;
+}
+
 void vm_exec(void)
 {
 	vm.scope_counter++;
+	exec_depth++;
 	while (true) {
 		if (vm_flag_is_on(FLAG_RETURN)) {
 			if (vm.scope_counter != 1)
@@ -1249,10 +1931,15 @@ void vm_exec(void)
 			vm_flag_off(FLAG_RETURN);
 			vm.ip.ptr = 0;
 		}
+		if (exec_depth == 1)
+			top_level_ip = vm.ip;
 		if (!vm_exec_statement())
 			break;
 		vm_peek();
+		if (exec_depth == 1)
+			savestate_poll();
 	}
+	exec_depth--;
 	vm.scope_counter--;
 }
 
@@ -1267,14 +1954,14 @@ void vm_mesjmp_aiw(const char *name)
 
 void vm_stmt_mesjmp_aiw(void)
 {
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 	vm_mesjmp_aiw(vm_string_param(&params, 0));
 }
 
 void vm_stmt_mescall_aiw(void)
 {
-	struct param_list params = {0};
+	struct param_list params;
 	game->vm.read_params(&params);
 	vm_string_param(&params, 0);
 
@@ -1288,7 +1975,9 @@ void vm_stmt_mescall_aiw(void)
 	vm.ip.ptr = 0;
 	vm.ip.code = memory.file_data;
 	vm_load_mes(params.params[0].str);
+	unsigned prof = profile_push_mes(mem_mes_name());
 	game->vm.exec();
+	profile_pop(prof);
 
 	// restore previous VM state
 	frame = &vm.mes_call_stack[--vm.mes_call_stack_ptr];
@@ -1302,8 +1991,14 @@ void vm_stmt_mescall_aiw(void)
 
 void vm_exec_aiw(void)
 {
+	exec_depth++;
 	while (true) {
-		if (!vm_exec_statement())
+		unsigned str_top = aiw_str_top;
+		if (exec_depth == 1)
+			top_level_ip = vm.ip;
+		bool r = vm_exec_statement();
+		aiw_str_top = str_top;
+		if (!r)
 			break;
 		if (load_next_mes) {
 			vm_load_mes(next_mes);
@@ -1312,5 +2007,8 @@ void vm_exec_aiw(void)
 			next_mes[0] = '\0';
 		}
 		vm_peek();
+		if (exec_depth == 1)
+			savestate_poll();
 	}
+	exec_depth--;
 }
@@ -577,9 +577,8 @@ static void util_yume(struct param_list *params)
 		yuno_draw_text(text[i]);
 		gfx_display_fade_in(1000);
 
-		// wait for input
-		struct param_list wait_params = { .nr_params = 0 };
-		sys_wait(&wait_params);
+		// wait for input (not a rewind point: the text was drawn by this statement)
+		sys_wait_for_click(false);
 
 		// fade out
 		gfx_display_fade_out(0, 1000);